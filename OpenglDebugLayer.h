@@ -0,0 +1,472 @@
+//
+//  OpenglDebugLayer.h
+//  OpenglFramework
+//
+
+/*
+ class information
+ - GL_CHECK and checkOpenGLError() live here, every layer reports its errors through them
+ - without KHR_debug nothing changes - DEBUG builds poll glGetError() after every GL_CHECK statement
+ - init() installs a KHR_debug message callback when the context has one (opengl 4.3 or GL_KHR_debug). the
+   context is asked at runtime so a 4.1 build picks the callback up on newer drivers, as long as the headers
+   declare KHR_debug. glGetError() is not called after that, the driver reports errors and warnings itself.
+   with synchronous output a message is reported against the GL_CHECK statement that caused it
+ - asynchronous output does not hold the driver up so it can stay on outside of DEBUG builds - the messages
+   then have no statement
+ - while the callback is installed the layers label what they create (glObjectLabel) and the draw layer puts
+   a debug group around every state bucket, so captures in renderdoc/nsight read by name
+ - messages below the minimum severity are dropped by the driver, single messages with ignoreMessage()
+ - only one debug layer can be initialised at a time, the callback is global to the context
+ - many drivers only send messages to a debug context - create the context with the debug flag
+   (glfw: GLFW_OPENGL_DEBUG_CONTEXT)
+ */
+
+#ifndef OpenglDebugLayer_h
+#define OpenglDebugLayer_h
+
+// generic includes
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <assert.h>
+
+// platform dependent includes
+#ifdef __APPLE__
+#include <OpenGL/gl3.h>
+#include <OpenGL/gl3ext.h>
+#elif _WIN32
+#include "GL/glew.h"
+#endif
+
+// defines
+#ifndef OPENGL_MAJOR_VERSION
+#define OPENGL_MAJOR_VERSION 4
+#endif
+#ifndef OPENGL_MINOR_VERSION
+#define OPENGL_MINOR_VERSION 1
+#endif
+
+#ifndef OPENGL_INVALID_OBJECT
+#define OPENGL_INVALID_OBJECT 0
+#endif
+
+// compares against the version the layers are compiled for - true for every later version, 5.0 included
+#define OPENGL_VERSION_AT_LEAST(major, minor) ((OPENGL_MAJOR_VERSION * 10 + OPENGL_MINOR_VERSION) >= ((major) * 10 + (minor)))
+
+// the headers declare KHR_debug - whether the context has it is only known once init() asks it
+#if OPENGL_VERSION_AT_LEAST(4, 3) || defined(GL_KHR_debug)
+#define OPENGL_KHR_DEBUG 1
+#else
+#define OPENGL_KHR_DEBUG 0
+#endif
+
+#ifdef _WIN32
+#define OPENGL_DEBUG_APIENTRY __stdcall
+#else
+#define OPENGL_DEBUG_APIENTRY
+#endif
+
+#ifndef GL_CHECK
+#ifdef DEBUG
+#define GL_CHECK(stmt) do { ::glLayer::markOpenGLStatement(#stmt,__FILE__,__LINE__); stmt; ::glLayer::checkOpenGLError(#stmt,__FILE__,__LINE__); } while(0)
+#else
+#define GL_CHECK(stmt) stmt
+#endif//DEBUG
+#endif//GL_CHECK
+
+namespace glLayer {
+    
+    enum class DebugSeverity : uint32_t {
+        NOTIFICATION = 0,
+        LOW          = 1,
+        MEDIUM       = 2,
+        HIGH         = 3
+    };
+    
+    // the object identifiers of glObjectLabel - the values are the KHR_debug ones so they exist in 4.1 headers too
+    enum class DebugObject : GLenum {
+        BUFFER       = 0x82E0,
+        SHADER       = 0x82E1,
+        PROGRAM      = 0x82E2,
+        VERTEX_ARRAY = 0x8074,
+        QUERY        = 0x82E3,
+        SAMPLER      = 0x82E6,
+        TEXTURE      = 0x1702
+    };
+    
+    struct DebugMessage {
+        GLenum        source;
+        GLenum        type;
+        GLuint        id;
+        DebugSeverity severity;
+        const char *  text;
+        const char *  statement; // the GL_CHECK statement that caused it - null for asynchronous output and release builds
+        const char *  file;
+        int           line;
+    };
+    
+    typedef void (*DebugMessageHandler)(DebugMessage const & message, void * userData);
+    
+    // shared by every layer - a function local static keeps the layers header only
+    struct DebugState {
+        bool                callbackInstalled = false;
+        bool                synchronous       = false;
+        bool                groups            = false;
+        const char *        statement         = nullptr;
+        const char *        file              = nullptr;
+        int                 line              = 0;
+        DebugMessageHandler handler           = nullptr;
+        void *              userData          = nullptr;
+        uint64_t            messageCounts[4]  = {0, 0, 0, 0};
+    };
+    
+    inline DebugState & debugState() {
+        static DebugState state;
+        return state;
+    }
+    
+    // remembers the statement GL_CHECK is about to run so a synchronous message can be put against it
+    inline void markOpenGLStatement(const char * stmt, const char * fname, int line) {
+        DebugState & state = debugState();
+        state.statement = stmt;
+        state.file      = fname;
+        state.line      = line;
+    }
+    
+    inline void checkOpenGLError(const char * stmt, const char * fname, int line) {
+        DebugState & state = debugState();
+        state.statement = nullptr;
+        
+        // the callback has already reported anything the statement did - glGetError() is only the fallback
+        if(state.callbackInstalled) {
+            return;
+        }
+        
+        GLenum err;
+        
+        while((err = glGetError()) != GL_NO_ERROR) {
+            std::string errorType;
+            
+            switch(err) {
+                case GL_INVALID_OPERATION:             errorType = "INVALID_OPERATION";             break;
+                case GL_INVALID_ENUM:                  errorType = "INVALID_ENUM";                  break;
+                case GL_INVALID_VALUE:                 errorType = "INVALID_VALUE";                 break;
+                case GL_OUT_OF_MEMORY:                 errorType = "OUT_OF_MEMORY";                 break;
+                case GL_INVALID_FRAMEBUFFER_OPERATION: errorType = "INVALID_FRAMEBUFFER_OPERATION"; break;
+                default:                               errorType = "UKNOWN ERROR - FUCK SAKE";      break;
+            }
+            
+            std::cerr << "-----------------------------------------------------------------------------\nOPENGL ERROR: "<< errorType
+            << "\nFilename: " << fname
+            << "\nline: " << line
+            << "\nerror on: " << stmt
+            << "\n-----------------------------------------------------------------------------"
+            << std::endl;
+        }
+    }
+    
+    // asks the current context rather than the compile time version - for entry points the headers declare
+    // but an older driver may not have. extension can be null
+    inline bool contextSupports(GLint major, GLint minor, const char * extension) {
+        GLint contextMajor = 0;
+        GLint contextMinor = 0;
+        GL_CHECK(glGetIntegerv(GL_MAJOR_VERSION, &contextMajor));
+        GL_CHECK(glGetIntegerv(GL_MINOR_VERSION, &contextMinor));
+        
+        if(contextMajor > major || (contextMajor == major && contextMinor >= minor)) {
+            return true;
+        }
+        if(extension == nullptr) {
+            return false;
+        }
+        
+        GLint count = 0;
+        GL_CHECK(glGetIntegerv(GL_NUM_EXTENSIONS, &count));
+        
+        for(GLint i = 0; i < count; i++) {
+            const GLubyte * name;
+            GL_CHECK(name = glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+            if(name != nullptr && std::strcmp(reinterpret_cast<const char *>(name), extension) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // check before building a label string, labelObject() is already a no-op while this is false
+    inline bool debugLabelsEnabled() {
+        return debugState().callbackInstalled;
+    }
+    
+    // names the object in debug messages and frame captures - nothing happens while the callback is not installed
+    inline void labelObject(DebugObject identifier, GLuint name, const char * label) {
+#if OPENGL_KHR_DEBUG
+        if(debugLabelsEnabled() && name != 0) {
+            GL_CHECK(glObjectLabel(static_cast<GLenum>(identifier), name, -1, label));
+        }
+#else
+        (void)identifier;
+        (void)name;
+        (void)label;
+#endif
+    }
+    
+    inline void labelObject(DebugObject identifier, GLuint name, std::string const & label) {
+        labelObject(identifier, name, label.c_str());
+    }
+    
+    // check before building a group name, pushing and popping are already no-ops while this is false
+    inline bool debugGroupsEnabled() {
+        return debugState().groups;
+    }
+    
+    inline void pushDebugGroup(const char * name) {
+#if OPENGL_KHR_DEBUG
+        if(debugState().groups) {
+            GL_CHECK(glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name));
+        }
+#else
+        (void)name;
+#endif
+    }
+    
+    inline void popDebugGroup() {
+#if OPENGL_KHR_DEBUG
+        if(debugState().groups) {
+            GL_CHECK(glPopDebugGroup());
+        }
+#endif
+    }
+    
+    // pushes a debug group for the lifetime of the object
+    class DebugGroup {
+    public:
+        explicit DebugGroup(const char * name) {
+            pushDebugGroup(name);
+        }
+        
+        ~DebugGroup() {
+            popDebugGroup();
+        }
+        
+        DebugGroup(DebugGroup const &) = delete;
+        DebugGroup & operator=(DebugGroup const &) = delete;
+    };
+    
+    class OpenglDebugLayer {
+    public:
+        OpenglDebugLayer() : m_initialised(false)
+        {
+        }
+        
+        ~OpenglDebugLayer() {
+            dispose();
+        }
+        
+        OpenglDebugLayer(OpenglDebugLayer const &) = delete;
+        OpenglDebugLayer & operator=(OpenglDebugLayer const &) = delete;
+        
+        /*
+         installs the message callback. returns false when the context or the build has no KHR_debug - GL_CHECK
+         keeps polling glGetError() in DEBUG builds then. synchronous output makes the driver report a message
+         before the call that caused it returns, which is slower but points at the statement.
+         */
+        bool init(bool synchronous = true, DebugSeverity minimum = DebugSeverity::LOW) {
+            if(m_initialised) {
+                assert(false && "double init you noob");
+                return false;
+            }
+            
+            DebugState & state = debugState();
+            assert(!state.callbackInstalled && "another debug layer already installed the callback");
+
+#if OPENGL_KHR_DEBUG
+            if(!contextHasDebugOutput()) {
+                std::cout << "OpenglDebugLayer: KHR_debug not found D: - falling back to glGetError()" << std::endl;
+                return false;
+            }
+            
+            GL_CHECK(glEnable(GL_DEBUG_OUTPUT));
+            if(synchronous) {
+                GL_CHECK(glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS));
+            } else {
+                GL_CHECK(glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS));
+            }
+            GL_CHECK(glDebugMessageCallback(messageCallback, nullptr));
+            
+            // our own debug groups would otherwise come back as notifications
+            GL_CHECK(glDebugMessageControl(GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_PUSH_GROUP, GL_DONT_CARE, 0, NULL, GL_FALSE));
+            GL_CHECK(glDebugMessageControl(GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_POP_GROUP,  GL_DONT_CARE, 0, NULL, GL_FALSE));
+            
+            state.callbackInstalled = true;
+            state.synchronous       = synchronous;
+            state.groups            = true;
+            m_initialised           = true;
+            
+            setMinimumSeverity(minimum);
+            return m_initialised;
+#else
+            (void)state;
+            (void)synchronous;
+            (void)minimum;
+            std::cout << "OpenglDebugLayer: KHR_debug not declared by the opengl headers D: - falling back to glGetError()" << std::endl;
+            return false;
+#endif
+        }
+        
+        void dispose() {
+            if(!m_initialised) {
+                return;
+            }
+
+#if OPENGL_KHR_DEBUG
+            GL_CHECK(glDebugMessageCallback(NULL, NULL));
+            GL_CHECK(glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS));
+            GL_CHECK(glDisable(GL_DEBUG_OUTPUT));
+            
+            // the callback has reported these already - the glGetError() fallback would report them again
+            while(glGetError() != GL_NO_ERROR) {
+            }
+#endif
+            
+            DebugState & state = debugState();
+            state.callbackInstalled = false;
+            state.synchronous       = false;
+            state.groups            = false;
+            state.handler           = nullptr;
+            state.userData          = nullptr;
+            m_initialised           = false;
+        }
+        
+        bool isCallbackInstalled() const {
+            return m_initialised;
+        }
+        
+        // the handler is called on the thread that made the call - nullptr prints to std::cerr
+        void setMessageHandler(DebugMessageHandler handler, void * userData = nullptr) {
+            debugState().handler  = handler;
+            debugState().userData = userData;
+        }
+        
+        void setMinimumSeverity(DebugSeverity minimum) {
+            if(!m_initialised) {
+                return;
+            }
+
+#if OPENGL_KHR_DEBUG
+            const GLenum severities[] = {GL_DEBUG_SEVERITY_NOTIFICATION, GL_DEBUG_SEVERITY_LOW, GL_DEBUG_SEVERITY_MEDIUM, GL_DEBUG_SEVERITY_HIGH};
+            
+            for(uint32_t i = 0; i < 4; i++) {
+                GLboolean enabled = i >= static_cast<uint32_t>(minimum) ? GL_TRUE : GL_FALSE;
+                GL_CHECK(glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, severities[i], 0, NULL, enabled));
+            }
+#else
+            (void)minimum;
+#endif
+        }
+        
+        // drops one message the driver keeps sending - source and type are the GL_DEBUG_SOURCE_* and GL_DEBUG_TYPE_* values
+        void ignoreMessage(GLenum source, GLenum type, GLuint id) {
+            if(!m_initialised) {
+                return;
+            }
+
+#if OPENGL_KHR_DEBUG
+            GL_CHECK(glDebugMessageControl(source, type, GL_DONT_CARE, 1, &id, GL_FALSE));
+#else
+            (void)source;
+            (void)type;
+            (void)id;
+#endif
+        }
+        
+        void setDebugGroupsEnabled(bool enabled) {
+            debugState().groups = m_initialised && enabled;
+        }
+        
+        uint64_t getMessageCount(DebugSeverity severity) const {
+            return debugState().messageCounts[static_cast<uint32_t>(severity)];
+        }
+    
+    private:
+        bool m_initialised;
+
+#if OPENGL_KHR_DEBUG
+        // queries the context itself - the information layer reports through GL_CHECK so it sits above this header
+        static bool contextHasDebugOutput() {
+            return contextSupports(4, 3, "GL_KHR_debug");
+        }
+        
+        static void OPENGL_DEBUG_APIENTRY messageCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar * text, const void * userParam) {
+            (void)length;
+            (void)userParam;
+            
+            DebugState & state = debugState();
+            
+            DebugMessage message;
+            message.source    = source;
+            message.type      = type;
+            message.id        = id;
+            message.severity  = severity == GL_DEBUG_SEVERITY_HIGH   ? DebugSeverity::HIGH
+                              : severity == GL_DEBUG_SEVERITY_MEDIUM ? DebugSeverity::MEDIUM
+                              : severity == GL_DEBUG_SEVERITY_LOW    ? DebugSeverity::LOW
+                              : DebugSeverity::NOTIFICATION;
+            message.text      = text;
+            message.statement = state.synchronous ? state.statement : nullptr;
+            message.file      = message.statement != nullptr ? state.file : nullptr;
+            message.line      = message.statement != nullptr ? state.line : 0;
+            
+            state.messageCounts[static_cast<uint32_t>(message.severity)]++;
+            
+            if(state.handler != nullptr) {
+                state.handler(message, state.userData);
+            } else {
+                printMessage(message);
+            }
+        }
+        
+        static void printMessage(DebugMessage const & message) {
+            const char * type;
+            switch(message.type) {
+                case GL_DEBUG_TYPE_ERROR:               type = "ERROR";               break;
+                case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: type = "DEPRECATED_BEHAVIOR"; break;
+                case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  type = "UNDEFINED_BEHAVIOR";  break;
+                case GL_DEBUG_TYPE_PORTABILITY:         type = "PORTABILITY";         break;
+                case GL_DEBUG_TYPE_PERFORMANCE:         type = "PERFORMANCE";         break;
+                case GL_DEBUG_TYPE_MARKER:              type = "MARKER";              break;
+                default:                                type = "OTHER";               break;
+            }
+            
+            const char * source;
+            switch(message.source) {
+                case GL_DEBUG_SOURCE_API:             source = "API";             break;
+                case GL_DEBUG_SOURCE_WINDOW_SYSTEM:   source = "WINDOW_SYSTEM";   break;
+                case GL_DEBUG_SOURCE_SHADER_COMPILER: source = "SHADER_COMPILER"; break;
+                case GL_DEBUG_SOURCE_THIRD_PARTY:     source = "THIRD_PARTY";     break;
+                case GL_DEBUG_SOURCE_APPLICATION:     source = "APPLICATION";     break;
+                default:                              source = "OTHER";           break;
+            }
+            
+            const char * severities[] = {"NOTIFICATION", "LOW", "MEDIUM", "HIGH"};
+            
+            std::cerr << "-----------------------------------------------------------------------------\nOPENGL " << type
+            << " (" << severities[static_cast<uint32_t>(message.severity)] << ")"
+            << "\nsource: " << source
+            << "\nid: " << message.id
+            << "\nmessage: " << message.text;
+            
+            if(message.statement != nullptr) {
+                std::cerr << "\nFilename: " << message.file
+                << "\nline: " << message.line
+                << "\nerror on: " << message.statement;
+            }
+            
+            std::cerr << "\n-----------------------------------------------------------------------------" << std::endl;
+        }
+#endif
+    };
+}
+
+#endif /* OpenglDebugLayer_h */
@@ -11,6 +11,16 @@
 
 //general includes
 #include <vector>
+#include <array>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <cstdio>
+#include <type_traits>
+#include <tuple>
+#include <assert.h>
 
 // platform dependent includes
 #ifdef __APPLE__
@@ -24,15 +34,9 @@
 #include "OpenglVertexDataLayer.h"
 #include "OpenglTextureLayer.h"
 #include "OpenglShaderLayer.h"
-
-// defines
-#ifndef GL_CHECK
-#ifdef DEBUG
-#define GL_CHECK(stmt) do { stmt; checkOpenGLError(#stmt,__FILE__,__LINE__); } while(0)
-#else
-#define GL_CHECK(stmt) stmt
-#endif//DEBUG
-#endif//GL_CHECK
+#include "OpenglDebugLayer.h"
+#include "OpenglInformationLayer.h"
+#include "OpenglProfilerLayer.h"
 
 /*
  TODO list
@@ -49,24 +53,754 @@ namespace glLayer {
         POINTS         = GL_POINTS,
     };
     
+    /*
+     which state the sort key orders by first. the first field in a SortKeyLayout gets the
+     most significant bits so the most expensive state change happens the least often
+     */
+    enum class SortKeyField {
+        PROGRAM,
+        VAO,
+        TEXTURE,
+        DRAW_TYPE,
+        WIRE_FRAME,
+        SAMPLER,    // not part of a SortKeyOrder - always packed directly under TEXTURE
+    };
+    
+    typedef std::array<SortKeyField, 5> SortKeyOrder;
+    
+    class SortKeyLayout {
+        friend class OpenglDrawLayer;
+    public:
+        static constexpr size_t FIELD_COUNT = 6;
+        
+        // default: program -> vao -> texture -> draw type -> wire frame
+        SortKeyLayout()
+        : SortKeyLayout(SortKeyOrder{{SortKeyField::PROGRAM, SortKeyField::VAO, SortKeyField::TEXTURE, SortKeyField::DRAW_TYPE, SortKeyField::WIRE_FRAME}})
+        {
+        }
+        
+        // order is most expensive state change first - the bit widths of the id fields can be changed
+        // but the total must fit in the 64 bit key. samplers are deduplicated by the texture layer so
+        // a few bits under the texture keep draws with the same texture and sampler together
+        SortKeyLayout(SortKeyOrder const & order, unsigned programBits = 16, unsigned vaoBits = 16, unsigned textureBits = 16, unsigned samplerBits = 4)
+        {
+            m_bits[static_cast<size_t>(SortKeyField::PROGRAM)]    = programBits;
+            m_bits[static_cast<size_t>(SortKeyField::VAO)]        = vaoBits;
+            m_bits[static_cast<size_t>(SortKeyField::TEXTURE)]    = textureBits;
+            m_bits[static_cast<size_t>(SortKeyField::DRAW_TYPE)]  = 2;
+            m_bits[static_cast<size_t>(SortKeyField::WIRE_FRAME)] = 1;
+            m_bits[static_cast<size_t>(SortKeyField::SAMPLER)]    = samplerBits;
+            
+            m_usedBits = 0;
+            for(auto bits : m_bits) {
+                m_usedBits += bits;
+            }
+            assert(m_usedBits <= 64 && "sort key layout does not fit in 64 bits");
+            
+            // walk the order from least to most significant so the first field ends up at the top
+            unsigned shift = 0;
+            for(auto i = order.rbegin(); i != order.rend(); i++) {
+                assert(*i != SortKeyField::SAMPLER && "the sampler is placed with the texture - leave it out of the order");
+                if(*i == SortKeyField::TEXTURE) {
+                    place(SortKeyField::SAMPLER, shift);
+                }
+                place(*i, shift);
+            }
+        }
+        
+        static SortKeyLayout programVaoTexture() {
+            return SortKeyLayout(SortKeyOrder{{SortKeyField::PROGRAM, SortKeyField::VAO, SortKeyField::TEXTURE, SortKeyField::DRAW_TYPE, SortKeyField::WIRE_FRAME}});
+        }
+        
+        static SortKeyLayout programTextureVao() {
+            return SortKeyLayout(SortKeyOrder{{SortKeyField::PROGRAM, SortKeyField::TEXTURE, SortKeyField::VAO, SortKeyField::DRAW_TYPE, SortKeyField::WIRE_FRAME}});
+        }
+        
+        static SortKeyLayout vaoTextureProgram() {
+            return SortKeyLayout(SortKeyOrder{{SortKeyField::VAO, SortKeyField::TEXTURE, SortKeyField::PROGRAM, SortKeyField::DRAW_TYPE, SortKeyField::WIRE_FRAME}});
+        }
+        
+        static SortKeyLayout textureVaoProgram() {
+            return SortKeyLayout(SortKeyOrder{{SortKeyField::TEXTURE, SortKeyField::VAO, SortKeyField::PROGRAM, SortKeyField::DRAW_TYPE, SortKeyField::WIRE_FRAME}});
+        }
+        
+        unsigned getUsedBits() const { return m_usedBits; }
+        
+    private:
+        std::array<unsigned, FIELD_COUNT> m_bits;
+        std::array<unsigned, FIELD_COUNT> m_shifts;
+        std::array<uint64_t, FIELD_COUNT> m_masks;
+        unsigned                          m_usedBits;
+        
+        void place(SortKeyField f, unsigned & shift) {
+            size_t i = static_cast<size_t>(f);
+            m_shifts[i] = shift;
+            m_masks[i]  = m_bits[i] == 0 ? 0 : m_bits[i] == 64 ? ~uint64_t(0) : ((uint64_t(1) << m_bits[i]) - 1);
+            shift += m_bits[i];
+        }
+        
+        // ids wider than their field are masked - two commands can then share a key which only costs
+        // ordering quality, state is still set from the command itself at submit time
+        uint64_t field(SortKeyField f, uint64_t value) const {
+            size_t i = static_cast<size_t>(f);
+            return (value & m_masks[i]) << m_shifts[i];
+        }
+    };
+    
+    /*
+     linear allocator for memory that only lives for one frame.
+     - allocate() bumps an offset inside the current block and moves to the next block when it is full
+     - reset() rewinds to the first block in O(1) - blocks are kept so a steady frame never calls the system allocator
+     - nothing allocated from the arena has its destructor called, only use it for plain data
+     - not thread safe, every recording thread owns its own arena
+     */
+    class FrameArena {
+    public:
+        static constexpr size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+        
+        explicit FrameArena(size_t blockSize = DEFAULT_BLOCK_SIZE)
+        : m_blockSize(blockSize)
+        , m_currentBlock(0)
+        , m_offset(0)
+        , m_bytesUsed(0)
+        {
+        }
+        
+        FrameArena(FrameArena const &) = delete;
+        FrameArena & operator=(FrameArena const &) = delete;
+        
+        void * allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+            assert(alignment != 0 && (alignment & (alignment - 1)) == 0 && "alignment must be a power of two");
+            
+            while(m_currentBlock < m_blocks.size()) {
+                Block & block = m_blocks[m_currentBlock];
+                uintptr_t base    = reinterpret_cast<uintptr_t>(block.memory.get());
+                uintptr_t aligned = (base + m_offset + alignment - 1) & ~(uintptr_t(alignment) - 1);
+                size_t    end     = static_cast<size_t>(aligned - base) + size;
+                
+                if(end <= block.size) {
+                    m_bytesUsed += end - m_offset;
+                    m_offset = end;
+                    return reinterpret_cast<void *>(aligned);
+                }
+                
+                // does not fit - move on to the next block, the tail of this one is wasted until reset()
+                m_currentBlock++;
+                m_offset = 0;
+            }
+            
+            Block block;
+            block.size = std::max(m_blockSize, size + alignment);
+            block.memory.reset(new uint8_t[block.size]);
+            m_blocks.push_back(std::move(block));
+            
+            return allocate(size, alignment);
+        }
+        
+        template<typename T>
+        T * allocate(size_t count = 1) {
+            static_assert(std::is_trivially_destructible<T>::value, "the arena never runs destructors");
+            return static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+        }
+        
+        void reset() {
+            m_currentBlock = 0;
+            m_offset       = 0;
+            m_bytesUsed    = 0;
+        }
+        
+        size_t getBytesUsed() const {
+            return m_bytesUsed;
+        }
+        
+        size_t getCapacity() const {
+            size_t capacity = 0;
+            for(auto const & block : m_blocks) {
+                capacity += block.size;
+            }
+            return capacity;
+        }
+        
+    private:
+        struct Block {
+            std::unique_ptr<uint8_t[]> memory;
+            size_t                     size;
+        };
+        
+        std::vector<Block> m_blocks;
+        size_t             m_blockSize;
+        size_t             m_currentBlock;
+        size_t             m_offset;
+        size_t             m_bytesUsed;
+    };
+    
     class DrawCommand {
         friend class OpenglDrawLayer;
     public:
         DrawCommand(ShaderProgram const & program, Texture const & texture, VertexArrayObject const & vao, DrawType const & drawType = DrawType::TRIANGLES, bool wireFrame = false)
         :
-        m_program(program)
-        , m_texture(texture)
+        m_program(program.m_id)
+        , m_texture(texture.m_id)
+        , m_textureTarget(static_cast<GLenum>(texture.m_target))
+        , m_sampler(OPENGL_INVALID_OBJECT)
         , m_vao(vao)
         , m_drawType(drawType)
         , m_wireFrame(wireFrame)
+        , m_first(0)
+        , m_count(3)
+        , m_indexType(IndexType::NONE)
+        , m_indexOffset(0)
+        , m_instanceData(nullptr)
+        , m_uniformBuffer(OPENGL_INVALID_OBJECT)
+        , m_uniformOffset(0)
+        , m_uniformSize(0)
+        , m_uniformData(nullptr)
+        {
+        }
+        
+        // program from an asynchronous build - resolves to the fallback program until the build is ready
+        DrawCommand(OpenglShaderLayer const & shaders, ProgramHandle program, Texture const & texture, VertexArrayObject const & vao, DrawType const & drawType = DrawType::TRIANGLES, bool wireFrame = false)
+        :
+        DrawCommand(shaders.getProgram(program), texture, vao, drawType, wireFrame)
         {
         }
+        
+        // samples an atlas - the region goes in the instance data so every command on the atlas shares one texture bind
+        DrawCommand(ShaderProgram const & program, TextureAtlas const & atlas, VertexArrayObject const & vao, DrawType const & drawType = DrawType::TRIANGLES, bool wireFrame = false)
+        :
+        DrawCommand(program, atlas.getTexture(), vao, drawType, wireFrame)
+        {
+        }
+        
+        // vertices [first, first + count) are drawn with glDrawArrays
+        DrawCommand & setVertexRange(GLint first, GLsizei count) {
+            m_first     = first;
+            m_count     = count;
+            m_indexType = IndexType::NONE;
+            return *this;
+        }
+        
+        // count indices starting at byteOffset into the element buffer bound to the vao are drawn with glDrawElements
+        // baseVertex is added to every index which lets many meshes share one vertex buffer
+        DrawCommand & setIndexRange(IndexType indexType, GLsizei count, size_t byteOffset = 0, GLint baseVertex = 0) {
+            assert(indexType != IndexType::NONE && "use setVertexRange for non indexed draws");
+            m_first       = baseVertex;
+            m_count       = count;
+            m_indexType   = indexType;
+            m_indexOffset = byteOffset;
+            return *this;
+        }
+        
+        // draws the whole index buffer - it must be the element buffer bound into the command's vao
+        DrawCommand & setIndices(IndexBufferObject const & indices, GLint baseVertex = 0) {
+            return setIndexRange(indices.type, indices.count, static_cast<size_t>(indices.buffer.getOffset()), baseVertex);
+        }
+        
+        // one instance record (InstanceBuffer::getStride() bytes) - must stay valid until processDrawCommands() returns.
+        // DrawCommandBucket::allocateTransient() gives memory that lives exactly that long
+        DrawCommand & setInstanceData(void const * data) {
+            m_instanceData = data;
+            return *this;
+        }
+        
+        // filtering and wrapping from a shared sampler instead of the texture's own parameters
+        DrawCommand & setSampler(Sampler const & sampler) {
+            m_sampler = sampler.m_id;
+            return *this;
+        }
+        
+        // per draw uniforms - bound to GLSL_UNIFORM_PER_DRAW_BLOCK_BINDING with glBindBufferRange before the draw.
+        // every block is its own range so commands with different blocks are never batched - prefer setUniformData()
+        // see OpenglVertexDataLayer::allocateUniformBlock()
+        DrawCommand & setUniformBlock(StreamAllocation const & allocation) {
+            assert(allocation.data != nullptr && "uniform block allocation failed");
+            assert(m_uniformData == nullptr && "command already has a per draw uniform record");
+            m_uniformBuffer = allocation.buffer;
+            m_uniformOffset = static_cast<uint32_t>(allocation.offset);
+            m_uniformSize   = static_cast<uint32_t>(allocation.size);
+            return *this;
+        }
+        
+        // one per draw uniform record (OpenglDrawLayer::setPerDrawUniforms() bytes) - the records of a batch are packed
+        // into one range so batching is not split. must stay valid until processDrawCommands() returns
+        DrawCommand & setUniformData(void const * record) {
+            assert(m_uniformBuffer == OPENGL_INVALID_OBJECT && "command already has a uniform block");
+            m_uniformData = record;
+            return *this;
+        }
+    
     private:
-        ShaderProgram m_program;
-        Texture       m_texture;
+        // objects are referenced by handle so a command is a flat record that can be memcpy'd
+        GLuint        m_program;
+        GLuint        m_texture;
+        GLenum        m_textureTarget;
+        GLuint        m_sampler; // 0 samples with the texture's parameters
         GLuint        m_vao;
         DrawType      m_drawType;
         bool          m_wireFrame;
+        GLint         m_first; // base vertex for indexed commands
+        GLsizei       m_count;
+        IndexType     m_indexType;
+        size_t        m_indexOffset;
+        void const *  m_instanceData;
+        GLuint        m_uniformBuffer;
+        uint32_t      m_uniformOffset;
+        uint32_t      m_uniformSize;
+        void const *  m_uniformData;
+    };
+    
+    static_assert(std::is_trivially_copyable<DrawCommand>::value, "DrawCommand must stay a plain record");
+    static_assert(std::is_trivially_destructible<DrawCommand>::value, "DrawCommand must stay a plain record");
+    
+    // layouts are fixed by the opengl spec for GL_DRAW_INDIRECT_BUFFER
+    struct DrawArraysIndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint first;
+        GLuint baseInstance;
+    };
+    
+    struct DrawElementsIndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint  baseVertex;
+        GLuint baseInstance;
+    };
+    
+    static_assert(sizeof(DrawArraysIndirectCommand)   == 16, "DrawArraysIndirectCommand must be tightly packed");
+    static_assert(sizeof(DrawElementsIndirectCommand) == 20, "DrawElementsIndirectCommand must be tightly packed");
+    
+    enum class SubmissionMode {
+        DIRECT,   // one glDraw* per batch
+        INDIRECT, // one glMultiDraw*Indirect per state bucket - needs opengl 4.3
+    };
+    
+    /*
+     a list of draw commands that one thread records into. every worker thread gets its own bucket so
+     recording needs no locks - the draw layer merges the buckets on the render thread and the stable sort
+     keeps equal keys in (bucket creation order, insertion order) so the frame is the same however the
+     threads were scheduled.
+     buckets are written by different threads so each one starts on its own cache line.
+     */
+    class alignas(64) DrawCommandBucket {
+        friend class OpenglDrawLayer;
+    public:
+        static constexpr size_t COMMANDS_PER_CHUNK = 256;
+        static constexpr size_t CACHE_LINE_SIZE    = 64;
+        
+        explicit DrawCommandBucket(size_t arenaBlockSize = FrameArena::DEFAULT_BLOCK_SIZE)
+        : m_arena(arenaBlockSize)
+        , m_head(nullptr)
+        , m_tail(nullptr)
+        , m_size(0)
+        {
+        }
+        
+        DrawCommandBucket(DrawCommandBucket const &) = delete;
+        DrawCommandBucket & operator=(DrawCommandBucket const &) = delete;
+        
+        // c++14 new only aligns to max_align_t - over allocate and keep the original pointer in front of the bucket
+        static void * operator new(size_t size) {
+            uint8_t * memory = static_cast<uint8_t *>(::operator new(size + CACHE_LINE_SIZE + sizeof(void *)));
+            uintptr_t aligned = (reinterpret_cast<uintptr_t>(memory) + sizeof(void *) + CACHE_LINE_SIZE - 1) & ~uintptr_t(CACHE_LINE_SIZE - 1);
+            reinterpret_cast<void **>(aligned)[-1] = memory;
+            return reinterpret_cast<void *>(aligned);
+        }
+        
+        static void operator delete(void * bucket) {
+            if(bucket != nullptr) {
+                ::operator delete(static_cast<void **>(bucket)[-1]);
+            }
+        }
+        
+        void addDrawCommand(DrawCommand const & command) {
+            if(m_tail == nullptr || m_tail->count == COMMANDS_PER_CHUNK) {
+                addChunk();
+            }
+            m_tail->commands[m_tail->count++] = command;
+            m_size++;
+        }
+        
+        // per frame data such as instance records - freed by clearDrawCommands()
+        void * allocateTransient(size_t size, size_t alignment = alignof(std::max_align_t)) {
+            return m_arena.allocate(size, alignment);
+        }
+        
+        template<typename T>
+        T * allocateTransient(size_t count = 1) {
+            return m_arena.allocate<T>(count);
+        }
+        
+        size_t size() const {
+            return m_size;
+        }
+        
+        FrameArena const & getArena() const {
+            return m_arena;
+        }
+        
+    private:
+        // commands live in fixed size chunks inside the arena so a bucket never reallocates and copies
+        struct CommandChunk {
+            CommandChunk * next;
+            size_t         count;
+            DrawCommand *  commands;
+        };
+        
+        FrameArena     m_arena;
+        CommandChunk * m_head;
+        CommandChunk * m_tail;
+        size_t         m_size;
+        
+        void addChunk() {
+            CommandChunk * chunk = m_arena.allocate<CommandChunk>();
+            chunk->next     = nullptr;
+            chunk->count    = 0;
+            chunk->commands = m_arena.allocate<DrawCommand>(COMMANDS_PER_CHUNK);
+            
+            if(m_tail == nullptr) {
+                m_head = chunk;
+            } else {
+                m_tail->next = chunk;
+            }
+            m_tail = chunk;
+        }
+        
+        // O(1) - the arena rewinds and the chunk list is dropped with it
+        void clear() {
+            m_arena.reset();
+            m_head = nullptr;
+            m_tail = nullptr;
+            m_size = 0;
+        }
+    };
+    
+    struct DrawStats {
+        size_t commands;
+        size_t drawCalls;
+        size_t instancedDrawCalls;
+        size_t skippedCommands; // commands whose program is not ready and has no fallback
+    };
+    
+    /*
+     shadow copy of the driver state the draw layer touches. every setter compares against the
+     cached value and only calls into opengl when the value actually changes.
+     - state starts as unknown so the first call of each kind always reaches the driver
+     - invalidate() runs at the start of every processDrawCommands(), code outside the draw layer can change
+       opengl state freely between frames
+     */
+    enum class StateCall {
+        USE_PROGRAM,
+        ACTIVE_TEXTURE,
+        BIND_TEXTURE,
+        BIND_SAMPLER,
+        BIND_VERTEX_ARRAY,
+        BIND_BUFFER,
+        BIND_BUFFER_RANGE,
+        POLYGON_MODE,
+        BLEND,
+        DEPTH,
+        CLEAR_COLOR,
+        COUNT
+    };
+    
+    struct StateCacheStats {
+        uint64_t issued  [static_cast<size_t>(StateCall::COUNT)];
+        uint64_t filtered[static_cast<size_t>(StateCall::COUNT)];
+        
+        uint64_t totalIssued() const {
+            uint64_t total = 0;
+            for(auto count : issued) { total += count; }
+            return total;
+        }
+        
+        uint64_t totalFiltered() const {
+            uint64_t total = 0;
+            for(auto count : filtered) { total += count; }
+            return total;
+        }
+    };
+    
+    enum class BufferBinding {
+        ARRAY_BUFFER,
+        ELEMENT_BUFFER,
+        UNIFORM_BUFFER,
+        DRAW_INDIRECT_BUFFER,
+        PIXEL_UNPACK_BUFFER,
+        COUNT
+    };
+    
+    class DrawStateCache {
+    public:
+        static constexpr GLuint MAX_TEXTURE_UNITS = 32;
+        static constexpr GLuint MAX_UNIFORM_BINDINGS = 16;
+        
+        DrawStateCache() {
+            invalidate();
+            resetStats();
+        }
+        
+        void invalidate() {
+            m_program       = UNKNOWN;
+            m_activeTexture = UNKNOWN;
+            m_vertexArray   = UNKNOWN;
+            m_polygonMode   = UNKNOWN;
+            
+            for(auto & unit : m_textures) {
+                unit.target = UNKNOWN;
+                unit.id     = UNKNOWN;
+            }
+            
+            for(auto & sampler : m_samplers) {
+                sampler = UNKNOWN;
+            }
+            
+            for(auto & buffer : m_buffers) {
+                buffer = UNKNOWN;
+            }
+            
+            for(auto & range : m_uniformRanges) {
+                range.buffer = UNKNOWN;
+            }
+            
+            m_blendEnabled = TriState::UNKNOWN;
+            m_blendSource  = UNKNOWN;
+            m_blendDest    = UNKNOWN;
+            m_depthEnabled = TriState::UNKNOWN;
+            m_depthMask    = TriState::UNKNOWN;
+            m_depthFunc    = UNKNOWN;
+            m_clearColorValid = false;
+        }
+        
+        // the other layers bind buffers to create and stream data so buffer bindings can not be trusted across frames
+        void invalidateBufferBindings() {
+            for(auto & buffer : m_buffers) {
+                buffer = UNKNOWN;
+            }
+            
+            for(auto & range : m_uniformRanges) {
+                range.buffer = UNKNOWN;
+            }
+        }
+        
+        void resetStats() {
+            std::fill(std::begin(m_stats.issued),   std::end(m_stats.issued),   0);
+            std::fill(std::begin(m_stats.filtered), std::end(m_stats.filtered), 0);
+        }
+        
+        StateCacheStats const & getStats() const {
+            return m_stats;
+        }
+        
+        void useProgram(GLuint program) {
+            if(filter(StateCall::USE_PROGRAM, m_program == program)) {
+                return;
+            }
+            GL_CHECK(glUseProgram(program));
+            m_program = program;
+        }
+        
+        void activeTexture(GLuint unit) {
+            assert(unit < MAX_TEXTURE_UNITS && "texture unit is out of range of the state cache");
+            if(filter(StateCall::ACTIVE_TEXTURE, m_activeTexture == unit)) {
+                return;
+            }
+            GL_CHECK(glActiveTexture(GL_TEXTURE0 + unit));
+            m_activeTexture = unit;
+        }
+        
+        void bindTexture(GLuint unit, GLenum target, GLuint texture) {
+            assert(unit < MAX_TEXTURE_UNITS && "texture unit is out of range of the state cache");
+            TextureUnit & cached = m_textures[unit];
+            if(filter(StateCall::BIND_TEXTURE, cached.target == target && cached.id == texture)) {
+                return;
+            }
+            activeTexture(unit);
+            GL_CHECK(glBindTexture(target, texture));
+            cached.target = target;
+            cached.id     = texture;
+        }
+        
+        // sampler bindings are per unit and do not need the unit to be active
+        void bindSampler(GLuint unit, GLuint sampler) {
+            assert(unit < MAX_TEXTURE_UNITS && "texture unit is out of range of the state cache");
+            if(filter(StateCall::BIND_SAMPLER, m_samplers[unit] == sampler)) {
+                return;
+            }
+            GL_CHECK(glBindSampler(unit, sampler));
+            m_samplers[unit] = sampler;
+        }
+        
+        void bindVertexArray(GLuint vao) {
+            if(filter(StateCall::BIND_VERTEX_ARRAY, m_vertexArray == vao)) {
+                return;
+            }
+            GL_CHECK(glBindVertexArray(vao));
+            m_vertexArray = vao;
+            
+            // the element buffer binding is part of the vao state
+            m_buffers[static_cast<size_t>(BufferBinding::ELEMENT_BUFFER)] = UNKNOWN;
+        }
+        
+        void bindBuffer(BufferBinding binding, GLuint buffer) {
+            GLuint & cached = m_buffers[static_cast<size_t>(binding)];
+            if(filter(StateCall::BIND_BUFFER, cached == buffer)) {
+                return;
+            }
+            GL_CHECK(glBindBuffer(bufferTarget(binding), buffer));
+            cached = buffer;
+        }
+        
+        // indexed uniform binding - also replaces the generic GL_UNIFORM_BUFFER binding
+        void bindUniformBufferRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+            assert(index < MAX_UNIFORM_BINDINGS && "uniform binding is out of range of the state cache");
+            BufferRange & cached = m_uniformRanges[index];
+            if(filter(StateCall::BIND_BUFFER_RANGE, cached.buffer == buffer && cached.offset == offset && cached.size == size)) {
+                return;
+            }
+            GL_CHECK(glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size));
+            cached.buffer = buffer;
+            cached.offset = offset;
+            cached.size   = size;
+            m_buffers[static_cast<size_t>(BufferBinding::UNIFORM_BUFFER)] = buffer;
+        }
+        
+        void polygonMode(GLenum mode) {
+            if(filter(StateCall::POLYGON_MODE, m_polygonMode == mode)) {
+                return;
+            }
+            GL_CHECK(glPolygonMode(GL_FRONT_AND_BACK, mode));
+            m_polygonMode = mode;
+        }
+        
+        void blend(bool enabled, GLenum source = GL_SRC_ALPHA, GLenum dest = GL_ONE_MINUS_SRC_ALPHA) {
+            if(!filter(StateCall::BLEND, m_blendEnabled == toTriState(enabled))) {
+                if(enabled) {
+                    GL_CHECK(glEnable(GL_BLEND));
+                } else {
+                    GL_CHECK(glDisable(GL_BLEND));
+                }
+                m_blendEnabled = toTriState(enabled);
+            }
+            
+            if(!enabled) {
+                return;
+            }
+            
+            if(filter(StateCall::BLEND, m_blendSource == source && m_blendDest == dest)) {
+                return;
+            }
+            GL_CHECK(glBlendFunc(source, dest));
+            m_blendSource = source;
+            m_blendDest   = dest;
+        }
+        
+        void depth(bool testEnabled, bool writeEnabled = true, GLenum func = GL_LESS) {
+            if(!filter(StateCall::DEPTH, m_depthEnabled == toTriState(testEnabled))) {
+                if(testEnabled) {
+                    GL_CHECK(glEnable(GL_DEPTH_TEST));
+                } else {
+                    GL_CHECK(glDisable(GL_DEPTH_TEST));
+                }
+                m_depthEnabled = toTriState(testEnabled);
+            }
+            
+            if(!filter(StateCall::DEPTH, m_depthMask == toTriState(writeEnabled))) {
+                GL_CHECK(glDepthMask(writeEnabled ? GL_TRUE : GL_FALSE));
+                m_depthMask = toTriState(writeEnabled);
+            }
+            
+            if(!testEnabled) {
+                return;
+            }
+            
+            if(filter(StateCall::DEPTH, m_depthFunc == func)) {
+                return;
+            }
+            GL_CHECK(glDepthFunc(func));
+            m_depthFunc = func;
+        }
+        
+        void clearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
+            bool same = m_clearColorValid
+                     && m_clearColor[0] == r && m_clearColor[1] == g
+                     && m_clearColor[2] == b && m_clearColor[3] == a;
+            if(filter(StateCall::CLEAR_COLOR, same)) {
+                return;
+            }
+            GL_CHECK(glClearColor(r, g, b, a));
+            m_clearColor[0] = r;
+            m_clearColor[1] = g;
+            m_clearColor[2] = b;
+            m_clearColor[3] = a;
+            m_clearColorValid = true;
+        }
+        
+    private:
+        static constexpr GLuint UNKNOWN = 0xFFFFFFFF;
+        
+        enum class TriState : uint8_t {
+            UNKNOWN,
+            ENABLED,
+            DISABLED,
+        };
+        
+        struct TextureUnit {
+            GLenum target;
+            GLuint id;
+        };
+        
+        struct BufferRange {
+            GLuint     buffer;
+            GLintptr   offset;
+            GLsizeiptr size;
+        };
+        
+        GLuint          m_program;
+        GLuint          m_activeTexture;
+        GLuint          m_vertexArray;
+        GLenum          m_polygonMode;
+        TextureUnit     m_textures[MAX_TEXTURE_UNITS];
+        GLuint          m_samplers[MAX_TEXTURE_UNITS];
+        GLuint          m_buffers[static_cast<size_t>(BufferBinding::COUNT)];
+        BufferRange     m_uniformRanges[MAX_UNIFORM_BINDINGS];
+        TriState        m_blendEnabled;
+        GLenum          m_blendSource;
+        GLenum          m_blendDest;
+        TriState        m_depthEnabled;
+        TriState        m_depthMask;
+        GLenum          m_depthFunc;
+        GLfloat         m_clearColor[4];
+        bool            m_clearColorValid;
+        StateCacheStats m_stats;
+        
+        static TriState toTriState(bool enabled) {
+            return enabled ? TriState::ENABLED : TriState::DISABLED;
+        }
+        
+        static GLenum bufferTarget(BufferBinding binding) {
+            switch(binding) {
+                case BufferBinding::ARRAY_BUFFER:         return GL_ARRAY_BUFFER;
+                case BufferBinding::ELEMENT_BUFFER:       return GL_ELEMENT_ARRAY_BUFFER;
+                case BufferBinding::UNIFORM_BUFFER:       return GL_UNIFORM_BUFFER;
+                case BufferBinding::DRAW_INDIRECT_BUFFER: return GL_DRAW_INDIRECT_BUFFER;
+                case BufferBinding::PIXEL_UNPACK_BUFFER:  return GL_PIXEL_UNPACK_BUFFER;
+                case BufferBinding::COUNT:                break;
+            }
+            assert(false && "invalid buffer binding");
+            return GL_ARRAY_BUFFER;
+        }
+        
+        // returns true when the call is redundant and counts it either way
+        bool filter(StateCall call, bool redundant) {
+            if(redundant) {
+                m_stats.filtered[static_cast<size_t>(call)]++;
+            } else {
+                m_stats.issued[static_cast<size_t>(call)]++;
+            }
+            return redundant;
+        }
     };
     
     class OpenglDrawLayer {
@@ -74,105 +808,843 @@ namespace glLayer {
     public:
         
         OpenglDrawLayer()
-        : m_boundShaderProgram(OPENGL_INVALID_OBJECT)
+        : r(0.0f)
+        , g(0.0f)
+        , b(0.0f)
+        , m_defaultBucket(new DrawCommandBucket())
+        , m_batchingEnabled(true)
+        , m_uniformRecordStride(0)
+        , m_uniformRecordsPerRange(0)
+        , m_uniformRangeAlignment(1)
+        , m_uniformRangeEnd(0)
+        , m_uniformRecordBuffer(OPENGL_INVALID_OBJECT)
+        , m_uniformRecordBufferCapacity(0)
+        , m_submissionMode(SubmissionMode::DIRECT)
+        , m_indirectBuffer(OPENGL_INVALID_OBJECT)
+        , m_indirectBufferCapacity(0)
+        , m_stats()
+        , m_profiler(nullptr)
         {
         }
         
+        ~OpenglDrawLayer() {
+            dispose();
+        }
+        
+        void dispose() {
+            if(m_indirectBuffer != OPENGL_INVALID_OBJECT) {
+                GL_CHECK(glDeleteBuffers(1, &m_indirectBuffer));
+                m_indirectBuffer         = OPENGL_INVALID_OBJECT;
+                m_indirectBufferCapacity = 0;
+            }
+            
+            if(m_uniformRecordBuffer != OPENGL_INVALID_OBJECT) {
+                GL_CHECK(glDeleteBuffers(1, &m_uniformRecordBuffer));
+                m_uniformRecordBuffer         = OPENGL_INVALID_OBJECT;
+                m_uniformRecordBufferCapacity = 0;
+            }
+            
+            // a new buffer can get the same name back - the cache must not think it is still bound
+            m_state.invalidateBufferBindings();
+        }
+        
+        /*
+         selects how batches reach the driver. INDIRECT falls back to DIRECT when the layers were compiled
+         for less than opengl 4.3 or when the context reported by the information layer is older than 4.3.
+         returns the mode that is actually used.
+         */
+        SubmissionMode setSubmissionMode(SubmissionMode mode, OpenglInformationLayer const & info) {
+            m_submissionMode = SubmissionMode::DIRECT;
+            
+#if OPENGL_VERSION_AT_LEAST(4, 3)
+            if(mode == SubmissionMode::INDIRECT && info.isVersionAtLeast(4, 3)) {
+                m_submissionMode = SubmissionMode::INDIRECT;
+            }
+#else
+            (void)mode;
+            (void)info;
+#endif
+            return m_submissionMode;
+        }
+        
+        SubmissionMode getSubmissionMode() const {
+            return m_submissionMode;
+        }
+        
+        /*
+         adjacent commands (after sorting) with the same state and the same vertex/index range are merged into
+         one glDraw*Instanced call. commands with instance data have their records packed into the instance buffer.
+         */
+        void setBatchingEnabled(bool enabled) {
+            m_batchingEnabled = enabled;
+        }
+        
+        // the buffer must have been attached to every vao that is drawn with instance data
+        void setInstanceBuffer(InstanceBuffer const & buffer) {
+            m_instanceBuffer = buffer;
+        }
+        
+        /*
+         records from DrawCommand::setUniformData() are copied into the layer's own uniform buffer, every batch
+         gets its records next to each other and one glBindBufferRange at GLSL_UNIFORM_PER_DRAW_BLOCK_BINDING.
+         the block declares an array of recordsPerRange records and the vertex shader picks its own:
+         
+         layout(std140) uniform PerDraw { DrawData draws[64]; };
+         DrawData data = draws[gl_InstanceID];
+         
+         records are recordSize rounded up to 16 bytes apart like a std140 array. a batch never holds more than
+         recordsPerRange commands. in INDIRECT mode the range covers a whole bucket and each draw's first record is
+         its baseInstance - index with gl_BaseInstance + gl_InstanceID (glsl 4.60 or ARB_shader_draw_parameters).
+         */
+        void setPerDrawUniforms(GLsizei recordSize, GLsizei recordsPerRange, OpenglInformationLayer const & info) {
+            assert(recordSize > 0 && recordsPerRange > 0 && "per draw uniforms need a record size and a record count");
+            
+            m_uniformRecordStride    = static_cast<GLsizeiptr>(std140RoundUp(static_cast<size_t>(recordSize), 16));
+            m_uniformRecordsPerRange = static_cast<size_t>(recordsPerRange);
+            m_uniformRangeAlignment  = std::max<GLsizeiptr>(info.getUniformBufferOffsetAlignment(), 1);
+            
+            assert(m_uniformRecordStride * recordsPerRange <= info.getMaxUniformBlockSize() && "per draw uniform range is bigger than GL_MAX_UNIFORM_BLOCK_SIZE");
+        }
+        
+        DrawStats const & getDrawStats() const {
+            return m_stats;
+        }
+        
+        // blend/depth state is set through the cache so it is filtered the same way as the per command state
+        DrawStateCache & getStateCache() {
+            return m_state;
+        }
+        
+        StateCacheStats const & getStateCacheStats() const {
+            return m_state.getStats();
+        }
+        
+        // processDrawCommands() reports itself and every sorted state bucket to the profiler - nullptr turns it off
+        void setProfiler(OpenglProfilerLayer * profiler) {
+            m_profiler = profiler;
+        }
+        
+        // processDrawCommands() already does this at the start of every frame - only needed when state is changed
+        // while the layer is drawing, e.g. from a profiler or debug callback
+        void invalidateStateCache() {
+            m_state.invalidate();
+        }
+        
+        // changes which state changes the command sort groups together - takes effect on the next processDrawCommands()
+        void setSortKeyLayout(SortKeyLayout const & layout) {
+            m_sortKeyLayout = layout;
+        }
+        
+        SortKeyLayout const & getSortKeyLayout() const {
+            return m_sortKeyLayout;
+        }
+        
+        // commands added here go into the render thread's own bucket which is merged first
         void addDrawCommad(DrawCommand const & command) {
-            m_commands.push_back(command);
+            m_defaultBucket->addDrawCommand(command);
+        }
+        
+        // frame memory of the render thread's bucket - see DrawCommandBucket::allocateTransient()
+        void * allocateTransient(size_t size, size_t alignment = alignof(std::max_align_t)) {
+            return m_defaultBucket->allocateTransient(size, alignment);
+        }
+        
+        /*
+         creates a bucket for a worker thread. create the buckets up front on the render thread - the
+         returned reference stays valid for the lifetime of the layer. the workers must have finished
+         recording before processDrawCommands() is called.
+         */
+        DrawCommandBucket & createCommandBucket(size_t arenaBlockSize = FrameArena::DEFAULT_BLOCK_SIZE) {
+            m_buckets.emplace_back(new DrawCommandBucket(arenaBlockSize));
+            return *m_buckets.back();
+        }
+        
+        size_t getCommandBucketCount() const {
+            return m_buckets.size();
+        }
+        
+        DrawCommandBucket & getCommandBucket(size_t index) {
+            assert(index < m_buckets.size() && "command bucket index out of range");
+            return *m_buckets[index];
         }
         
         float r,g,b;
         void processDrawCommands() {
-            sortCommandsByVaoAndThenTexture();
+            ProfileScope scope(m_profiler, "processDrawCommands");
+            DebugGroup   group("processDrawCommands");
+            
+            // the vertex and texture layers bind vaos, buffers and textures outside of the draw layer - every frame
+            // starts from unknown state so the first draw always rebinds what it needs
+            m_state.invalidate();
+            mergeCommandBuckets();
+            sortCommands();
             
             r+= 0.001f;
             g+= 0.01f;
             b+= 0.0001f;
-            glClearColor(sin(r), sin(g),sin(b), 1);
-            glClear(GL_COLOR_BUFFER_BIT);
+            m_state.clearColor(sin(r), sin(g),sin(b), 1);
+            GL_CHECK(glClear(GL_COLOR_BUFFER_BIT));
             
+            buildBatches();
+            uploadInstanceData();
             
-            for(auto & command: m_commands) {
-                bindShaderProgram(command.m_program);
-                bindTexture(0, command.m_texture);
+            m_stats.commands           = m_mergedCommands.size();
+            m_stats.drawCalls          = 0;
+            m_stats.instancedDrawCalls = 0;
+            
+#if OPENGL_VERSION_AT_LEAST(4, 3)
+            if(m_submissionMode == SubmissionMode::INDIRECT) {
+                buildIndirectBuckets();
+                uploadIndirectCommands();
+                uploadUniformRecords();
                 
-                //TODO: remove this branch in future
-                if(!command.m_wireFrame) {
-                    glDrawArrays(static_cast<GLenum>(command.m_drawType), 0, 3);
-                } else {
-                    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-                    glDrawArrays(static_cast<GLenum>(command.m_drawType), 0, 3);
-                    glPolygonMode(GL_FRONT_AND_BACK, GL_TRIANGLES);
+                for(auto const & bucket : m_indirectBuckets) {
+                    if(bucketScopes()) {
+                        beginBucketScope(sortedCommand(m_batches[bucket.firstBatch].firstSorted));
+                        submitIndirectBucket(bucket);
+                        endBucketScope();
+                    } else {
+                        submitIndirectBucket(bucket);
+                    }
                 }
-                
+                return;
+            }
+#endif
+            
+            uploadUniformRecords();
+            
+            if(bucketScopes()) {
+                submitBatchesInBucketScopes();
+                return;
+            }
+            
+            for(auto const & batch : m_batches) {
+                submitBatch(batch);
             }
         }
         
         void clearDrawCommands() {
-            m_commands.clear();
+            m_defaultBucket->clear();
+            for(auto & bucket : m_buckets) {
+                bucket->clear();
+            }
+            m_mergedCommands.clear();
         }
         
     private:
-        std::vector<DrawCommand> m_commands;
-        GLuint                   m_boundShaderProgram;
+        // a run of sorted commands that is submitted with one draw call
+        struct DrawBatch {
+            uint32_t firstSorted;
+            uint32_t instanceCount;
+            size_t   instanceByteOffset;
+            size_t   uniformByteOffset;
+        };
+        
+        std::unique_ptr<DrawCommandBucket>              m_defaultBucket; // on the heap so the layer itself is not over aligned
+        std::vector<std::unique_ptr<DrawCommandBucket>> m_buckets;
+        std::vector<DrawCommand const *>                m_mergedCommands;
+        DrawStateCache                                  m_state;
+        
+        // batching state - like the sort buffers these only grow
+        bool                     m_batchingEnabled;
+        std::vector<DrawBatch>   m_batches;
+        std::vector<uint8_t>     m_instanceStaging;
+        InstanceBuffer           m_instanceBuffer;
+        
+        // per draw uniform records - packed like the instance records, one range per batch or indirect bucket
+        GLsizeiptr               m_uniformRecordStride;
+        size_t                   m_uniformRecordsPerRange;
+        GLsizeiptr               m_uniformRangeAlignment;
+        size_t                   m_uniformRangeEnd; // the last range is bound whole so the buffer must reach past the records
+        std::vector<uint8_t>     m_uniformStaging;
+        GLuint                   m_uniformRecordBuffer;
+        GLsizeiptr               m_uniformRecordBufferCapacity;
+        
+        // indirect state - one bucket per run of batches that share all state except the draw range
+        struct IndirectBucket {
+            uint32_t firstBatch;
+            uint32_t batchCount;
+            size_t   byteOffset;
+            size_t   uniformByteOffset;
+        };
+        
+        SubmissionMode                           m_submissionMode;
+        GLuint                                   m_indirectBuffer;
+        GLsizeiptr                               m_indirectBufferCapacity;
+        std::vector<IndirectBucket>              m_indirectBuckets;
+        std::vector<uint8_t>                     m_indirectStaging;
+        
+        DrawStats                m_stats;
+        OpenglProfilerLayer *    m_profiler;
+        
+        // sort state - the vectors only ever grow so a steady frame does not allocate
+        SortKeyLayout            m_sortKeyLayout;
+        std::vector<uint64_t>    m_sortKeys;
+        std::vector<uint64_t>    m_sortKeysScratch;
+        std::vector<uint32_t>    m_sortedIndices;
+        std::vector<uint32_t>    m_sortedIndicesScratch;
+        uint32_t                 m_radixHistograms[8][256];
+        
+        // the commands stay in their buckets - only pointers are gathered so merging does not copy commands
+        void mergeCommandBuckets() {
+            size_t total = m_defaultBucket->size();
+            for(auto const & bucket : m_buckets) {
+                total += bucket->size();
+            }
+            
+            m_mergedCommands.clear();
+            m_mergedCommands.reserve(total);
+            m_stats.skippedCommands = 0;
+            
+            gatherBucket(*m_defaultBucket);
+            for(auto const & bucket : m_buckets) {
+                gatherBucket(*bucket);
+            }
+        }
         
-        void sortCommandsByVaoAndThenTexture() {
-            if(m_commands.size() == 0 || m_commands.size() == 1) {
+        void gatherBucket(DrawCommandBucket const & bucket) {
+            for(auto chunk = bucket.m_head; chunk != nullptr; chunk = chunk->next) {
+                for(size_t i = 0; i < chunk->count; i++) {
+                    if(chunk->commands[i].m_program == OPENGL_INVALID_OBJECT) {
+                        m_stats.skippedCommands++;
+                        continue;
+                    }
+                    m_mergedCommands.push_back(&chunk->commands[i]);
+                }
+            }
+        }
+        
+        DrawCommand const & sortedCommand(size_t sortedPosition) const {
+            return *m_mergedCommands[m_sortedIndices[sortedPosition]];
+        }
+        
+        static uint64_t drawTypeSortValue(DrawType const & drawType) {
+            switch(drawType) {
+                case DrawType::TRIANGLES:      return 0;
+                case DrawType::TRIANGLE_STRIP: return 1;
+                case DrawType::POINTS:         return 2;
+            }
+            return 3;
+        }
+        
+        uint64_t makeSortKey(DrawCommand const & command) const {
+            return m_sortKeyLayout.field(SortKeyField::PROGRAM,    command.m_program)
+                 | m_sortKeyLayout.field(SortKeyField::VAO,        command.m_vao)
+                 | m_sortKeyLayout.field(SortKeyField::TEXTURE,    command.m_texture)
+                 | m_sortKeyLayout.field(SortKeyField::SAMPLER,    command.m_sampler)
+                 | m_sortKeyLayout.field(SortKeyField::DRAW_TYPE,  drawTypeSortValue(command.m_drawType))
+                 | m_sortKeyLayout.field(SortKeyField::WIRE_FRAME, command.m_wireFrame ? 1 : 0);
+        }
+        
+        /*
+         packs every command into a 64 bit key and then lsd radix sorts (key, index) pairs.
+         - one pass over the keys builds all the byte histograms
+         - only the bytes the layout uses are sorted and a byte where every key lands in the same bucket is skipped
+         - the sort is stable so commands with equal keys keep their insertion order
+         - the key has no room for draw ranges or uniform blocks, see orderEqualKeys()
+         */
+        void sortCommands() {
+            const size_t count = m_mergedCommands.size();
+            
+            m_sortKeys.resize(count);
+            m_sortedIndices.resize(count);
+            
+            for(size_t i = 0; i < count; i++) {
+                m_sortKeys[i]      = makeSortKey(*m_mergedCommands[i]);
+                m_sortedIndices[i] = static_cast<uint32_t>(i);
+            }
+            
+            if(count < 2) {
                 return;
             }
+            
+            m_sortKeysScratch.resize(count);
+            m_sortedIndicesScratch.resize(count);
+            
+            const unsigned passes = (m_sortKeyLayout.getUsedBits() + 7) / 8;
+            
+            std::fill(&m_radixHistograms[0][0], &m_radixHistograms[0][0] + 8 * 256, 0);
+            
+            for(size_t i = 0; i < count; i++) {
+                uint64_t key = m_sortKeys[i];
+                for(unsigned pass = 0; pass < passes; pass++) {
+                    m_radixHistograms[pass][(key >> (pass * 8)) & 0xFF]++;
+                }
+            }
+            
+            uint64_t * keysIn     = m_sortKeys.data();
+            uint64_t * keysOut    = m_sortKeysScratch.data();
+            uint32_t * indicesIn  = m_sortedIndices.data();
+            uint32_t * indicesOut = m_sortedIndicesScratch.data();
+            
+            for(unsigned pass = 0; pass < passes; pass++) {
+                uint32_t * histogram = m_radixHistograms[pass];
+                const unsigned shift = pass * 8;
+                
+                // every key has the same byte - nothing to do for this pass
+                if(histogram[(keysIn[0] >> shift) & 0xFF] == count) {
+                    continue;
+                }
+                
+                // turn counts into starting offsets
+                uint32_t offset = 0;
+                for(unsigned bucket = 0; bucket < 256; bucket++) {
+                    uint32_t bucketCount = histogram[bucket];
+                    histogram[bucket] = offset;
+                    offset += bucketCount;
+                }
+                
+                for(size_t i = 0; i < count; i++) {
+                    uint32_t destination = histogram[(keysIn[i] >> shift) & 0xFF]++;
+                    keysOut[destination]    = keysIn[i];
+                    indicesOut[destination] = indicesIn[i];
+                }
+                
+                std::swap(keysIn, keysOut);
+                std::swap(indicesIn, indicesOut);
+            }
+            
+            // an odd number of passes leaves the result in the scratch buffers
+            if(indicesIn != m_sortedIndices.data()) {
+                m_sortKeys.swap(m_sortKeysScratch);
+                m_sortedIndices.swap(m_sortedIndicesScratch);
+            }
+            
+            orderEqualKeys();
+        }
+        
+        // everything canBatch() compares - the sameBucket() state first so indirect buckets stay together as well
+        static auto batchState(DrawCommand const & command) {
+            return std::make_tuple(command.m_program, command.m_vao, command.m_texture, command.m_textureTarget, command.m_sampler,
+                                   command.m_drawType, command.m_wireFrame, command.m_indexType,
+                                   command.m_uniformBuffer, command.m_uniformOffset, command.m_uniformSize,
+                                   command.m_instanceData != nullptr, command.m_uniformData != nullptr,
+                                   command.m_first, command.m_count, command.m_indexOffset);
         }
         
-        void sortCommandsByTextureAndThenVao() {
-            if(m_commands.size() == 0 || m_commands.size() == 1) {
+        /*
+         commands with equal keys can still differ in their draw range or uniform block, or in id bits the key
+         dropped. in submission order they would interleave (a b a b) and split into as many batches as commands.
+         runs that do not already batch end to end are sorted by the full batch state, submission order breaks
+         the remaining ties so the result stays deterministic.
+         */
+        void orderEqualKeys() {
+            const size_t count = m_sortedIndices.size();
+            size_t begin = 0;
+            
+            while(begin < count) {
+                size_t end     = begin + 1;
+                bool   batches = true;
+                
+                while(end < count && m_sortKeys[end] == m_sortKeys[begin]) {
+                    batches = batches && canBatch(*m_mergedCommands[m_sortedIndices[end - 1]], *m_mergedCommands[m_sortedIndices[end]]);
+                    end++;
+                }
+                
+                if(!batches) {
+                    std::sort(m_sortedIndices.begin() + begin, m_sortedIndices.begin() + end, [this](uint32_t lhsIndex, uint32_t rhsIndex) {
+                        auto lhs = batchState(*m_mergedCommands[lhsIndex]);
+                        auto rhs = batchState(*m_mergedCommands[rhsIndex]);
+                        return lhs != rhs ? lhs < rhs : lhsIndex < rhsIndex;
+                    });
+                }
+                
+                begin = end;
+            }
+        }
+        
+        // same state - draw ranges can differ
+        static bool sameBucket(DrawCommand const & a, DrawCommand const & b) {
+            return a.m_program              == b.m_program
+                && a.m_vao                  == b.m_vao
+                && a.m_texture              == b.m_texture
+                && a.m_textureTarget        == b.m_textureTarget
+                && a.m_sampler              == b.m_sampler
+                && a.m_drawType             == b.m_drawType
+                && a.m_wireFrame            == b.m_wireFrame
+                && a.m_indexType            == b.m_indexType
+                && sameUniformBlock(a, b)
+                && (a.m_instanceData != nullptr) == (b.m_instanceData != nullptr)
+                && (a.m_uniformData  != nullptr) == (b.m_uniformData  != nullptr);
+        }
+        
+        // a ring block is bound once for a whole batch or indirect bucket - uniform records are packed per batch instead
+        static bool sameUniformBlock(DrawCommand const & a, DrawCommand const & b) {
+            return a.m_uniformBuffer == b.m_uniformBuffer
+                && a.m_uniformOffset == b.m_uniformOffset
+                && a.m_uniformSize   == b.m_uniformSize;
+        }
+        
+        static bool canBatch(DrawCommand const & a, DrawCommand const & b) {
+            return a.m_program              == b.m_program
+                && a.m_vao                  == b.m_vao
+                && a.m_texture              == b.m_texture
+                && a.m_textureTarget        == b.m_textureTarget
+                && a.m_sampler              == b.m_sampler
+                && a.m_drawType             == b.m_drawType
+                && a.m_wireFrame            == b.m_wireFrame
+                && a.m_first                == b.m_first
+                && a.m_count                == b.m_count
+                && a.m_indexType            == b.m_indexType
+                && a.m_indexOffset          == b.m_indexOffset
+                && sameUniformBlock(a, b)
+                && (a.m_instanceData != nullptr) == (b.m_instanceData != nullptr)
+                && (a.m_uniformData  != nullptr) == (b.m_uniformData  != nullptr);
+        }
+        
+        void buildBatches() {
+            m_batches.clear();
+            m_instanceStaging.clear();
+            m_uniformStaging.clear();
+            m_uniformRangeEnd = 0;
+            
+            const size_t count = m_sortedIndices.size();
+            size_t i = 0;
+            
+            while(i < count) {
+                DrawCommand const & first = sortedCommand(i);
+                
+                // the shader's record array bounds the batch
+                const size_t maxBatch = first.m_uniformData != nullptr ? m_uniformRecordsPerRange : count;
+                assert((first.m_uniformData == nullptr || maxBatch > 0) && "commands have uniform data but setPerDrawUniforms() was not called");
+                
+                size_t end = i + 1;
+                if(m_batchingEnabled) {
+                    while(end < count && end - i < maxBatch && canBatch(first, sortedCommand(end))) {
+                        end++;
+                    }
+                }
+                
+                DrawBatch batch;
+                batch.firstSorted        = static_cast<uint32_t>(i);
+                batch.instanceCount      = static_cast<uint32_t>(end - i);
+                batch.instanceByteOffset = m_instanceStaging.size();
+                batch.uniformByteOffset  = 0;
+                
+                // indirect buckets pack the records of all their batches together in buildIndirectBuckets()
+                if(first.m_uniformData != nullptr && m_submissionMode == SubmissionMode::DIRECT) {
+                    batch.uniformByteOffset = stageUniformRecords(i, end);
+                }
+                
+                if(first.m_instanceData != nullptr) {
+                    assert(m_instanceBuffer != OPENGL_INVALID_OBJECT && "commands have instance data but no instance buffer was set");
+                    
+                    const size_t stride = static_cast<size_t>(m_instanceBuffer.m_stride);
+                    m_instanceStaging.resize(batch.instanceByteOffset + stride * batch.instanceCount);
+                    
+                    uint8_t * destination = m_instanceStaging.data() + batch.instanceByteOffset;
+                    for(size_t j = i; j < end; j++) {
+                        std::memcpy(destination, sortedCommand(j).m_instanceData, stride);
+                        destination += stride;
+                    }
+                }
+                
+                m_batches.push_back(batch);
+                i = end;
+            }
+        }
+        
+        // all instance records of the frame go up in one upload - the old storage is orphaned so the driver does not stall
+        void uploadInstanceData() {
+            if(m_instanceStaging.empty()) {
                 return;
             }
+            
+            GLsizeiptr size = static_cast<GLsizeiptr>(m_instanceStaging.size());
+            m_state.bindBuffer(BufferBinding::ARRAY_BUFFER, m_instanceBuffer.m_id);
+            
+            if(size > m_instanceBuffer.m_capacity) {
+                m_instanceBuffer.m_capacity = std::max(size, m_instanceBuffer.m_capacity * 2);
+            }
+            
+            GL_CHECK(glBufferData(GL_ARRAY_BUFFER, m_instanceBuffer.m_capacity, NULL, GL_STREAM_DRAW));
+            GL_CHECK(glBufferSubData(GL_ARRAY_BUFFER, 0, size, m_instanceStaging.data()));
         }
         
-        void bindShaderProgram(ShaderProgram const & program) {
-            if(m_boundShaderProgram == program.m_id) {
+        // copies the records of sorted commands [first, end) next to each other and returns where they start
+        size_t stageUniformRecords(size_t first, size_t end) {
+            const size_t stride    = static_cast<size_t>(m_uniformRecordStride);
+            const size_t alignment = static_cast<size_t>(m_uniformRangeAlignment);
+            
+            size_t offset = (m_uniformStaging.size() + alignment - 1) / alignment * alignment;
+            m_uniformStaging.resize(offset + stride * (end - first));
+            
+            uint8_t * destination = m_uniformStaging.data() + offset;
+            for(size_t i = first; i < end; i++) {
+                std::memcpy(destination, sortedCommand(i).m_uniformData, stride);
+                destination += stride;
+            }
+            
+            m_uniformRangeEnd = std::max(m_uniformRangeEnd, offset + stride * m_uniformRecordsPerRange);
+            return offset;
+        }
+        
+        // every record of the frame goes up in one upload like the instance records
+        void uploadUniformRecords() {
+            if(m_uniformStaging.empty()) {
                 return;
-            } else {
-                GL_CHECK(glUseProgram(program.m_id));
-                m_boundShaderProgram = program.m_id;
             }
+            
+            bool created = false;
+            if(m_uniformRecordBuffer == OPENGL_INVALID_OBJECT) {
+                GL_CHECK(glGenBuffers(1, &m_uniformRecordBuffer));
+                created = true;
+            }
+            
+            m_state.bindBuffer(BufferBinding::UNIFORM_BUFFER, m_uniformRecordBuffer);
+            
+            if(created) {
+                labelObject(DebugObject::BUFFER, m_uniformRecordBuffer, "per draw uniform records");
+            }
+            
+            GLsizeiptr size = static_cast<GLsizeiptr>(m_uniformRangeEnd);
+            if(size > m_uniformRecordBufferCapacity) {
+                m_uniformRecordBufferCapacity = std::max(size, m_uniformRecordBufferCapacity * 2);
+            }
+            
+            GL_CHECK(glBufferData(GL_UNIFORM_BUFFER, m_uniformRecordBufferCapacity, NULL, GL_STREAM_DRAW));
+            GL_CHECK(glBufferSubData(GL_UNIFORM_BUFFER, 0, static_cast<GLsizeiptr>(m_uniformStaging.size()), m_uniformStaging.data()));
         }
         
-        void unbindShaderProgram() {
-            GL_CHECK(glUseProgram(0));
+        // records are bound as the whole array the shader declares, starting at the batch's or bucket's first record
+        void bindUniformBlock(DrawCommand const & command, size_t uniformByteOffset) {
+            if(command.m_uniformData != nullptr) {
+                m_state.bindUniformBufferRange(GLSL_UNIFORM_PER_DRAW_BLOCK_BINDING, m_uniformRecordBuffer, static_cast<GLintptr>(uniformByteOffset), m_uniformRecordStride * static_cast<GLsizeiptr>(m_uniformRecordsPerRange));
+                return;
+            }
+            
+            if(command.m_uniformBuffer == OPENGL_INVALID_OBJECT) {
+                return;
+            }
+            m_state.bindUniformBufferRange(GLSL_UNIFORM_PER_DRAW_BLOCK_BINDING, command.m_uniformBuffer, command.m_uniformOffset, command.m_uniformSize);
         }
         
-        void bindTexture(GLuint unit, Texture const & texture) {
-            GL_CHECK(glActiveTexture(GL_TEXTURE0 + unit));
-            GL_CHECK(glBindTexture(static_cast<GLenum>(texture.m_target), texture.m_id));
+        // points the instance attributes of the bound vao at the batch's records
+        void pointInstanceAttributes(size_t byteOffset) {
+            m_state.bindBuffer(BufferBinding::ARRAY_BUFFER, m_instanceBuffer.m_id);
+            
+            for(size_t i = 0; i < m_instanceBuffer.m_attributeCount; i++) {
+                InstanceAttribute const & attribute = m_instanceBuffer.m_attributes[i];
+                GL_CHECK(glVertexAttribPointer(attribute.location, attribute.components, GL_FLOAT, GL_FALSE, m_instanceBuffer.m_stride, reinterpret_cast<GLvoid const *>(byteOffset + attribute.offset)));
+            }
+        }
+        
+        bool profiling() const {
+            return m_profiler != nullptr && m_profiler->isRecording();
         }
         
-        void bindVertexArrayObject(VertexArrayObject const & vao) {
-            GL_CHECK(glBindVertexArray(vao.m_id));
+        // state buckets get a profiler scope and a debug group when either is on
+        bool bucketScopes() const {
+            return profiling() || debugGroupsEnabled();
+        }
+        
+        void beginBucketScope(DrawCommand const & command) {
+            if(profiling()) {
+                m_profiler->beginScope("state bucket", {{"program", command.m_program}, {"vao", command.m_vao}, {"texture", command.m_texture}});
+            }
+            if(debugGroupsEnabled()) {
+                char name[96];
+                snprintf(name, sizeof(name), "state bucket program %u vao %u texture %u", command.m_program, command.m_vao, command.m_texture);
+                pushDebugGroup(name);
+            }
         }
         
-        void checkOpenGLError(const char * stmt, const char * fname, int line) const {
-            // TODO: add assert functionality
-            GLenum err;
+        void endBucketScope() {
+            popDebugGroup();
+            if(profiling()) {
+                m_profiler->endScope();
+            }
+        }
+        
+        // one scope around every run of batches that shares the state sameBucket() compares
+        void submitBatchesInBucketScopes() {
+            DrawCommand const * bucketFirst = nullptr;
             
-            while((err = glGetError()) != GL_NO_ERROR) {
-                std::string errorType;
+            for(auto const & batch : m_batches) {
+                DrawCommand const & command = sortedCommand(batch.firstSorted);
                 
-                switch(err) {
-                    case GL_INVALID_OPERATION:             errorType = "INVALID_OPERATION";             break;
-                    case GL_INVALID_ENUM:                  errorType = "INVALID_ENUM";                  break;
-                    case GL_INVALID_VALUE:                 errorType = "INVALID_VALUE";                 break;
-                    case GL_OUT_OF_MEMORY:                 errorType = "OUT_OF_MEMORY";                 break;
-                    case GL_INVALID_FRAMEBUFFER_OPERATION: errorType = "INVALID_FRAMEBUFFER_OPERATION"; break;
-                    default:                               errorType = "UKNOWN ERROR - FUCK SAKE";      break;
+                if(bucketFirst == nullptr || !sameBucket(*bucketFirst, command)) {
+                    if(bucketFirst != nullptr) {
+                        endBucketScope();
+                    }
+                    beginBucketScope(command);
+                    bucketFirst = &command;
                 }
                 
-                std::cerr << "-----------------------------------------------------------------------------\nOPENGL ERROR: "<< errorType
-                << "\nFilename: " << fname
-                << "\nline: " << line
-                << "\nerror on: " << stmt
-                << "\n-----------------------------------------------------------------------------"
-                << std::endl;
+                submitBatch(batch);
+            }
+            
+            if(bucketFirst != nullptr) {
+                endBucketScope();
+            }
+        }
+        
+#if OPENGL_VERSION_AT_LEAST(4, 3)
+        static GLuint indexSize(IndexType indexType) {
+            return indexType == IndexType::UNSIGNED_SHORT ? 2 : 4;
+        }
+        
+        /*
+         the batches are already in sorted order so every state bucket is a contiguous run of batches.
+         each batch becomes one indirect command. the instance attributes and the uniform records are pointed at the
+         bucket's first record, so baseInstance is the batch's record index inside the bucket for both of them
+         */
+        void buildIndirectBuckets() {
+            m_indirectBuckets.clear();
+            m_indirectStaging.clear();
+            
+            size_t i = 0;
+            while(i < m_batches.size()) {
+                DrawCommand const & first = sortedCommand(m_batches[i].firstSorted);
+                const bool hasRecords = first.m_instanceData != nullptr || first.m_uniformData != nullptr;
+                
+                IndirectBucket bucket;
+                bucket.firstBatch        = static_cast<uint32_t>(i);
+                bucket.byteOffset        = m_indirectStaging.size();
+                bucket.uniformByteOffset = 0;
+                
+                // the shader's record array bounds the bucket
+                const size_t maxRecords = first.m_uniformData != nullptr ? m_uniformRecordsPerRange : SIZE_MAX;
+                size_t records = 0;
+                
+                size_t end = i;
+                while(end < m_batches.size()) {
+                    DrawBatch const & batch = m_batches[end];
+                    DrawCommand const & command = sortedCommand(batch.firstSorted);
+                    
+                    if(!sameBucket(first, command) || records + batch.instanceCount > maxRecords) {
+                        break;
+                    }
+                    
+                    GLuint baseInstance = hasRecords ? static_cast<GLuint>(records) : 0;
+                    records += batch.instanceCount;
+                    
+                    if(command.m_indexType == IndexType::NONE) {
+                        DrawArraysIndirectCommand indirect;
+                        indirect.count         = static_cast<GLuint>(command.m_count);
+                        indirect.instanceCount = batch.instanceCount;
+                        indirect.first         = static_cast<GLuint>(command.m_first);
+                        indirect.baseInstance  = baseInstance;
+                        appendIndirect(indirect);
+                    } else {
+                        DrawElementsIndirectCommand indirect;
+                        indirect.count         = static_cast<GLuint>(command.m_count);
+                        indirect.instanceCount = batch.instanceCount;
+                        indirect.firstIndex    = static_cast<GLuint>(command.m_indexOffset / indexSize(command.m_indexType));
+                        indirect.baseVertex    = command.m_first;
+                        indirect.baseInstance  = baseInstance;
+                        appendIndirect(indirect);
+                    }
+                    end++;
+                }
+                
+                bucket.batchCount = static_cast<uint32_t>(end - i);
+                if(first.m_uniformData != nullptr) {
+                    bucket.uniformByteOffset = stageUniformRecords(m_batches[i].firstSorted, m_batches[i].firstSorted + records);
+                }
+                m_indirectBuckets.push_back(bucket);
+                i = end;
+            }
+        }
+        
+        template<typename T>
+        void appendIndirect(T const & indirect) {
+            size_t offset = m_indirectStaging.size();
+            m_indirectStaging.resize(offset + sizeof(T));
+            std::memcpy(m_indirectStaging.data() + offset, &indirect, sizeof(T));
+        }
+        
+        void uploadIndirectCommands() {
+            if(m_indirectStaging.empty()) {
+                return;
+            }
+            
+            bool created = false;
+            if(m_indirectBuffer == OPENGL_INVALID_OBJECT) {
+                GL_CHECK(glGenBuffers(1, &m_indirectBuffer));
+                created = true;
+            }
+            
+            GLsizeiptr size = static_cast<GLsizeiptr>(m_indirectStaging.size());
+            m_state.bindBuffer(BufferBinding::DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+            
+            // the name only becomes a buffer once it is bound
+            if(created) {
+                labelObject(DebugObject::BUFFER, m_indirectBuffer, "indirect draw commands");
+            }
+            
+            if(size > m_indirectBufferCapacity) {
+                m_indirectBufferCapacity = std::max(size, m_indirectBufferCapacity * 2);
+            }
+            
+            GL_CHECK(glBufferData(GL_DRAW_INDIRECT_BUFFER, m_indirectBufferCapacity, NULL, GL_STREAM_DRAW));
+            GL_CHECK(glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, size, m_indirectStaging.data()));
+        }
+        
+        void submitIndirectBucket(IndirectBucket const & bucket) {
+            DrawCommand const & command = sortedCommand(m_batches[bucket.firstBatch].firstSorted);
+            
+            m_state.useProgram(command.m_program);
+            m_state.bindTexture(0, command.m_textureTarget, command.m_texture);
+            m_state.bindSampler(0, command.m_sampler);
+            m_state.bindVertexArray(command.m_vao);
+            m_state.polygonMode(command.m_wireFrame ? GL_LINE : GL_FILL);
+            m_state.bindBuffer(BufferBinding::DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+            bindUniformBlock(command, bucket.uniformByteOffset);
+            
+            if(command.m_instanceData != nullptr) {
+                pointInstanceAttributes(m_batches[bucket.firstBatch].instanceByteOffset);
+            }
+            
+            GLenum mode = static_cast<GLenum>(command.m_drawType);
+            GLvoid const * offset = reinterpret_cast<GLvoid const *>(bucket.byteOffset);
+            GLsizei drawCount = static_cast<GLsizei>(bucket.batchCount);
+            
+            m_stats.drawCalls++;
+            
+            if(command.m_indexType == IndexType::NONE) {
+                GL_CHECK(glMultiDrawArraysIndirect(mode, offset, drawCount, 0));
+            } else {
+                GL_CHECK(glMultiDrawElementsIndirect(mode, static_cast<GLenum>(command.m_indexType), offset, drawCount, 0));
+            }
+        }
+#endif
+        
+        void submitBatch(DrawBatch const & batch) {
+            DrawCommand const & command = sortedCommand(batch.firstSorted);
+            
+            m_state.useProgram(command.m_program);
+            m_state.bindTexture(0, command.m_textureTarget, command.m_texture);
+            m_state.bindSampler(0, command.m_sampler);
+            m_state.bindVertexArray(command.m_vao);
+            m_state.polygonMode(command.m_wireFrame ? GL_LINE : GL_FILL);
+            bindUniformBlock(command, batch.uniformByteOffset);
+            
+            GLenum mode = static_cast<GLenum>(command.m_drawType);
+            GLvoid const * indices = reinterpret_cast<GLvoid const *>(command.m_indexOffset);
+            
+            m_stats.drawCalls++;
+            
+            if(batch.instanceCount == 1 && command.m_instanceData == nullptr) {
+                if(command.m_indexType == IndexType::NONE) {
+                    GL_CHECK(glDrawArrays(mode, command.m_first, command.m_count));
+                } else {
+                    GL_CHECK(glDrawElementsBaseVertex(mode, command.m_count, static_cast<GLenum>(command.m_indexType), indices, command.m_first));
+                }
+                return;
+            }
+            
+            if(command.m_instanceData != nullptr) {
+                pointInstanceAttributes(batch.instanceByteOffset);
+            }
+            
+            m_stats.instancedDrawCalls++;
+            
+            GLsizei instances = static_cast<GLsizei>(batch.instanceCount);
+            if(command.m_indexType == IndexType::NONE) {
+                GL_CHECK(glDrawArraysInstanced(mode, command.m_first, command.m_count, instances));
+            } else {
+                GL_CHECK(glDrawElementsInstancedBaseVertex(mode, command.m_count, static_cast<GLenum>(command.m_indexType), indices, instances, command.m_first));
             }
         }
     };
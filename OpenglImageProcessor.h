@@ -0,0 +1,579 @@
+//
+//  OpenglImageProcessor.h
+//  OpenglFramework
+//
+
+/*
+ class information
+ - cpu side pixel work for texture data, no opengl calls so it can run on the threads that decode images
+ - every kernel has a scalar version, the sse2/avx2 versions are compiled in when the compiler targets them
+   (-msse2 is the x86_64 default, -mavx2 or /arch:AVX2 for avx2) and produce the same bytes
+ - mip chains are filtered in linear float - srgb data is decoded first and encoded again per level so
+   the levels do not get darker
+ - the results go straight into OpenglTextureLayer::updateTexture2D() or a TextureStreamer staging allocation
+ */
+
+#ifndef OpenglImageProcessor_h
+#define OpenglImageProcessor_h
+
+// generic includes
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <assert.h>
+
+// simd includes
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OPENGL_IMAGE_SSE2 1
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define OPENGL_IMAGE_AVX2 1
+#endif
+
+namespace glLayer {
+    
+    enum class ImageKernel {
+        SCALAR,
+        SSE2,
+        AVX2,
+    };
+    
+    enum class MipFilter {
+        BOX,    // 2x2 average - cheap, slightly blurry
+        KAISER, // 8 tap kaiser windowed sinc - sharper, keeps detail in the small levels
+    };
+    
+    // tightly packed rgba8
+    struct ImageMipLevel {
+        uint32_t             width;
+        uint32_t             height;
+        std::vector<uint8_t> pixels;
+    };
+    
+    struct ImageKernelBenchmark {
+        const char * operation;
+        ImageKernel  kernel;
+        double       milliseconds; // per iteration
+        double       speedup;      // against the scalar kernel
+        bool         matchesScalar;
+    };
+    
+    class ImageProcessor {
+    public:
+        // the widest kernel the build supports
+        static ImageKernel bestKernel() {
+#if defined(OPENGL_IMAGE_AVX2)
+            return ImageKernel::AVX2;
+#elif defined(OPENGL_IMAGE_SSE2)
+            return ImageKernel::SSE2;
+#else
+            return ImageKernel::SCALAR;
+#endif
+        }
+        
+        static bool isKernelAvailable(ImageKernel kernel) {
+            return kernel <= bestKernel();
+        }
+        
+        /* Format Conversion */
+        /*------------------------------------------------------------------------------------------*/
+        // clamps to [0, 1] and rounds to the nearest of 256 steps
+        static void floatToUnorm8(float const * src, uint8_t * dst, size_t count, ImageKernel kernel = bestKernel()) {
+            size_t i = 0;
+
+#if defined(OPENGL_IMAGE_AVX2)
+            if(kernel == ImageKernel::AVX2) {
+                const __m256  zero  = _mm256_setzero_ps();
+                const __m256  one   = _mm256_set1_ps(1.0f);
+                const __m256  scale = _mm256_set1_ps(255.0f);
+                const __m256  half  = _mm256_set1_ps(0.5f);
+                const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7); // undoes the per lane packing
+                
+                for(; i + 32 <= count; i += 32) {
+                    __m256i v[4];
+                    for(int j = 0; j < 4; j++) {
+                        __m256 f = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i + j * 8), zero), one);
+                        v[j] = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(f, scale), half));
+                    }
+                    __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_permutevar8x32_epi32(packed, order));
+                }
+            }
+#endif
+#if defined(OPENGL_IMAGE_SSE2)
+            if(kernel >= ImageKernel::SSE2) {
+                const __m128 zero  = _mm_setzero_ps();
+                const __m128 one   = _mm_set1_ps(1.0f);
+                const __m128 scale = _mm_set1_ps(255.0f);
+                const __m128 half  = _mm_set1_ps(0.5f);
+                
+                for(; i + 16 <= count; i += 16) {
+                    __m128i v[4];
+                    for(int j = 0; j < 4; j++) {
+                        __m128 f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + j * 4), zero), one);
+                        v[j] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, scale), half));
+                    }
+                    __m128i packed = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), packed);
+                }
+            }
+#endif
+            (void)kernel;
+            for(; i < count; i++) {
+                float f = std::min(std::max(src[i], 0.0f), 1.0f);
+                dst[i] = static_cast<uint8_t>(f * 255.0f + 0.5f);
+            }
+        }
+        
+        // rgb8 -> rgba8. sse2 has no byte shuffle so anything below avx2 runs the scalar loop
+        static void rgbToRgba(uint8_t const * src, uint8_t * dst, size_t pixels, uint8_t alpha = 255, ImageKernel kernel = bestKernel()) {
+            size_t i = 0;
+
+#if defined(OPENGL_IMAGE_AVX2)
+            if(kernel == ImageKernel::AVX2) {
+                const __m256i spread = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0); // 12 source bytes per lane
+                const __m256i expand = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                                        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+                const __m256i alphas = _mm256_set1_epi32(static_cast<int>(static_cast<uint32_t>(alpha) << 24));
+                
+                // 8 pixels read 32 bytes - stop while the read stays inside the source
+                for(; i + 11 <= pixels; i += 8) {
+                    __m256i rgb = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i * 3));
+                    rgb = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(rgb, spread), expand);
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 4), _mm256_or_si256(rgb, alphas));
+                }
+            }
+#endif
+            (void)kernel;
+            for(; i < pixels; i++) {
+                dst[i * 4 + 0] = src[i * 3 + 0];
+                dst[i * 4 + 1] = src[i * 3 + 1];
+                dst[i * 4 + 2] = src[i * 3 + 2];
+                dst[i * 4 + 3] = alpha;
+            }
+        }
+        
+        // rgba8 in place - colour = round(colour * alpha / 255)
+        static void premultiplyAlpha(uint8_t * rgba, size_t pixels, ImageKernel kernel = bestKernel()) {
+            size_t i = 0;
+
+#if defined(OPENGL_IMAGE_AVX2)
+            if(kernel == ImageKernel::AVX2) {
+                const __m256i zero     = _mm256_setzero_si256();
+                const __m256i colour   = _mm256_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0);
+                const __m256i keep     = _mm256_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255);
+                const __m256i rounding = _mm256_set1_epi16(128);
+                
+                for(; i + 8 <= pixels; i += 8) {
+                    __m256i packed = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(rgba + i * 4));
+                    __m256i halves[2] = { _mm256_unpacklo_epi8(packed, zero), _mm256_unpackhi_epi8(packed, zero) };
+                    
+                    for(auto & half : halves) {
+                        __m256i alphas = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(half, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+                        alphas = _mm256_or_si256(_mm256_and_si256(alphas, colour), keep);
+                        __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(half, alphas), rounding);
+                        half = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+                    }
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(rgba + i * 4), _mm256_packus_epi16(halves[0], halves[1]));
+                }
+            }
+#endif
+#if defined(OPENGL_IMAGE_SSE2)
+            if(kernel >= ImageKernel::SSE2) {
+                const __m128i zero     = _mm_setzero_si128();
+                const __m128i colour   = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+                const __m128i keep     = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+                const __m128i rounding = _mm_set1_epi16(128);
+                
+                for(; i + 4 <= pixels; i += 4) {
+                    __m128i packed = _mm_loadu_si128(reinterpret_cast<__m128i const *>(rgba + i * 4));
+                    __m128i halves[2] = { _mm_unpacklo_epi8(packed, zero), _mm_unpackhi_epi8(packed, zero) };
+                    
+                    for(auto & half : halves) {
+                        __m128i alphas = _mm_shufflehi_epi16(_mm_shufflelo_epi16(half, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+                        alphas = _mm_or_si128(_mm_and_si128(alphas, colour), keep);
+                        __m128i t = _mm_add_epi16(_mm_mullo_epi16(half, alphas), rounding);
+                        half = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+                    }
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(rgba + i * 4), _mm_packus_epi16(halves[0], halves[1]));
+                }
+            }
+#endif
+            (void)kernel;
+            for(; i < pixels; i++) {
+                uint32_t a = rgba[i * 4 + 3];
+                for(size_t c = 0; c < 3; c++) {
+                    uint32_t t = rgba[i * 4 + c] * a + 128;
+                    rgba[i * 4 + c] = static_cast<uint8_t>((t + (t >> 8)) >> 8);
+                }
+            }
+        }
+        
+        /* Mip Generation */
+        /*------------------------------------------------------------------------------------------*/
+        /*
+         builds levels 1..n of an rgba8 image down to 1x1 - level 0 stays with the caller. with srgb the colour
+         channels are treated as srgb encoded, alpha is always linear. odd sizes round down and the last
+         row/column is clamped.
+         */
+        static std::vector<ImageMipLevel> generateMipChain(uint8_t const * rgba, uint32_t width, uint32_t height, bool srgb = true, MipFilter filter = MipFilter::BOX, ImageKernel kernel = bestKernel()) {
+            assert(width > 0 && height > 0 && "image size must be greater than 0");
+            
+            std::vector<ImageMipLevel> levels;
+            std::vector<float> current(static_cast<size_t>(width) * height * 4);
+            std::vector<float> next;
+            std::vector<float> scratch;
+            
+            decodeLinear(rgba, current.data(), static_cast<size_t>(width) * height, srgb);
+            
+            while(width > 1 || height > 1) {
+                uint32_t nextWidth  = std::max(1u, width  / 2);
+                uint32_t nextHeight = std::max(1u, height / 2);
+                next.resize(static_cast<size_t>(nextWidth) * nextHeight * 4);
+                
+                if(filter == MipFilter::BOX) {
+                    downsampleBox(current.data(), width, height, next.data(), nextWidth, nextHeight, kernel);
+                } else {
+                    downsampleKaiser(current.data(), width, height, next.data(), nextWidth, nextHeight, scratch, kernel);
+                }
+                
+                ImageMipLevel level;
+                level.width  = nextWidth;
+                level.height = nextHeight;
+                level.pixels.resize(next.size());
+                encodeLinear(next.data(), level.pixels.data(), static_cast<size_t>(nextWidth) * nextHeight, srgb, kernel);
+                levels.push_back(std::move(level));
+                
+                current.swap(next);
+                width  = nextWidth;
+                height = nextHeight;
+            }
+            
+            return levels;
+        }
+        
+        /* Benchmark */
+        /*------------------------------------------------------------------------------------------*/
+        /*
+         times every operation with every kernel the build supports on a width x height image and checks the
+         output against the scalar kernel. a harness, not a test - run it in the target build configuration.
+         */
+        static std::vector<ImageKernelBenchmark> benchmarkKernels(uint32_t width = 1024, uint32_t height = 1024, unsigned iterations = 10) {
+            const size_t pixels = static_cast<size_t>(width) * height;
+            
+            // deterministic noise with a gradient so the filters see both
+            std::vector<float>   floats(pixels * 4);
+            std::vector<uint8_t> rgb(pixels * 3);
+            std::vector<uint8_t> rgba(pixels * 4);
+            uint32_t state = 0x12345678u;
+            for(size_t i = 0; i < floats.size(); i++) {
+                state = state * 1664525u + 1013904223u;
+                floats[i] = float(state >> 8) / float(1u << 24) * 1.2f - 0.1f;
+                rgba[i]   = static_cast<uint8_t>((state >> 24) / 2 + (i / 4 % width) * 127 / width);
+            }
+            for(size_t i = 0; i < rgb.size(); i++) {
+                rgb[i] = rgba[i];
+            }
+            
+            std::vector<ImageKernelBenchmark> results;
+            std::vector<uint8_t> scalarOutput;
+            std::vector<uint8_t> output;
+            
+            const char * operations[] = { "floatToUnorm8", "rgbToRgba", "premultiplyAlpha", "mipChain box srgb", "mipChain kaiser srgb" };
+            
+            for(const char * operation : operations) {
+                double scalarTime = 0.0;
+                
+                for(ImageKernel kernel : { ImageKernel::SCALAR, ImageKernel::SSE2, ImageKernel::AVX2 }) {
+                    if(!isKernelAvailable(kernel)) {
+                        continue;
+                    }
+                    
+                    auto start = std::chrono::steady_clock::now();
+                    for(unsigned iteration = 0; iteration < iterations; iteration++) {
+                        runBenchmarkOperation(operation, kernel, floats, rgb, rgba, width, height, output);
+                    }
+                    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / std::max(iterations, 1u);
+                    
+                    if(kernel == ImageKernel::SCALAR) {
+                        scalarTime = milliseconds;
+                        scalarOutput = output;
+                    }
+                    
+                    ImageKernelBenchmark result;
+                    result.operation     = operation;
+                    result.kernel        = kernel;
+                    result.milliseconds  = milliseconds;
+                    result.speedup       = milliseconds > 0.0 ? scalarTime / milliseconds : 0.0;
+                    result.matchesScalar = maxDifference(scalarOutput, output) <= 1; // fma contraction may move a rounding by one step
+                    results.push_back(result);
+                }
+            }
+            
+            return results;
+        }
+        
+        static const char * kernelName(ImageKernel kernel) {
+            switch(kernel) {
+                case ImageKernel::SCALAR: return "scalar";
+                case ImageKernel::SSE2:   return "sse2";
+                case ImageKernel::AVX2:   return "avx2";
+            }
+            return "unknown";
+        }
+    
+    private:
+        static constexpr size_t KAISER_TAPS = 8;
+        static constexpr size_t SRGB_ENCODE_STEPS = 4096;
+        
+        static float const * srgbDecodeTable() {
+            static const std::vector<float> table = [] {
+                std::vector<float> values(256);
+                for(size_t i = 0; i < values.size(); i++) {
+                    float c = float(i) / 255.0f;
+                    values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+                }
+                return values;
+            }();
+            return table.data();
+        }
+        
+        // indexed by linear * (SRGB_ENCODE_STEPS - 1) - fine enough that every srgb value is reachable
+        static uint8_t const * srgbEncodeTable() {
+            static const std::vector<uint8_t> table = [] {
+                std::vector<uint8_t> values(SRGB_ENCODE_STEPS);
+                for(size_t i = 0; i < values.size(); i++) {
+                    float l = float(i) / float(SRGB_ENCODE_STEPS - 1);
+                    float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+                    values[i] = static_cast<uint8_t>(std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+                }
+                return values;
+            }();
+            return table.data();
+        }
+        
+        static void decodeLinear(uint8_t const * rgba, float * dst, size_t pixels, bool srgb) {
+            float const * decode = srgbDecodeTable();
+            
+            for(size_t i = 0; i < pixels * 4; i += 4) {
+                for(size_t c = 0; c < 3; c++) {
+                    dst[i + c] = srgb ? decode[rgba[i + c]] : float(rgba[i + c]) / 255.0f;
+                }
+                dst[i + 3] = float(rgba[i + 3]) / 255.0f;
+            }
+        }
+        
+        static void encodeLinear(float const * src, uint8_t * rgba, size_t pixels, bool srgb, ImageKernel kernel) {
+            if(!srgb) {
+                floatToUnorm8(src, rgba, pixels * 4, kernel);
+                return;
+            }
+            
+            uint8_t const * encode = srgbEncodeTable();
+            const float steps = float(SRGB_ENCODE_STEPS - 1);
+            
+            for(size_t i = 0; i < pixels * 4; i += 4) {
+                for(size_t c = 0; c < 3; c++) {
+                    float l = std::min(std::max(src[i + c], 0.0f), 1.0f);
+                    rgba[i + c] = encode[static_cast<size_t>(l * steps + 0.5f)];
+                }
+                float a = std::min(std::max(src[i + 3], 0.0f), 1.0f);
+                rgba[i + 3] = static_cast<uint8_t>(a * 255.0f + 0.5f);
+            }
+        }
+        
+        // float rgba - every output pixel averages a 2x2 block, ((p0 + p1) + (q0 + q1)) * 0.25 in every kernel
+        static void downsampleBox(float const * src, uint32_t width, uint32_t height, float * dst, uint32_t dstWidth, uint32_t dstHeight, ImageKernel kernel) {
+            for(uint32_t y = 0; y < dstHeight; y++) {
+                float const * row0 = src + static_cast<size_t>(std::min(y * 2,     height - 1)) * width * 4;
+                float const * row1 = src + static_cast<size_t>(std::min(y * 2 + 1, height - 1)) * width * 4;
+                float *       out  = dst + static_cast<size_t>(y) * dstWidth * 4;
+                
+                uint32_t x = 0;
+
+#if defined(OPENGL_IMAGE_SSE2)
+                // a float rgba pixel is exactly one register. avx2 runs this loop too - pairing two outputs needs
+                // a lane shuffle that measured slower and it would add the rows before the columns
+                if(kernel >= ImageKernel::SSE2) {
+                    const __m128 quarter = _mm_set1_ps(0.25f);
+                    for(; x < dstWidth && x * 2 + 1 < width; x++) {
+                        __m128 p = _mm_add_ps(_mm_loadu_ps(row0 + x * 8), _mm_loadu_ps(row0 + x * 8 + 4));
+                        __m128 q = _mm_add_ps(_mm_loadu_ps(row1 + x * 8), _mm_loadu_ps(row1 + x * 8 + 4));
+                        _mm_storeu_ps(out + x * 4, _mm_mul_ps(_mm_add_ps(p, q), quarter));
+                    }
+                }
+#endif
+                (void)kernel;
+                for(; x < dstWidth; x++) {
+                    size_t x0 = std::min(x * 2,     width - 1) * 4;
+                    size_t x1 = std::min(x * 2 + 1, width - 1) * 4;
+                    for(size_t c = 0; c < 4; c++) {
+                        out[x * 4 + c] = ((row0[x0 + c] + row0[x1 + c]) + (row1[x0 + c] + row1[x1 + c])) * 0.25f;
+                    }
+                }
+            }
+        }
+        
+        // kaiser windowed sinc for a 2x reduction - taps sit at -3.5 .. 3.5 source pixels from the output centre
+        static float const * kaiserWeights() {
+            static const std::vector<float> weights = [] {
+                const double pi     = 3.14159265358979323846;
+                const double alpha  = 4.0;
+                const double radius = double(KAISER_TAPS) / 2.0;
+                
+                auto bessel0 = [](double x) {
+                    double sum = 1.0, term = 1.0;
+                    for(int k = 1; k < 20; k++) {
+                        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                        sum  += term;
+                    }
+                    return sum;
+                };
+                
+                std::vector<float> values(KAISER_TAPS);
+                double total = 0.0;
+                for(size_t k = 0; k < KAISER_TAPS; k++) {
+                    double t    = double(k) - radius + 0.5;
+                    double s    = t / 2.0; // in output pixels
+                    double sinc = s == 0.0 ? 1.0 : std::sin(pi * s) / (pi * s);
+                    double r    = t / radius;
+                    double w    = bessel0(alpha * std::sqrt(std::max(0.0, 1.0 - r * r))) / bessel0(alpha);
+                    values[k]   = float(sinc * w);
+                    total      += values[k];
+                }
+                for(auto & value : values) {
+                    value = float(value / total);
+                }
+                return values;
+            }();
+            return weights.data();
+        }
+        
+        // separable - rows into scratch at the new width, then columns into dst. edges clamp
+        static void downsampleKaiser(float const * src, uint32_t width, uint32_t height, float * dst, uint32_t dstWidth, uint32_t dstHeight, std::vector<float> & scratch, ImageKernel kernel) {
+            float const * weights = kaiserWeights();
+            const int64_t offset = int64_t(KAISER_TAPS) / 2 - 1;
+            
+            scratch.resize(static_cast<size_t>(dstWidth) * height * 4);
+            
+            // horizontal - one rgba pixel per register, avx2 has nothing to add here
+            for(uint32_t y = 0; y < height; y++) {
+                float const * row = src + static_cast<size_t>(y) * width * 4;
+                float *       out = scratch.data() + static_cast<size_t>(y) * dstWidth * 4;
+                
+                for(uint32_t x = 0; x < dstWidth; x++) {
+                    int64_t first = int64_t(x) * 2 - offset;
+
+#if defined(OPENGL_IMAGE_SSE2)
+                    if(kernel >= ImageKernel::SSE2) {
+                        __m128 sum = _mm_setzero_ps();
+                        for(size_t k = 0; k < KAISER_TAPS; k++) {
+                            size_t sx = static_cast<size_t>(std::min<int64_t>(std::max<int64_t>(first + int64_t(k), 0), width - 1));
+                            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(row + sx * 4), _mm_set1_ps(weights[k])));
+                        }
+                        _mm_storeu_ps(out + x * 4, sum);
+                        continue;
+                    }
+#endif
+                    for(size_t c = 0; c < 4; c++) {
+                        float sum = 0.0f;
+                        for(size_t k = 0; k < KAISER_TAPS; k++) {
+                            size_t sx = static_cast<size_t>(std::min<int64_t>(std::max<int64_t>(first + int64_t(k), 0), width - 1));
+                            sum += row[sx * 4 + c] * weights[k];
+                        }
+                        out[x * 4 + c] = sum;
+                    }
+                }
+            }
+            
+            // vertical - a weighted sum of whole rows so it vectorises over any width
+            const size_t floats = static_cast<size_t>(dstWidth) * 4;
+            float const * rows[KAISER_TAPS];
+            
+            for(uint32_t y = 0; y < dstHeight; y++) {
+                int64_t first = int64_t(y) * 2 - offset;
+                for(size_t k = 0; k < KAISER_TAPS; k++) {
+                    size_t sy = static_cast<size_t>(std::min<int64_t>(std::max<int64_t>(first + int64_t(k), 0), height - 1));
+                    rows[k] = scratch.data() + sy * floats;
+                }
+                float * out = dst + static_cast<size_t>(y) * floats;
+                
+                size_t i = 0;
+
+#if defined(OPENGL_IMAGE_AVX2)
+                if(kernel == ImageKernel::AVX2) {
+                    for(; i + 8 <= floats; i += 8) {
+                        __m256 sum = _mm256_setzero_ps();
+                        for(size_t k = 0; k < KAISER_TAPS; k++) {
+                            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[k] + i), _mm256_set1_ps(weights[k])));
+                        }
+                        _mm256_storeu_ps(out + i, sum);
+                    }
+                }
+#endif
+#if defined(OPENGL_IMAGE_SSE2)
+                if(kernel >= ImageKernel::SSE2) {
+                    for(; i + 4 <= floats; i += 4) {
+                        __m128 sum = _mm_setzero_ps();
+                        for(size_t k = 0; k < KAISER_TAPS; k++) {
+                            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + i), _mm_set1_ps(weights[k])));
+                        }
+                        _mm_storeu_ps(out + i, sum);
+                    }
+                }
+#endif
+                for(; i < floats; i++) {
+                    float sum = 0.0f;
+                    for(size_t k = 0; k < KAISER_TAPS; k++) {
+                        sum += rows[k][i] * weights[k];
+                    }
+                    out[i] = sum;
+                }
+            }
+            (void)kernel;
+        }
+        
+        static void runBenchmarkOperation(const char * operation, ImageKernel kernel, std::vector<float> const & floats, std::vector<uint8_t> const & rgb, std::vector<uint8_t> const & rgba,
+                                          uint32_t width, uint32_t height, std::vector<uint8_t> & output) {
+            const size_t pixels = static_cast<size_t>(width) * height;
+            
+            if(std::strcmp(operation, "floatToUnorm8") == 0) {
+                output.resize(floats.size());
+                floatToUnorm8(floats.data(), output.data(), floats.size(), kernel);
+            } else if(std::strcmp(operation, "rgbToRgba") == 0) {
+                output.resize(pixels * 4);
+                rgbToRgba(rgb.data(), output.data(), pixels, 255, kernel);
+            } else if(std::strcmp(operation, "premultiplyAlpha") == 0) {
+                output = rgba;
+                premultiplyAlpha(output.data(), pixels, kernel);
+            } else {
+                MipFilter filter = std::strstr(operation, "kaiser") != nullptr ? MipFilter::KAISER : MipFilter::BOX;
+                std::vector<ImageMipLevel> levels = generateMipChain(rgba.data(), width, height, true, filter, kernel);
+                output.clear();
+                for(auto const & level : levels) {
+                    output.insert(output.end(), level.pixels.begin(), level.pixels.end());
+                }
+            }
+        }
+        
+        static int maxDifference(std::vector<uint8_t> const & a, std::vector<uint8_t> const & b) {
+            if(a.size() != b.size()) {
+                return 256;
+            }
+            int difference = 0;
+            for(size_t i = 0; i < a.size(); i++) {
+                difference = std::max(difference, std::abs(int(a[i]) - int(b[i])));
+            }
+            return difference;
+        }
+    };
+}
+
+#endif /* OpenglImageProcessor_h */
@@ -11,6 +11,9 @@
 
 //generic includes
 #include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
 
 // platform dependent includes
 #ifdef __APPLE__
@@ -20,22 +23,35 @@
 #include "GL/glew.h"
 #endif
 
+//local includes
+#include "OpenglDebugLayer.h"
+
 // defines
 #define INVALID_ID 0
 #define TEXTURE_NOT_BOUND 0
 
-#ifndef GL_CHECK
-#ifdef DEBUG
-#define GL_CHECK(stmt) do { stmt; checkOpenGLError(#stmt,__FILE__,__LINE__); } while(0)
-#else
-#define GL_CHECK(stmt) stmt
-#endif//DEBUG
-#endif//GL_CHECK
-
 class OpenglInformationLayer {
-    
+
 public:
     
+    OpenglInformationLayer()
+    : m_isCoreProfile(false)
+    , m_isProfileForwardCompatible(false)
+    , m_majorVersion(0)
+    , m_minorVersion(0)
+    , m_vendor(nullptr)
+    , m_renderer(nullptr)
+    , m_version(nullptr)
+    , m_maxAnisotropy(0.0f)
+    , m_maxTextureImageUnits(0)
+    , m_maxCombinedTextureImageUnits(0)
+    , m_maxTextureSize(0)
+    , m_uniformBufferOffsetAlignment(256)
+    , m_maxUniformBlockSize(16384)
+    , m_maxUniformBufferBindings(0)
+    {
+    }
+    
     void init() {
         /* Context information */
         //------------------------------------------------------------------------------------------------------//
@@ -71,18 +87,46 @@ public:
          */
         m_renderer = (const char *)glGetString(GL_RENDERER);
         
+        // full version string - includes the driver version on most implementations e.g. "4.5 (Core Profile) Mesa 22.3.6"
+        m_version = (const char *)glGetString(GL_VERSION);
+        
         // get context major and minor version
         GL_CHECK(glGetIntegerv(GL_MAJOR_VERSION, &m_majorVersion)); // function works for opengl 3.0 + only
         GL_CHECK(glGetIntegerv(GL_MINOR_VERSION, &m_minorVersion)); // function works for opengl 3.0 + only
         
+        // extensions - kept sorted so hasExtension can binary search
+        GLint numExtensions = 0;
+        GL_CHECK(glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions));
+        m_extensions.clear();
+        m_extensions.reserve(numExtensions);
+        for(GLint i = 0; i < numExtensions; i++) {
+            const char * extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+            if(extension != nullptr) {
+                m_extensions.push_back(extension);
+            }
+        }
+        std::sort(m_extensions.begin(), m_extensions.end());
+        
         
         /* texture information */
         //------------------------------------------------------------------------------------------------------//
         GL_CHECK(glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS,   &m_maxCombinedTextureImageUnits));
         GL_CHECK(glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS,            &m_maxTextureImageUnits));
-        GL_CHECK(glGetFloatv  (GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT,     &m_maxAnisotropy));
         GL_CHECK(glGetIntegerv(GL_MAX_TEXTURE_SIZE,                   &m_maxTextureSize));
         
+        // the query is an invalid enum without the extension - 1 means no anisotropic filtering
+        m_maxAnisotropy = 1.0f;
+        if(isVersionAtLeast(4, 6) || hasExtension("GL_EXT_texture_filter_anisotropic") || hasExtension("GL_ARB_texture_filter_anisotropic")) {
+            GL_CHECK(glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &m_maxAnisotropy));
+        }
+        
+        
+        /* buffer information */
+        //------------------------------------------------------------------------------------------------------//
+        GL_CHECK(glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT,    &m_uniformBufferOffsetAlignment));
+        GL_CHECK(glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE,             &m_maxUniformBlockSize));
+        GL_CHECK(glGetIntegerv(GL_MAX_UNIFORM_BUFFER_BINDINGS,        &m_maxUniformBufferBindings));
+        
         
         // build information string
         //------------------------------------------------------------------------------------------------------//
@@ -95,6 +139,7 @@ public:
         m_concatedInfo += "Version:                          " + std::to_string(m_majorVersion) + '.' + std::to_string(m_minorVersion) + '\n';
         m_concatedInfo += "Vendor:                           " + std::string(m_vendor) + '\n';
         m_concatedInfo += "Renderer:                         " + std::string(m_renderer) + "\n";
+        m_concatedInfo += "Extensions:                       " + std::to_string(m_extensions.size()) + '\n';
         m_concatedInfo += "------------------                    \n\n";
         
         
@@ -107,6 +152,14 @@ public:
         m_concatedInfo += "Max Anisotropy:                   " + std::to_string(m_maxAnisotropy) + '\n';
         m_concatedInfo += "------------------                    \n\n";
         
+        m_concatedInfo += "------------------                    \n";
+        m_concatedInfo += "Buffer Info\n";
+        m_concatedInfo += "------------------                    \n";
+        m_concatedInfo += "Uniform Buffer Offset Alignment:  " + std::to_string(m_uniformBufferOffsetAlignment) + '\n';
+        m_concatedInfo += "Max Uniform Block Size:           " + std::to_string(m_maxUniformBlockSize) + '\n';
+        m_concatedInfo += "Max Uniform Buffer Bindings:      " + std::to_string(m_maxUniformBufferBindings) + '\n';
+        m_concatedInfo += "------------------                    \n\n";
+        
         m_concatedInfo += "------------------                    \n";
         m_concatedInfo += "Shader Info\n";
         m_concatedInfo += "------------------                    \n";
@@ -123,6 +176,53 @@ public:
         return m_concatedInfo;
     }
     
+    const char * getVendor() const {
+        return m_vendor != nullptr ? m_vendor : "";
+    }
+    
+    const char * getRenderer() const {
+        return m_renderer != nullptr ? m_renderer : "";
+    }
+    
+    const char * getVersionString() const {
+        return m_version != nullptr ? m_version : "";
+    }
+    
+    GLint getMajorVersion() const {
+        return m_majorVersion;
+    }
+    
+    GLint getMinorVersion() const {
+        return m_minorVersion;
+    }
+    
+    // name is the full extension string e.g. "GL_ARB_buffer_storage"
+    bool hasExtension(std::string const & name) const {
+        return std::binary_search(m_extensions.begin(), m_extensions.end(), name);
+    }
+    
+    std::vector<std::string> const & getExtensions() const {
+        return m_extensions;
+    }
+    
+    // offsets passed to glBindBufferRange(GL_UNIFORM_BUFFER, ...) must be a multiple of this
+    GLint getUniformBufferOffsetAlignment() const {
+        return m_uniformBufferOffsetAlignment;
+    }
+    
+    GLint getMaxUniformBlockSize() const {
+        return m_maxUniformBlockSize;
+    }
+    
+    GLfloat getMaxAnisotropy() const {
+        return m_maxAnisotropy;
+    }
+    
+    // version of the created context - not the version the layers were compiled against
+    bool isVersionAtLeast(GLint major, GLint minor) const {
+        return m_majorVersion > major || (m_majorVersion == major && m_minorVersion >= minor);
+    }
+    
 private:
     //---------------Context------------------//
     bool         m_isCoreProfile;
@@ -131,6 +231,8 @@ private:
     GLint        m_minorVersion;
     const char * m_vendor;
     const char * m_renderer;
+    const char * m_version;
+    std::vector<std::string> m_extensions;
     //----------------------------------------//
     
     //---------------Texture------------------//
@@ -140,32 +242,13 @@ private:
     GLint        m_maxTextureSize;
     //----------------------------------------//
     
-    std::string m_concatedInfo;
+    //---------------Buffer-------------------//
+    GLint        m_uniformBufferOffsetAlignment;
+    GLint        m_maxUniformBlockSize;
+    GLint        m_maxUniformBufferBindings;
+    //----------------------------------------//
     
-    void checkOpenGLError(const char * stmt, const char * fname, int line) const {
-        // TODO: add assert functionality
-        GLenum err;
-        
-        while((err = glGetError()) != GL_NO_ERROR) {
-            std::string errorType;
-            
-            switch(err) {
-                case GL_INVALID_OPERATION:             errorType = "INVALID_OPERATION";             break;
-                case GL_INVALID_ENUM:                  errorType = "INVALID_ENUM";                  break;
-                case GL_INVALID_VALUE:                 errorType = "INVALID_VALUE";                 break;
-                case GL_OUT_OF_MEMORY:                 errorType = "OUT_OF_MEMORY";                 break;
-                case GL_INVALID_FRAMEBUFFER_OPERATION: errorType = "INVALID_FRAMEBUFFER_OPERATION"; break;
-                default:                               errorType = "UKNOWN ERROR - FUCK SAKE";      break;
-            }
-            
-            std::cerr << "-----------------------------------------------------------------------------\nOPENGL ERROR: "<< errorType
-            << "\nFilename: " << fname
-            << "\nline: " << line
-            << "\nerror on: " << stmt
-            << "\n-----------------------------------------------------------------------------"
-            << std::endl;
-        }
-    }
+    std::string m_concatedInfo;
 };
 
 #endif /* OpenglInformationLayer_h */
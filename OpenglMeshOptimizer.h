@@ -0,0 +1,359 @@
+//
+//  OpenglMeshOptimizer.h
+//  OpenglFramework
+//
+
+/*
+ class information
+ - import time mesh processing, no opengl calls so it can run on any thread or in an offline tool
+ - run optimizeVertexCache() first and then optimizeVertexFetch(), the fetch pass follows the new triangle order
+ - the result is meant for OpenglVertexDataLayer::createIndexBufferObject() which picks the index width
+ - benchmarkMeshes() runs optimizeMesh() on generated meshes and reports the acmr before and after
+ */
+
+#ifndef OpenglMeshOptimizer_h
+#define OpenglMeshOptimizer_h
+
+// generic includes
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <assert.h>
+
+namespace glLayer {
+    
+    struct MeshOptimizationReport {
+        size_t triangles;
+        size_t verticesBefore;
+        size_t verticesAfter;
+        float  acmrBefore; // average cache miss ratio - misses per triangle, 0.5 is the best a regular grid can do
+        float  acmrAfter;
+        float  atvrBefore; // misses per vertex - 1.0 is optimal
+        float  atvrAfter;
+    };
+    
+    struct MeshBenchmark {
+        const char *           mesh;
+        MeshOptimizationReport report;
+        double                 milliseconds; // optimizeMesh() including both passes
+    };
+    
+    class MeshOptimizer {
+    public:
+        static constexpr unsigned DEFAULT_CACHE_SIZE = 16;
+        
+        // simulates a fifo post transform cache of cacheSize entries and returns misses per triangle
+        static float computeACMR(std::vector<uint32_t> const & indices, size_t vertexCount, unsigned cacheSize = DEFAULT_CACHE_SIZE) {
+            if(indices.size() < 3) {
+                return 0.0f;
+            }
+            return float(countCacheMisses(indices, vertexCount, cacheSize)) / float(indices.size() / 3);
+        }
+        
+        // misses per referenced vertex
+        static float computeATVR(std::vector<uint32_t> const & indices, size_t vertexCount, unsigned cacheSize = DEFAULT_CACHE_SIZE) {
+            std::vector<bool> used(vertexCount, false);
+            size_t usedCount = 0;
+            for(auto index : indices) {
+                if(!used[index]) {
+                    used[index] = true;
+                    usedCount++;
+                }
+            }
+            return usedCount == 0 ? 0.0f : float(countCacheMisses(indices, vertexCount, cacheSize)) / float(usedCount);
+        }
+        
+        /*
+         reorders triangles for post transform cache locality using tipsify (Sander, Nehab, Barczak 2007).
+         runs in linear time - it fans around a vertex, emitting all of its remaining triangles, and then picks the
+         next fanning vertex from the vertices just emitted that will still be in the cache.
+         */
+        static void optimizeVertexCache(std::vector<uint32_t> & indices, size_t vertexCount, unsigned cacheSize = DEFAULT_CACHE_SIZE) {
+            assert(indices.size() % 3 == 0 && "indices must be a triangle list");
+            
+            const size_t triangleCount = indices.size() / 3;
+            if(triangleCount == 0) {
+                return;
+            }
+            
+            // vertex -> triangle adjacency in compressed rows
+            std::vector<uint32_t> liveTriangles(vertexCount, 0);
+            for(auto index : indices) {
+                assert(index < vertexCount && "index out of range");
+                liveTriangles[index]++;
+            }
+            
+            std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+            for(size_t v = 0; v < vertexCount; v++) {
+                adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+            }
+            
+            std::vector<uint32_t> adjacency(indices.size());
+            std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for(size_t t = 0; t < triangleCount; t++) {
+                for(size_t corner = 0; corner < 3; corner++) {
+                    adjacency[fill[indices[t * 3 + corner]]++] = static_cast<uint32_t>(t);
+                }
+            }
+            
+            std::vector<uint32_t> cacheTime(vertexCount, 0);
+            std::vector<bool>     emitted(triangleCount, false);
+            std::vector<uint32_t> deadEnd;
+            std::vector<uint32_t> candidates;
+            std::vector<uint32_t> output;
+            
+            deadEnd.reserve(indices.size());
+            output.reserve(indices.size());
+            
+            uint32_t timeStamp = cacheSize + 1;
+            size_t   cursor    = 0;
+            int64_t  fanning   = findNextLiveVertex(liveTriangles, cursor);
+            
+            while(fanning >= 0) {
+                candidates.clear();
+                
+                for(uint32_t a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; a++) {
+                    uint32_t triangle = adjacency[a];
+                    if(emitted[triangle]) {
+                        continue;
+                    }
+                    
+                    for(size_t corner = 0; corner < 3; corner++) {
+                        uint32_t v = indices[triangle * 3 + corner];
+                        output.push_back(v);
+                        deadEnd.push_back(v);
+                        candidates.push_back(v);
+                        liveTriangles[v]--;
+                        
+                        if(timeStamp - cacheTime[v] > cacheSize) {
+                            cacheTime[v] = timeStamp++;
+                        }
+                    }
+                    emitted[triangle] = true;
+                }
+                
+                // best candidate is the one that stays in the cache longest after its fan is emitted
+                int64_t  next     = -1;
+                int64_t  bestPriority = -1;
+                for(auto v : candidates) {
+                    if(liveTriangles[v] == 0) {
+                        continue;
+                    }
+                    
+                    int64_t priority = 0;
+                    if(timeStamp - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+                        priority = timeStamp - cacheTime[v];
+                    }
+                    
+                    if(priority > bestPriority) {
+                        bestPriority = priority;
+                        next = v;
+                    }
+                }
+                
+                if(next == -1) {
+                    next = skipDeadEnd(liveTriangles, deadEnd, cursor);
+                }
+                
+                fanning = next;
+            }
+            
+            indices.swap(output);
+        }
+        
+        /*
+         reorders vertices into the order the index buffer first touches them and rewrites the indices.
+         unreferenced vertices are dropped. returns the new vertex count.
+         */
+        template<typename Vertex>
+        static size_t optimizeVertexFetch(std::vector<uint32_t> & indices, std::vector<Vertex> & vertices) {
+            const uint32_t unused = 0xFFFFFFFF;
+            
+            std::vector<uint32_t> remap(vertices.size(), unused);
+            std::vector<Vertex>   reordered;
+            reordered.reserve(vertices.size());
+            
+            for(auto & index : indices) {
+                assert(index < vertices.size() && "index out of range");
+                
+                if(remap[index] == unused) {
+                    remap[index] = static_cast<uint32_t>(reordered.size());
+                    reordered.push_back(vertices[index]);
+                }
+                index = remap[index];
+            }
+            
+            vertices.swap(reordered);
+            return vertices.size();
+        }
+        
+        // both passes with before/after statistics - the numbers to look at when tuning an import pipeline
+        template<typename Vertex>
+        static MeshOptimizationReport optimizeMesh(std::vector<uint32_t> & indices, std::vector<Vertex> & vertices, unsigned cacheSize = DEFAULT_CACHE_SIZE) {
+            MeshOptimizationReport report;
+            report.triangles      = indices.size() / 3;
+            report.verticesBefore = vertices.size();
+            report.acmrBefore     = computeACMR(indices, vertices.size(), cacheSize);
+            report.atvrBefore     = computeATVR(indices, vertices.size(), cacheSize);
+            
+            optimizeVertexCache(indices, vertices.size(), cacheSize);
+            optimizeVertexFetch(indices, vertices);
+            
+            report.verticesAfter = vertices.size();
+            report.acmrAfter     = computeACMR(indices, vertices.size(), cacheSize);
+            report.atvrAfter     = computeATVR(indices, vertices.size(), cacheSize);
+            
+            return report;
+        }
+        
+        /* Benchmark */
+        /*------------------------------------------------------------------------------------------*/
+        /*
+         runs optimizeMesh() on generated meshes - a grid in scanline order, the same grid with its triangles
+         shuffled (what an exporter that does not care about order produces) and a uv sphere. gridSize is the
+         number of quads along each side of the grid and the number of rings of the sphere.
+         a harness, not a test - the numbers to compare when changing the cache optimizer.
+         */
+        static std::vector<MeshBenchmark> benchmarkMeshes(uint32_t gridSize = 128, unsigned cacheSize = DEFAULT_CACHE_SIZE) {
+            assert(gridSize >= 2 && "the meshes need at least two quads per side");
+            
+            std::vector<MeshBenchmark> results;
+            
+            const char * meshes[] = { "grid", "shuffled grid", "sphere" };
+            
+            for(const char * mesh : meshes) {
+                std::vector<uint32_t>        indices;
+                std::vector<BenchmarkVertex> vertices;
+                
+                if(mesh == meshes[2]) {
+                    makeSphere(gridSize, gridSize * 2, indices, vertices);
+                } else {
+                    makeGrid(gridSize, indices, vertices);
+                    if(mesh == meshes[1]) {
+                        shuffleTriangles(indices);
+                    }
+                }
+                
+                auto start = std::chrono::steady_clock::now();
+                
+                MeshBenchmark result;
+                result.mesh         = mesh;
+                result.report       = optimizeMesh(indices, vertices, cacheSize);
+                result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                results.push_back(result);
+            }
+            
+            return results;
+        }
+    
+    private:
+        struct BenchmarkVertex {
+            float position[3];
+        };
+        
+        static void makeGrid(uint32_t size, std::vector<uint32_t> & indices, std::vector<BenchmarkVertex> & vertices) {
+            const uint32_t row = size + 1;
+            
+            for(uint32_t y = 0; y <= size; y++) {
+                for(uint32_t x = 0; x <= size; x++) {
+                    vertices.push_back({ { float(x), float(y), 0.0f } });
+                }
+            }
+            
+            for(uint32_t y = 0; y < size; y++) {
+                for(uint32_t x = 0; x < size; x++) {
+                    uint32_t corner = y * row + x;
+                    indices.insert(indices.end(), { corner, corner + 1, corner + row + 1 });
+                    indices.insert(indices.end(), { corner, corner + row + 1, corner + row });
+                }
+            }
+        }
+        
+        // one vertex at each pole, rings - 1 rows of segments vertices in between
+        static void makeSphere(uint32_t rings, uint32_t segments, std::vector<uint32_t> & indices, std::vector<BenchmarkVertex> & vertices) {
+            const float pi = 3.14159265358979f;
+            
+            vertices.push_back({ { 0.0f, 1.0f, 0.0f } });
+            for(uint32_t ring = 1; ring < rings; ring++) {
+                float theta = pi * float(ring) / float(rings);
+                for(uint32_t segment = 0; segment < segments; segment++) {
+                    float phi = 2.0f * pi * float(segment) / float(segments);
+                    vertices.push_back({ { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) } });
+                }
+            }
+            vertices.push_back({ { 0.0f, -1.0f, 0.0f } });
+            
+            const uint32_t south = static_cast<uint32_t>(vertices.size() - 1);
+            
+            for(uint32_t segment = 0; segment < segments; segment++) {
+                uint32_t next = (segment + 1) % segments;
+                
+                indices.insert(indices.end(), { 0, 1 + next, 1 + segment });
+                
+                for(uint32_t ring = 1; ring + 1 < rings; ring++) {
+                    uint32_t top    = 1 + (ring - 1) * segments;
+                    uint32_t bottom = top + segments;
+                    indices.insert(indices.end(), { top + segment, top + next, bottom + next });
+                    indices.insert(indices.end(), { top + segment, bottom + next, bottom + segment });
+                }
+                
+                uint32_t last = 1 + (rings - 2) * segments;
+                indices.insert(indices.end(), { last + segment, last + next, south });
+            }
+        }
+        
+        // fisher yates over whole triangles with a fixed seed so every run measures the same mesh
+        static void shuffleTriangles(std::vector<uint32_t> & indices) {
+            uint32_t state = 0x12345678u;
+            for(size_t t = indices.size() / 3; t > 1; t--) {
+                state = state * 1664525u + 1013904223u;
+                size_t other = (state >> 8) % t;
+                for(size_t corner = 0; corner < 3; corner++) {
+                    std::swap(indices[(t - 1) * 3 + corner], indices[other * 3 + corner]);
+                }
+            }
+        }
+        
+        static size_t countCacheMisses(std::vector<uint32_t> const & indices, size_t vertexCount, unsigned cacheSize) {
+            // fifo - a vertex is in the cache if it was inserted less than cacheSize misses ago
+            std::vector<size_t> insertedAt(vertexCount, 0);
+            size_t misses = 0;
+            
+            for(auto index : indices) {
+                assert(index < vertexCount && "index out of range");
+                
+                if(insertedAt[index] == 0 || misses - insertedAt[index] >= cacheSize) {
+                    misses++;
+                    insertedAt[index] = misses;
+                }
+            }
+            return misses;
+        }
+        
+        static int64_t findNextLiveVertex(std::vector<uint32_t> const & liveTriangles, size_t & cursor) {
+            while(cursor < liveTriangles.size()) {
+                if(liveTriangles[cursor] > 0) {
+                    return static_cast<int64_t>(cursor);
+                }
+                cursor++;
+            }
+            return -1;
+        }
+        
+        // first try recently emitted vertices, then scan forward through the vertex list
+        static int64_t skipDeadEnd(std::vector<uint32_t> const & liveTriangles, std::vector<uint32_t> & deadEnd, size_t & cursor) {
+            while(!deadEnd.empty()) {
+                uint32_t v = deadEnd.back();
+                deadEnd.pop_back();
+                if(liveTriangles[v] > 0) {
+                    return v;
+                }
+            }
+            return findNextLiveVertex(liveTriangles, cursor);
+        }
+    };
+}
+
+#endif /* OpenglMeshOptimizer_h */
@@ -0,0 +1,472 @@
+//
+//  OpenglProfilerLayer.h
+//  OpenglFramework
+//
+
+/*
+ class information
+ - cpu and gpu timings for named scopes. the gpu results are read a few frames later, once they are there, so
+   reading them never stalls the pipeline
+ - beginFrame()/endFrame() go around everything that should be measured once a frame, scopes outside a frame
+   are ignored
+ - every scope puts a GL_TIMESTAMP query at its start and end - timestamps can nest where GL_TIME_ELAPSED
+   queries can not. queries come from a pool that grows to what a frame needs and is then reused
+ - at most framesInFlight frames wait for results. when they are all still waiting the next frame is not
+   recorded, it is dropped rather than waited for
+ - OpenglDrawLayer::setProfiler() makes processDrawCommands() open a scope for every sorted state bucket
+ - setEnabled() can be called at any time and takes effect at the next beginFrame(). while disabled a scope
+   costs a branch
+ - captured frames are written as chrome trace json (chrome://tracing or ui.perfetto.dev) with the cpu and gpu
+   scopes on their own tracks
+ */
+
+#ifndef OpenglProfilerLayer_h
+#define OpenglProfilerLayer_h
+
+// generic includes
+#include <vector>
+#include <deque>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <initializer_list>
+#include <assert.h>
+
+// platform dependent includes
+#ifdef __APPLE__
+#include <OpenGL/gl3.h>
+#include <OpenGL/gl3ext.h>
+#elif _WIN32
+#include "GL/glew.h"
+#endif
+
+//local includes
+#include "OpenglDebugLayer.h"
+#include "OpenglInformationLayer.h"
+
+namespace glLayer {
+    
+    // a named value shown with the scope in the trace - the name must outlive the profiler's results
+    struct ProfileScopeArg {
+        const char * name;
+        uint32_t     value;
+    };
+    
+    struct ProfileScopeResult {
+        static constexpr uint32_t MAX_ARGS = 3;
+        
+        const char *    name;
+        uint32_t        depth; // 0 is the frame
+        uint32_t        argCount;
+        ProfileScopeArg args[MAX_ARGS];
+        double          cpuBegin; // microseconds since OpenglProfilerLayer::init()
+        double          cpuEnd;
+        double          gpuBegin; // the gpu clock moved onto the cpu timeline - 0 without timer queries
+        double          gpuEnd;
+        
+        double cpuMilliseconds() const { return (cpuEnd - cpuBegin) / 1000.0; }
+        double gpuMilliseconds() const { return (gpuEnd - gpuBegin) / 1000.0; }
+    };
+    
+    struct ProfileFrameResult {
+        uint64_t                        frame;
+        std::vector<ProfileScopeResult> scopes; // in the order they were opened, the frame first
+    };
+    
+    class OpenglProfilerLayer {
+    public:
+        OpenglProfilerLayer()
+        : m_initialised(false)
+        , m_enableRequested(false)
+        , m_recording(false)
+        , m_capturing(false)
+        , m_timerQueries(false)
+        , m_framesInFlight(3)
+        , m_frameIndex(0)
+        , m_droppedFrames(0)
+        {
+            m_lastFrame.frame = 0;
+        }
+        
+        ~OpenglProfilerLayer() {
+            dispose();
+        }
+        
+        OpenglProfilerLayer(OpenglProfilerLayer const &) = delete;
+        OpenglProfilerLayer & operator=(OpenglProfilerLayer const &) = delete;
+        
+        // framesInFlight 2 or 3 - more only adds latency to the results
+        bool init(OpenglInformationLayer const & info, bool enabled = true, uint32_t framesInFlight = 3) {
+            if(m_initialised) {
+                assert(false && "double init you noob");
+                return false;
+            }
+            assert(framesInFlight > 0 && "the profiler needs at least one frame in flight");
+            
+            // without timer queries the scopes still get their cpu times
+            m_timerQueries    = info.isVersionAtLeast(3, 3) || info.hasExtension("GL_ARB_timer_query");
+            m_framesInFlight  = framesInFlight;
+            m_enableRequested = enabled;
+            m_epoch           = std::chrono::steady_clock::now();
+            m_initialised     = true;
+            return m_initialised;
+        }
+        
+        void dispose() {
+            if(!m_initialised) {
+                return;
+            }
+            
+            for(auto & frame : m_inFlight) {
+                releaseQueries(frame);
+            }
+            releaseQueries(m_current);
+            m_inFlight.clear();
+            m_current.scopes.clear();
+            m_openScopes.clear();
+            
+            if(!m_freeQueries.empty()) {
+                GL_CHECK(glDeleteQueries(static_cast<GLsizei>(m_freeQueries.size()), m_freeQueries.data()));
+                m_freeQueries.clear();
+            }
+            
+            m_recording   = false;
+            m_initialised = false;
+        }
+        
+        void setEnabled(bool enabled) {
+            m_enableRequested = enabled;
+        }
+        
+        bool isEnabled() const {
+            return m_enableRequested;
+        }
+        
+        // true between beginFrame() and endFrame() of a frame that is being measured
+        bool isRecording() const {
+            return m_recording;
+        }
+        
+        bool hasGpuTimers() const {
+            return m_timerQueries;
+        }
+        
+        // frames that were not recorded because every frame in flight was still waiting for the gpu
+        uint64_t getDroppedFrames() const {
+            return m_droppedFrames;
+        }
+        
+        void beginFrame() {
+            assert(m_initialised && "profiler layer must be initialised before beginFrame()");
+            assert(!m_recording && "beginFrame() called twice without endFrame()");
+            
+            resolveFrames();
+            
+            if(!m_enableRequested) {
+                return;
+            }
+            
+            if(m_inFlight.size() >= m_framesInFlight) {
+                m_droppedFrames++;
+                return;
+            }
+            
+            m_recording       = true;
+            m_current.frame   = m_frameIndex++;
+            m_current.capture = m_capturing;
+            m_current.scopes.clear();
+            m_current.clockOffset = 0;
+            
+            // pairs the two clocks once a frame so the gpu scopes can be put on the cpu timeline
+            if(m_timerQueries) {
+                GLint64 gpuNow = 0;
+                GL_CHECK(glGetInteger64v(GL_TIMESTAMP, &gpuNow));
+                m_current.clockOffset = cpuNow() - gpuNow;
+            }
+            
+            beginScope("frame");
+        }
+        
+        void endFrame() {
+            if(!m_recording) {
+                return;
+            }
+            
+            endScope();
+            assert(m_openScopes.empty() && "a scope was left open at the end of the frame");
+            m_openScopes.clear();
+            
+            m_inFlight.push_back(std::move(m_current));
+            m_current = FrameRecord();
+            m_recording = false;
+        }
+        
+        // name must outlive the profiler's results - a string literal
+        void beginScope(const char * name, std::initializer_list<ProfileScopeArg> args = {}) {
+            if(!m_recording) {
+                return;
+            }
+            assert(args.size() <= ProfileScopeResult::MAX_ARGS && "too many scope arguments");
+            
+            ScopeRecord scope;
+            scope.name       = name;
+            scope.depth      = static_cast<uint32_t>(m_openScopes.size());
+            scope.argCount   = 0;
+            scope.beginQuery = OPENGL_INVALID_OBJECT;
+            scope.endQuery   = OPENGL_INVALID_OBJECT;
+            
+            for(auto const & arg : args) {
+                if(scope.argCount < ProfileScopeResult::MAX_ARGS) {
+                    scope.args[scope.argCount++] = arg;
+                }
+            }
+            
+            if(m_timerQueries) {
+                scope.beginQuery = acquireQuery();
+                GL_CHECK(glQueryCounter(scope.beginQuery, GL_TIMESTAMP));
+            }
+            
+            m_openScopes.push_back(static_cast<uint32_t>(m_current.scopes.size()));
+            scope.cpuBegin = cpuNow();
+            scope.cpuEnd   = scope.cpuBegin;
+            m_current.scopes.push_back(scope);
+        }
+        
+        void endScope() {
+            if(!m_recording) {
+                return;
+            }
+            assert(!m_openScopes.empty() && "endScope() without beginScope()");
+            
+            ScopeRecord & scope = m_current.scopes[m_openScopes.back()];
+            m_openScopes.pop_back();
+            
+            scope.cpuEnd = cpuNow();
+            if(m_timerQueries) {
+                scope.endQuery = acquireQuery();
+                GL_CHECK(glQueryCounter(scope.endQuery, GL_TIMESTAMP));
+            }
+        }
+        
+        // the newest frame whose results are in - framesInFlight frames old at most. no scopes until one has arrived
+        ProfileFrameResult const & getLastFrame() const {
+            return m_lastFrame;
+        }
+        
+        /* Chrome Trace */
+        /*------------------------------------------------------------------------------------------*/
+        // frames recorded from now on are kept - they are added as their results arrive, a few frames later
+        void beginCapture() {
+            m_captured.clear();
+            m_capturing = true;
+        }
+        
+        void endCapture() {
+            m_capturing = false;
+        }
+        
+        size_t getCapturedFrameCount() const {
+            return m_captured.size();
+        }
+        
+        std::string getChromeTrace() const {
+            std::string json = "{\"traceEvents\":[\n";
+            json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"cpu\"}},\n";
+            json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"gpu\"}}";
+            
+            for(auto const & frame : m_captured) {
+                for(auto const & scope : frame.scopes) {
+                    appendTraceEvent(json, frame.frame, scope, 1, scope.cpuBegin, scope.cpuEnd);
+                    if(m_timerQueries) {
+                        appendTraceEvent(json, frame.frame, scope, 2, scope.gpuBegin, scope.gpuEnd);
+                    }
+                }
+            }
+            
+            json += "\n],\"displayTimeUnit\":\"ms\"}\n";
+            return json;
+        }
+        
+        bool writeChromeTrace(std::string const & path) const {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            if(!file) {
+                std::cout << "writeChromeTrace: could not open " << path << " D:" << std::endl;
+                return false;
+            }
+            
+            std::string json = getChromeTrace();
+            file.write(json.data(), static_cast<std::streamsize>(json.size()));
+            return static_cast<bool>(file);
+        }
+    
+    private:
+        struct ScopeRecord {
+            const char *    name;
+            uint32_t        depth;
+            uint32_t        argCount;
+            ProfileScopeArg args[ProfileScopeResult::MAX_ARGS];
+            int64_t         cpuBegin; // nanoseconds since init()
+            int64_t         cpuEnd;
+            GLuint          beginQuery;
+            GLuint          endQuery;
+        };
+        
+        struct FrameRecord {
+            uint64_t                 frame       = 0;
+            bool                     capture     = false;
+            int64_t                  clockOffset = 0; // cpu minus gpu nanoseconds
+            std::vector<ScopeRecord> scopes;
+        };
+        
+        bool                                  m_initialised;
+        bool                                  m_enableRequested;
+        bool                                  m_recording;
+        bool                                  m_capturing;
+        bool                                  m_timerQueries;
+        uint32_t                              m_framesInFlight;
+        uint64_t                              m_frameIndex;
+        uint64_t                              m_droppedFrames;
+        std::chrono::steady_clock::time_point m_epoch;
+        
+        FrameRecord                           m_current;
+        std::vector<uint32_t>                 m_openScopes;
+        std::deque<FrameRecord>               m_inFlight;
+        std::vector<GLuint>                   m_freeQueries;
+        ProfileFrameResult                    m_lastFrame;
+        std::vector<ProfileFrameResult>       m_captured;
+        
+        int64_t cpuNow() const {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_epoch).count();
+        }
+        
+        GLuint acquireQuery() {
+            if(m_freeQueries.empty()) {
+                const GLsizei batch = 64;
+                m_freeQueries.resize(batch);
+                GL_CHECK(glGenQueries(batch, m_freeQueries.data()));
+            }
+            
+            GLuint query = m_freeQueries.back();
+            m_freeQueries.pop_back();
+            return query;
+        }
+        
+        void releaseQueries(FrameRecord & frame) {
+            for(auto const & scope : frame.scopes) {
+                if(scope.beginQuery != OPENGL_INVALID_OBJECT) {
+                    m_freeQueries.push_back(scope.beginQuery);
+                }
+                if(scope.endQuery != OPENGL_INVALID_OBJECT) {
+                    m_freeQueries.push_back(scope.endQuery);
+                }
+            }
+        }
+        
+        /*
+         oldest first, and never waits - the frame's end query is the last one it issued so once that has its
+         result every query of the frame has
+         */
+        void resolveFrames() {
+            while(!m_inFlight.empty()) {
+                FrameRecord & frame = m_inFlight.front();
+                
+                if(m_timerQueries) {
+                    GLuint available = GL_FALSE;
+                    GL_CHECK(glGetQueryObjectuiv(frame.scopes.front().endQuery, GL_QUERY_RESULT_AVAILABLE, &available));
+                    if(available == GL_FALSE) {
+                        return;
+                    }
+                }
+                
+                m_lastFrame.frame = frame.frame;
+                m_lastFrame.scopes.resize(frame.scopes.size());
+                
+                for(size_t i = 0; i < frame.scopes.size(); i++) {
+                    ScopeRecord const &  scope  = frame.scopes[i];
+                    ProfileScopeResult & result = m_lastFrame.scopes[i];
+                    
+                    result.name     = scope.name;
+                    result.depth    = scope.depth;
+                    result.argCount = scope.argCount;
+                    std::copy(scope.args, scope.args + scope.argCount, result.args);
+                    result.cpuBegin = double(scope.cpuBegin) / 1000.0;
+                    result.cpuEnd   = double(scope.cpuEnd)   / 1000.0;
+                    result.gpuBegin = 0.0;
+                    result.gpuEnd   = 0.0;
+                    
+                    if(m_timerQueries) {
+                        GLuint64 begin = 0;
+                        GLuint64 end   = 0;
+                        GL_CHECK(glGetQueryObjectui64v(scope.beginQuery, GL_QUERY_RESULT, &begin));
+                        GL_CHECK(glGetQueryObjectui64v(scope.endQuery,   GL_QUERY_RESULT, &end));
+                        result.gpuBegin = double(static_cast<int64_t>(begin) + frame.clockOffset) / 1000.0;
+                        result.gpuEnd   = double(static_cast<int64_t>(end)   + frame.clockOffset) / 1000.0;
+                    }
+                }
+                
+                if(frame.capture) {
+                    m_captured.push_back(m_lastFrame);
+                }
+                
+                releaseQueries(frame);
+                m_inFlight.pop_front();
+            }
+        }
+        
+        static void appendTraceEvent(std::string & json, uint64_t frame, ProfileScopeResult const & scope, int thread, double begin, double end) {
+            char buffer[256];
+            
+            json += ",\n{\"name\":\"";
+            appendEscaped(json, scope.name);
+            snprintf(buffer, sizeof(buffer), "\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu",
+                     thread == 1 ? "cpu" : "gpu", thread, begin, end - begin, static_cast<unsigned long long>(frame));
+            json += buffer;
+            
+            for(uint32_t i = 0; i < scope.argCount; i++) {
+                json += ",\"";
+                appendEscaped(json, scope.args[i].name);
+                snprintf(buffer, sizeof(buffer), "\":%u", scope.args[i].value);
+                json += buffer;
+            }
+            json += "}}";
+        }
+        
+        static void appendEscaped(std::string & json, const char * text) {
+            for(; *text != '\0'; text++) {
+                if(*text == '"' || *text == '\\') {
+                    json += '\\';
+                }
+                json += *text;
+            }
+        }
+    };
+    
+    // opens a scope for the lifetime of the object - a null profiler does nothing
+    class ProfileScope {
+    public:
+        ProfileScope(OpenglProfilerLayer * profiler, const char * name, std::initializer_list<ProfileScopeArg> args = {})
+        : m_profiler(profiler)
+        {
+            if(m_profiler != nullptr) {
+                m_profiler->beginScope(name, args);
+            }
+        }
+        
+        ~ProfileScope() {
+            if(m_profiler != nullptr) {
+                m_profiler->endScope();
+            }
+        }
+        
+        ProfileScope(ProfileScope const &) = delete;
+        ProfileScope & operator=(ProfileScope const &) = delete;
+    
+    private:
+        OpenglProfilerLayer * m_profiler;
+    };
+}
+
+#endif /* OpenglProfilerLayer_h */
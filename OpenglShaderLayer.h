@@ -16,9 +16,7 @@
  - add ifdefs for opengl versions
  - add context creation into layer so it is based on the version defines.??
  - add master function for shader creation
- - figure out some template magic for the TexturePixelData class and then pass it into the create texture function !(:
  - if defs for DSA opengl
- - finish of createTexture function - currently only works for certain texture types
  - replace glew with something ?? for the windows version
  */
 
@@ -30,8 +28,29 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <memory>
+#include <deque>
+#include <unordered_map>
 #include <assert.h>
 
+#include <chrono>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
 // platform dependent includes
 #ifdef __APPLE__
 #include <OpenGL/gl3.h>
@@ -40,20 +59,26 @@
 #include "GL/glew.h"
 #endif
 
-//defines
+//defines - the version can be overridden before including to compile in newer api paths
+#ifndef OPENGL_MAJOR_VERSION
 #define OPENGL_MAJOR_VERSION  4
+#endif
+#ifndef OPENGL_MINOR_VERSION
 #define OPENGL_MINOR_VERSION  1
+#endif
 #define OPENGL_MIN_REQUIRED_VERSION_MAJOR 3
 #define OPENGL_MIN_REQUIRED_VERSION_MINOR 2
-#define OPENGL_INVALID_OBJECT 0
 
-#ifndef GL_CHECK
-#ifdef DEBUG
-#define GL_CHECK(stmt) do { stmt; checkOpenGLError(#stmt,__FILE__,__LINE__); } while(0)
+//local includes
+#include "OpenglDebugLayer.h"
+#include "OpenglInformationLayer.h"
+
+// glProgramUniform* is declared - whether the context has it is checked in init()
+#if OPENGL_VERSION_AT_LEAST(4, 1) || defined(GL_ARB_separate_shader_objects)
+#define OPENGL_PROGRAM_UNIFORM 1
 #else
-#define GL_CHECK(stmt) stmt
-#endif//DEBUG
-#endif//GL_CHECK
+#define OPENGL_PROGRAM_UNIFORM 0
+#endif
 
 namespace glLayer
 {
@@ -62,13 +87,13 @@ namespace glLayer
     enum class ShaderObjectType
     {
         VERTEX_SHADER          = GL_VERTEX_SHADER,
-#if OPENGL_MAJOR_VERSION >= 4
+#if OPENGL_VERSION_AT_LEAST(4, 0)
         TESS_CONTROL_SHADER    = GL_TESS_CONTROL_SHADER,
         TESS_EVALUATION_SHADER = GL_TESS_EVALUATION_SHADER,
 #endif
         GEOMETRY_SHADER        = GL_GEOMETRY_SHADER,
         FRAGMENT_SHADER        = GL_FRAGMENT_SHADER,
-#if OPENGL_MAJOR_VERSION >= 4 && OPENGL_MINOR_VERSION >= 3
+#if OPENGL_VERSION_AT_LEAST(4, 3)
         COMPUTE_SHADER         = GL_COMPUTE_SHADER
 #endif
     };
@@ -99,10 +124,13 @@ namespace glLayer
         bool             m_isCompiled;
     };
     
+    class ProgramReflection;
+    
     class ShaderProgram
     {
         friend class OpenglShaderLayer;
         friend class OpenglDrawLayer;
+        friend class DrawCommand;
         
     public:
         ShaderProgram()
@@ -117,281 +145,2336 @@ namespace glLayer
         bool operator!=(ShaderProgram const & rhs) { return(!(this->m_id == rhs.m_id));}
         operator int() const { return m_id;}
         
+        // filled in when the program links - nullptr before that
+        ProgramReflection const * getReflection() const { return m_reflection.get(); }
+    
     private:
         GLuint                    m_id;
         std::vector<ShaderObject> m_shaderObjects;
         bool                      m_linked;
+        std::shared_ptr<const ProgramReflection> m_reflection; // shared between copies of the program
     };
     
-    class OpenglShaderLayer
-    {
+    /* Hashing */
+    /*----------------------------------------------------------------------------------------------*/
+    // 64 bit FNV-1a - constexpr so names can be hashed at compile time
+    constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+    constexpr uint64_t FNV_PRIME        = 0x100000001b3ULL;
+    
+    constexpr uint64_t fnv1a(const char * string, uint64_t hash = FNV_OFFSET_BASIS) {
+        return *string == '\0' ? hash : fnv1a(string + 1, (hash ^ static_cast<uint8_t>(*string)) * FNV_PRIME);
+    }
+    
+    inline uint64_t fnv1aBytes(void const * data, size_t length, uint64_t hash = FNV_OFFSET_BASIS) {
+        const uint8_t * bytes = static_cast<const uint8_t *>(data);
+        for(size_t i = 0; i < length; i++) {
+            hash = (hash ^ bytes[i]) * FNV_PRIME;
+        }
+        return hash;
+    }
+    
+    inline uint64_t fnv1a(std::string const & string, uint64_t hash = FNV_OFFSET_BASIS) {
+        return fnv1aBytes(string.data(), string.size(), hash);
+    }
+    
+    /* Program Reflection */
+    /*----------------------------------------------------------------------------------------------*/
+    /*
+     everything the linker reports as active, keyed by the fnv1a hash of the name.
+     - hash the names at compile time: constexpr uint64_t MVP = fnv1a("mvp");
+     - arrays are stored under the base name, "lights[0]" is found with fnv1a("lights")
+     - uniforms inside a block have location -1 and a valid blockIndex / offset
+     */
+    struct UniformInfo {
+        uint64_t nameHash;
+        GLint    location;
+        GLenum   type;
+        GLint    arraySize;
+        GLint    blockIndex;
+        GLint    offset;
+        GLint    arrayStride;
+        GLint    matrixStride;
+    };
+    
+    struct UniformBlockInfo {
+        uint64_t nameHash;
+        GLuint   index;
+        GLint    dataSize;
+        GLint    binding;
+    };
+    
+    struct AttributeInfo {
+        uint64_t nameHash;
+        GLint    location;
+        GLenum   type;
+        GLint    arraySize;
+    };
+    
+    class ProgramReflection {
+        friend class OpenglShaderLayer;
     public:
+        UniformInfo const * findUniform(uint64_t nameHash) const {
+            return find(m_uniforms, nameHash);
+        }
         
-        OpenglShaderLayer()
-        :
-        m_initialised(false)
-        {}
+        UniformBlockInfo const * findUniformBlock(uint64_t nameHash) const {
+            return find(m_blocks, nameHash);
+        }
         
-        ~OpenglShaderLayer() {
-            dispose();
+        AttributeInfo const * findAttribute(uint64_t nameHash) const {
+            return find(m_attributes, nameHash);
         }
         
-        bool init() {
-            if(m_initialised) {
-                assert(false && "double init you noob");
-                return false;
+        // -1 when the uniform is not active - the same as glGetUniformLocation
+        GLint getUniformLocation(uint64_t nameHash) const {
+            UniformInfo const * uniform = findUniform(nameHash);
+            return uniform != nullptr ? uniform->location : -1;
+        }
+        
+        std::vector<UniformInfo> const & getUniforms() const { return m_uniforms; }
+        std::vector<UniformBlockInfo> const & getUniformBlocks() const { return m_blocks; }
+        std::vector<AttributeInfo> const & getAttributes() const { return m_attributes; }
+    
+    private:
+        // all sorted by name hash
+        std::vector<UniformInfo>      m_uniforms;
+        std::vector<UniformBlockInfo> m_blocks;
+        std::vector<AttributeInfo>    m_attributes;
+        
+        template<typename T>
+        static T const * find(std::vector<T> const & table, uint64_t nameHash) {
+            auto search = std::lower_bound(table.begin(), table.end(), nameHash, [](T const & entry, uint64_t hash) {
+                return entry.nameHash < hash;
+            });
+            return (search != table.end() && search->nameHash == nameHash) ? &(*search) : nullptr;
+        }
+        
+        template<typename T>
+        static void sortTable(std::vector<T> & table) {
+            std::sort(table.begin(), table.end(), [](T const & a, T const & b) {
+                return a.nameHash < b.nameHash;
+            });
+            
+            for(size_t i = 1; i < table.size(); i++) {
+                assert(table[i - 1].nameHash != table[i].nameHash && "two active names hash to the same value");
             }
-            m_initialised = true;
-            return m_initialised;
         }
+    };
+    
+    /* Shader Object Cache */
+    /*----------------------------------------------------------------------------------------------*/
+    struct ShaderObjectCacheStats {
+        uint64_t lookups;
+        uint64_t hits;
+        uint64_t compiles;
+        size_t   liveObjects;
         
-        void dispose() {
-            if(!m_initialised) {
-                return;
+        float hitRate() const {
+            return lookups == 0 ? 0.0f : float(hits) / float(lookups);
+        }
+    };
+    
+    /* Shader Preprocessor */
+    /*----------------------------------------------------------------------------------------------*/
+    /*
+     a set of #define NAME VALUE lines. kept sorted by name so the same set always produces the same text
+     and therefore the same hash, whatever order the defines were added in.
+     */
+    class ShaderDefines {
+    public:
+        ShaderDefines & set(std::string const & name, std::string const & value = "1") {
+            auto search = std::lower_bound(m_defines.begin(), m_defines.end(), name, [](Define const & define, std::string const & n) {
+                return define.first < n;
+            });
+            
+            if(search != m_defines.end() && search->first == name) {
+                search->second = value;
+            } else {
+                m_defines.insert(search, Define(name, value));
             }
-            m_initialised = false;
+            return *this;
         }
         
-        /*
-         *Order of shader Program creation*
-         - create a shader progarm
-         - create a shader object
-         - compile shader object
-         - attach objects to program
-         - bind attrib locations ? optional
-         - link program
-         */
+        bool empty() const {
+            return m_defines.empty();
+        }
         
-        ShaderProgram createShaderProgram() const {
-            ShaderProgram shaderProgram;
-            
-            GL_CHECK(shaderProgram.m_id = glCreateProgram());
-            
-            // TODO: add program to program list - used for deleting at dispose time.
-            return shaderProgram;
+        std::string toString() const {
+            std::string text;
+            for(auto const & define : m_defines) {
+                text += "#define " + define.first + ' ' + define.second + '\n';
+            }
+            return text;
         }
         
-        ShaderObject createShaderObject(ShaderObjectType const & type) const {
-            ShaderObject shaderObject;
+        // every combination of the features switched on or off on top of base - 2^n sets
+        static std::vector<ShaderDefines> permutations(std::vector<std::string> const & features, ShaderDefines const & base = ShaderDefines()) {
+            assert(features.size() < 16 && "too many features to permute");
             
-            GL_CHECK(shaderObject.m_id = glCreateShader(static_cast<GLenum>(type))); // conversion used to restrist values passed to glCreateShader
+            std::vector<ShaderDefines> sets;
+            sets.reserve(size_t(1) << features.size());
             
-            return shaderObject;
+            for(size_t mask = 0; mask < (size_t(1) << features.size()); mask++) {
+                ShaderDefines defines = base;
+                for(size_t i = 0; i < features.size(); i++) {
+                    if(mask & (size_t(1) << i)) {
+                        defines.set(features[i]);
+                    }
+                }
+                sets.push_back(defines);
+            }
+            return sets;
+        }
+    
+    private:
+        typedef std::pair<std::string, std::string> Define;
+        std::vector<Define> m_defines;
+    };
+    
+    // a piece of shader text that is not owned - points into a file or a generated line
+    struct SourceSegment {
+        const char * data;
+        size_t       length;
+    };
+    
+    /*
+     the output of the preprocessor - a list of segments that go straight to glShaderSource as separate strings
+     so nothing is concatenated. the segments point into file text and generated lines owned by this object.
+     move only - moving keeps the segment pointers valid, a copy would not.
+     */
+    class PreprocessedShader {
+        friend class ShaderPreprocessor;
+    public:
+        PreprocessedShader()
+        : m_hash(FNV_OFFSET_BASIS)
+        , m_valid(false)
+        {
         }
         
-        void attachSourceToShaderObject(ShaderObject & object, std::string const & source) const {
-            // calling this multiple times in consession will overide the privious attached source - concatinate all source before calling this function
-            assert(object != OPENGL_INVALID_OBJECT && "shader object is in invalid state - the shader object must be created with createShaderObject()");
-            assert(!(source.empty()) && "source is empty");
-            
-            const GLchar* shaderSourceStrings[1];
-            GLint shaderSourceStringLengths[1];
-            
-            shaderSourceStrings[0] = source.c_str();
-            shaderSourceStringLengths[0] = static_cast<GLint>(source.length());
+        PreprocessedShader(PreprocessedShader &&) = default;
+        PreprocessedShader & operator=(PreprocessedShader &&) = default;
+        PreprocessedShader(PreprocessedShader const &) = delete;
+        PreprocessedShader & operator=(PreprocessedShader const &) = delete;
+        
+        bool isValid() const                                 { return m_valid; }
+        std::string const & getError() const                 { return m_error; }
+        std::vector<SourceSegment> const & getSegments() const { return m_segments; }
+        
+        // hash of the final text - identical sources hash the same however they were put together
+        uint64_t getHash() const                             { return m_hash; }
+        
+        // the source string number in compiler errors is the index into this - #line N index is emitted for every file
+        std::vector<std::string> const & getFiles() const    { return m_files; }
+        
+        // one string for debugging and logs - the compile path never needs it
+        std::string flatten() const {
+            std::string text;
+            for(auto const & segment : m_segments) {
+                text.append(segment.data, segment.length);
+            }
+            return text;
+        }
+    
+    private:
+        std::vector<SourceSegment>                     m_segments;
+        std::deque<std::string>                        m_generated; // deque so growing it never moves the strings
+        std::vector<std::shared_ptr<const std::string>> m_sources;   // keeps the file text alive
+        std::vector<std::string>                       m_files;
+        uint64_t                                       m_hash;
+        bool                                           m_valid;
+        std::string                                    m_error;
+    };
+    
+    /*
+     resolves #include "file" and injects defines straight after #version.
+     - includes are searched relative to the including file, then in the include directories
+     - files added with addVirtualFile() win over the disk - useful for embedded or generated sources
+     - #pragma once is honoured, c style include guards work as normal
+     - file text is read once and cached, invalidateFile() drops it after the file changed on disk
+     - everything else (#if, #ifdef ...) is left to the glsl compiler
+     */
+    class ShaderPreprocessor {
+    public:
+        static constexpr unsigned MAX_INCLUDE_DEPTH = 32;
+        
+        void addIncludeDirectory(std::string const & directory) {
+            m_includeDirectories.push_back(withTrailingSlash(directory));
+        }
+        
+        void addVirtualFile(std::string const & name, std::string const & source) {
+            m_virtualFiles[name] = std::make_shared<const std::string>(source);
+        }
+        
+        void invalidateFile(std::string const & path) {
+            m_fileCache.erase(path);
+        }
+        
+        void invalidateAllFiles() {
+            m_fileCache.clear();
+        }
+        
+        PreprocessedShader preprocess(std::string const & path, ShaderDefines const & defines = ShaderDefines()) {
+            PreprocessedShader result;
             
-            GL_CHECK(glShaderSource(object, 1, shaderSourceStrings, shaderSourceStringLengths));
+            std::shared_ptr<const std::string> root = load(path, "");
+            if(!root) {
+                result.m_error = "could not open " + path;
+                return result;
+            }
             
-            object.m_hasSource = true;
+            return run(path, root, defines);
         }
         
-        void compileShaderObject(ShaderObject & object) const {
-            assert(object != OPENGL_INVALID_OBJECT && "the shader object being compiled is in an invald state");
-            assert((!(object.m_isCompiled))        && "the shader object being compiled is allready compiled");
-            assert(object.m_hasSource              && "the shader object has no source code to compile");
-            //assert(shaderObject.type == ShaderObjectType::INVALID); TODO: check this out
+        // same as preprocess() for text that is not a file - includes still resolve against the include directories
+        PreprocessedShader preprocessSource(std::string const & source, ShaderDefines const & defines = ShaderDefines(), std::string const & name = "<source>") {
+            return run(name, std::make_shared<const std::string>(source), defines);
+        }
+    
+    private:
+        typedef std::unordered_map<std::string, std::shared_ptr<const std::string>> FileMap;
+        
+        std::vector<std::string> m_includeDirectories;
+        FileMap                  m_virtualFiles;
+        FileMap                  m_fileCache;
+        
+        struct Context {
+            PreprocessedShader *     result;
+            std::vector<std::string> includeStack;
+            std::vector<std::string> pragmaOnce;
+            bool                     endsWithNewline;
+        };
+        
+        static std::string withTrailingSlash(std::string directory) {
+            if(!directory.empty() && directory.back() != '/' && directory.back() != '\\') {
+                directory += '/';
+            }
+            return directory;
+        }
+        
+        static std::string directoryOf(std::string const & path) {
+            size_t slash = path.find_last_of("/\\");
+            return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+        }
+        
+        std::shared_ptr<const std::string> readFile(std::string const & path) {
+            auto cached = m_fileCache.find(path);
+            if(cached != m_fileCache.end()) {
+                return cached->second;
+            }
             
-            GL_CHECK(glCompileShader(object));
+            std::ifstream file(path, std::ios::binary);
+            if(!file) {
+                return nullptr;
+            }
             
-            GLint isCompiled = GL_FALSE;
+            auto text = std::make_shared<const std::string>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            m_fileCache[path] = text;
+            return text;
+        }
+        
+        // resolves name and returns the text - resolvedPath is the key used for #pragma once and #line
+        std::shared_ptr<const std::string> load(std::string const & name, std::string const & fromDirectory, std::string * resolvedPath = nullptr) {
+            auto found = m_virtualFiles.find(name);
+            if(found != m_virtualFiles.end()) {
+                if(resolvedPath) { *resolvedPath = name; }
+                return found->second;
+            }
             
-            GL_CHECK(glGetShaderiv(object,GL_COMPILE_STATUS, &isCompiled));
+            std::vector<std::string> candidates;
+            candidates.push_back(fromDirectory + name);
+            for(auto const & directory : m_includeDirectories) {
+                candidates.push_back(directory + name);
+            }
             
-            if(isCompiled == GL_FALSE) {
-                GLint maxLength = 0;
-                GL_CHECK(glGetShaderiv(object, GL_INFO_LOG_LENGTH, &maxLength)); // get the length of the error
-                GLchar error[maxLength];  //The maxLength includes the NULL character
-                
-                GL_CHECK(glGetShaderInfoLog(object, maxLength, &maxLength, error)); // populate the error array with the error string
-                
-                printf("%s", error);
-                
-                GL_CHECK(glDeleteShader(object)); // Don't leak the shader.
-                
-                object.m_isCompiled = false;
-                
-                return;
-                
+            for(auto const & candidate : candidates) {
+                auto text = readFile(candidate);
+                if(text) {
+                    if(resolvedPath) { *resolvedPath = candidate; }
+                    return text;
+                }
             }
-            object.m_isCompiled = true;
+            return nullptr;
         }
         
-        void attachShaderObjectToProgram(ShaderProgram & program, ShaderObject const & object) const {
-            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
-            assert(object  != OPENGL_INVALID_OBJECT && "shader object is in an invalid state");
-            assert(object.m_isCompiled && "shader object is not compiled");
+        PreprocessedShader run(std::string const & name, std::shared_ptr<const std::string> const & root, ShaderDefines const & defines) {
+            PreprocessedShader result;
             
-            auto find = std::find(program.m_shaderObjects.begin(), program.m_shaderObjects.end(),object);
+            Context context;
+            context.result          = &result;
+            context.endsWithNewline = true;
             
-            if(find == program.m_shaderObjects.end()) {
-                GL_CHECK(glAttachShader(program, object));
-                program.m_shaderObjects.push_back(object);
-            } else {
-                // object is allready attatched
+            std::string definesText = defines.toString();
+            result.m_valid = expand(context, name, root, &definesText);
+            
+            if(result.m_valid) {
+                for(auto const & segment : result.m_segments) {
+                    result.m_hash = fnv1aBytes(segment.data, segment.length, result.m_hash);
+                }
             }
+            return result;
         }
         
-        void detachShaderObjectFromProgram(ShaderProgram & program, ShaderObject const & object) const {
-            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
-            assert(object  != OPENGL_INVALID_OBJECT && "shader object is in an invalid state");
-            
-            auto find = std::find(program.m_shaderObjects.begin(), program.m_shaderObjects.end(),object);
-            
-            if(find != program.m_shaderObjects.end()) {
-                GL_CHECK(glDetachShader(program,object));
-                program.m_shaderObjects.erase(find);
-            } else {
-                // program doesnt contain shader object
+        void emit(Context & context, const char * data, size_t length) {
+            if(length == 0) {
+                return;
             }
+            context.result->m_segments.push_back({data, length});
+            context.endsWithNewline = data[length - 1] == '\n';
         }
         
-        void detachAllShaderObjectsFromProgram(ShaderProgram & program) const {
-            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
-            
-            for(auto i = program.m_shaderObjects.begin(); i < program.m_shaderObjects.end(); i++) {
-                GL_CHECK(glDetachShader(program,i->m_id));
-                program.m_shaderObjects.erase(i);
+        void emitGenerated(Context & context, std::string text) {
+            if(!context.endsWithNewline) {
+                text.insert(text.begin(), '\n');
             }
+            context.result->m_generated.push_back(std::move(text));
+            std::string const & stored = context.result->m_generated.back();
+            emit(context, stored.data(), stored.size());
         }
         
-        void detachAndDeleteShaderObjectFromProgram(ShaderProgram & program, ShaderObject const & object) const {
-            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
-            assert(object  != OPENGL_INVALID_OBJECT && "shader object is in an invalid state");
-            //TODO: maybe some weird things happening if trying to detach something that isnt attached
+        void emitLine(Context & context, size_t line, size_t fileIndex) {
+            emitGenerated(context, "#line " + std::to_string(line) + ' ' + std::to_string(fileIndex) + '\n');
+        }
+        
+        // returns the directive name of a line like "  #  include ..." and where its arguments start
+        static bool parseDirective(const char * line, const char * end, std::string & directive, const char * & arguments) {
+            while(line < end && (*line == ' ' || *line == '\t')) { line++; }
+            if(line == end || *line != '#') {
+                return false;
+            }
+            line++;
+            while(line < end && (*line == ' ' || *line == '\t')) { line++; }
             
-            auto find = std::find(program.m_shaderObjects.begin(), program.m_shaderObjects.end(),object);
+            const char * nameStart = line;
+            while(line < end && ((*line >= 'a' && *line <= 'z') || *line == '_')) { line++; }
             
-            if(find != program.m_shaderObjects.end()) {
-                GL_CHECK(glDetachShader(program,object));
-                GL_CHECK(glDeleteShader(object));
-                program.m_shaderObjects.erase(find);
-            } else {
-                // program doesnt contain the specified shader object
-            }
+            directive.assign(nameStart, line);
+            arguments = line;
+            return !directive.empty();
         }
         
-        void detachAndDeleteAllShaderObjectsFromProgram(ShaderProgram & program) const {
-            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
+        // definesText is only passed for the root file - it goes after #version
+        bool expand(Context & context, std::string const & path, std::shared_ptr<const std::string> const & text, std::string const * definesText) {
+            PreprocessedShader & result = *context.result;
             
-            for(auto i = program.m_shaderObjects.begin(); i < program.m_shaderObjects.end(); i++) {
-                GL_CHECK(glDetachShader(program,i->m_id));
-                GL_CHECK(glDeleteShader(i->m_id));
-                program.m_shaderObjects.erase(i);
+            if(context.includeStack.size() >= MAX_INCLUDE_DEPTH) {
+                result.m_error = "include depth exceeded - is there an include cycle? at " + path;
+                return false;
             }
-        }
-        
-        void linkProgram(ShaderProgram & program, bool deleteShaderObjects = true) {
-            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
             
-            // check to see if program contains any objects
-            // if contains object check to see if they are valid
-            // if valid link program
+            if(std::find(context.pragmaOnce.begin(), context.pragmaOnce.end(), path) != context.pragmaOnce.end()) {
+                return true;
+            }
             
-            if(!program.m_shaderObjects.empty())
-            {
-                printf("program contains shader objects\n");
-                // check if the the shader program contains any valid objects - if it does link
-                bool isLinkable = true;
+            const size_t fileIndex = result.m_files.size();
+            result.m_files.push_back(path);
+            result.m_sources.push_back(text);
+            context.includeStack.push_back(path);
+            
+            if(definesText == nullptr) {
+                emitLine(context, 1, fileIndex);
+            }
+            
+            const char * data      = text->data();
+            const char * end       = data + text->size();
+            const char * pending   = data; // start of text not emitted yet
+            const char * line      = data;
+            size_t       lineNumber = 1;
+            bool         definesDone = definesText == nullptr || definesText->empty();
+            
+            // no #version - defines go first
+            if(!definesDone && text->find("#version") == std::string::npos) {
+                emitGenerated(context, *definesText);
+                emitLine(context, 1, fileIndex);
+                definesDone = true;
+            }
+            
+            while(line < end) {
+                const char * lineEnd = static_cast<const char *>(std::memchr(line, '\n', static_cast<size_t>(end - line)));
+                const char * next    = lineEnd ? lineEnd + 1 : end;
+                if(!lineEnd) { lineEnd = end; }
                 
-                for(ShaderObject & so : program.m_shaderObjects) {
-                    if(so == OPENGL_INVALID_OBJECT) {
-                        isLinkable = false;
-                    }
-                }
+                std::string directive;
+                const char * arguments;
                 
-                if(isLinkable) {
-                    printf("program doesnt contain any invalid shader objects\n");
-                    GL_CHECK(glLinkProgram(program));
-                    
-                    GLint isLinked = GL_FALSE;
-                    
-                    GL_CHECK(glGetProgramiv(program,GL_LINK_STATUS,&isLinked));
-                    
-                    if(isLinked == GL_FALSE) {
-                        printf("program link failed");
+                if(parseDirective(line, lineEnd, directive, arguments)) {
+                    if(directive == "version" && !definesDone) {
+                        emit(context, pending, static_cast<size_t>(next - pending));
+                        pending = next;
+                        emitGenerated(context, *definesText);
+                        emitLine(context, lineNumber + 1, fileIndex);
+                        definesDone = true;
+                    } else if(directive == "include") {
+                        const char * open  = std::find_if(arguments, lineEnd, [](char c) { return c == '"' || c == '<'; });
+                        const char * close = open == lineEnd ? lineEnd : std::find_if(open + 1, lineEnd, [](char c) { return c == '"' || c == '>'; });
                         
-                        GLint maxLength = 0;
-                        GL_CHECK(glGetProgramiv(program, GL_INFO_LOG_LENGTH, &maxLength));
-                        GLchar error[maxLength]; //The maxLength includes the NULL character
-                        
-                        GL_CHECK(glGetProgramInfoLog(program, maxLength, &maxLength, error));
-                        
-                        std::cout << error << std::endl;;
-                        
-                        deleteShaderProgram(program);
+                        if(close == lineEnd) {
+                            result.m_error = path + ':' + std::to_string(lineNumber) + ": malformed #include";
+                            return false;
+                        }
                         
+                        std::string includeName(open + 1, close);
+                        std::string includePath;
+                        auto included = load(includeName, directoryOf(path), &includePath);
                         
+                        if(!included) {
+                            result.m_error = path + ':' + std::to_string(lineNumber) + ": could not find include " + includeName;
+                            return false;
+                        }
                         
-                        //Provide the infolog in whatever manner you deem best.
-                        //Exit with failure. TODO: exit with failure or error code?
-                        return;
-                    } else { // if link succesfull
-                        printf("program link successfull\n");
+                        emit(context, pending, static_cast<size_t>(line - pending));
+                        pending = next;
                         
-                        if(deleteShaderObjects) {
-                            detachAndDeleteAllShaderObjectsFromProgram(program);
-                        } else {
-                            detachAllShaderObjectsFromProgram(program);
-                            //TODO: cache shader objects
+                        if(!expand(context, includePath, included, nullptr)) {
+                            return false;
                         }
+                        emitLine(context, lineNumber + 1, fileIndex);
+                    } else if(directive == "pragma" && std::string(arguments, lineEnd).find("once") != std::string::npos) {
+                        emit(context, pending, static_cast<size_t>(line - pending));
+                        pending = next;
+                        context.pragmaOnce.push_back(path);
+                        emitLine(context, lineNumber + 1, fileIndex);
                     }
-                } else {
-                    // shader program contains invalid shader objects: TODO: handle shader object destruction
                 }
-            } else {
-                printf("the program contains no shader objects\n");
+                
+                line = next;
+                lineNumber++;
+            }
+            
+            emit(context, pending, static_cast<size_t>(end - pending));
+            context.includeStack.pop_back();
+            return true;
+        }
+    };
+    
+    /* Shader File Watcher */
+    /*----------------------------------------------------------------------------------------------*/
+    /*
+     reports shader files that changed on disk.
+     - on linux the directories of the watched files are watched with inotify, nothing is touched until the
+       kernel reports a write or a rename into the directory (editors often save by renaming a temp file)
+     - everywhere else the modification time of every watched file is compared on each poll()
+     */
+    class ShaderFileWatcher {
+    public:
+        ShaderFileWatcher()
+#ifdef __linux__
+        : m_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+#endif
+        {
+#ifdef __linux__
+            if(m_fd < 0) {
+                printf("shader file watcher: inotify_init1 failed - hot reload disabled\n");
             }
+#endif
         }
         
-        void deleteShaderProgram(ShaderProgram & program) const {
-            assert(program != OPENGL_INVALID_OBJECT && "shader program being deleted is invalid");
-            detachAllShaderObjectsFromProgram(program);
-            GL_CHECK(glDeleteProgram(program));
-            program.m_id = OPENGL_INVALID_OBJECT;
+        ~ShaderFileWatcher() {
+#ifdef __linux__
+            if(m_fd >= 0) {
+                ::close(m_fd);
+            }
+#endif
         }
         
-        void deleteShaderObject(ShaderObject & object) const {
-            assert(object != OPENGL_INVALID_OBJECT && "shader object being deleted is invalid");
-            GL_CHECK(glDeleteShader(object));
-            object.m_id = OPENGL_INVALID_OBJECT;
+        ShaderFileWatcher(ShaderFileWatcher const &) = delete;
+        ShaderFileWatcher & operator=(ShaderFileWatcher const &) = delete;
+        
+        // returns false for files that are not on disk (virtual files) - they are never reported
+        bool watchFile(std::string const & path) {
+            if(m_files.count(path) > 0) {
+                return true;
+            }
+            
+            time_t modified;
+            if(!modificationTime(path, modified)) {
+                return false;
+            }
+
+#ifdef __linux__
+            if(m_fd < 0) {
+                return false;
+            }
+            
+            size_t slash = path.find_last_of('/');
+            std::string directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+            
+            if(m_directoryWatches.count(directory) == 0) {
+                const uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+                int watch = inotify_add_watch(m_fd, directory.empty() ? "." : directory.c_str(), mask);
+                if(watch < 0) {
+                    return false;
+                }
+                m_directoryWatches[directory] = watch;
+                m_watchedDirectories[watch]   = directory;
+            }
+#endif
+            m_files[path] = modified;
+            return true;
         }
         
+        // appends every watched file that changed since the last poll - never blocks
+        void poll(std::vector<std::string> & changed) {
+#ifdef __linux__
+            if(m_fd < 0) {
+                return;
+            }
+            
+            alignas(struct inotify_event) char buffer[4096];
+            
+            for(;;) {
+                ssize_t length = ::read(m_fd, buffer, sizeof(buffer));
+                if(length <= 0) {
+                    break;
+                }
+                
+                for(char * cursor = buffer; cursor < buffer + length; ) {
+                    struct inotify_event const * event = reinterpret_cast<struct inotify_event const *>(cursor);
+                    cursor += sizeof(struct inotify_event) + event->len;
+                    
+                    auto directory = m_watchedDirectories.find(event->wd);
+                    if(event->len == 0 || directory == m_watchedDirectories.end()) {
+                        continue;
+                    }
+                    
+                    std::string path = directory->second + event->name;
+                    if(m_files.count(path) > 0 && std::find(changed.begin(), changed.end(), path) == changed.end()) {
+                        changed.push_back(path);
+                    }
+                }
+            }
+#else
+            for(auto & file : m_files) {
+                time_t modified;
+                if(modificationTime(file.first, modified) && modified != file.second) {
+                    file.second = modified;
+                    changed.push_back(file.first);
+                }
+            }
+#endif
+        }
+    
     private:
-        bool m_initialised;
+        std::unordered_map<std::string, time_t> m_files; // watched file -> modification time when last seen
+
+#ifdef __linux__
+        int                                  m_fd;
+        std::unordered_map<std::string, int> m_directoryWatches;
+        std::unordered_map<int, std::string> m_watchedDirectories;
+#endif
+        
+        static bool modificationTime(std::string const & path, time_t & modified) {
+            struct stat info;
+            if(stat(path.c_str(), &info) != 0) {
+                return false;
+            }
+            modified = info.st_mtime;
+            return true;
+        }
+    };
+    
+    /* Asynchronous Program Builds */
+    /*----------------------------------------------------------------------------------------------*/
+    // index into the shader layer's program table - stays valid for the lifetime of the layer
+    typedef uint32_t ProgramHandle;
+    constexpr ProgramHandle INVALID_PROGRAM_HANDLE = 0xFFFFFFFF;
+    
+    enum class ProgramBuildState {
+        COMPILING,
+        LINKING,
+        READY,
+        FAILED
+    };
+    
+    /* Program Binary Cache */
+    /*----------------------------------------------------------------------------------------------*/
+    struct ShaderSource {
+        ShaderObjectType type;
+        std::string      source;
+    };
+    
+    // a stage loaded through the ShaderPreprocessor - path is resolved like an #include
+    struct ShaderStage {
+        ShaderObjectType type;
+        std::string      path;
+    };
+    
+    /*
+     on disk store of linked program binaries keyed by a hash of the sources, defines and driver.
+     - the file is memory mapped and binaries are handed to glProgramBinary straight from the mapping
+     - new binaries are kept in memory until save() rewrites the file
+     - every entry carries a checksum, a truncated or corrupt file only loses the broken entries
+     
+     file layout
+     - FileHeader
+     - FileEntry * entryCount
+     - binary blobs
+     */
+    class ProgramBinaryCache {
+    public:
+        ProgramBinaryCache()
+        : m_mapped(nullptr)
+        , m_mappedSize(0)
+        , m_dirty(false)
+        {
+        }
+        
+        ~ProgramBinaryCache() {
+            close();
+        }
         
-        void checkOpenGLError(const char * stmt, const char * fname, int line) const {
-            // TODO: add assert functionality
-            GLenum err;
+        ProgramBinaryCache(ProgramBinaryCache const &) = delete;
+        ProgramBinaryCache & operator=(ProgramBinaryCache const &) = delete;
+        
+        // a missing file is not an error - the cache just starts empty
+        bool open(std::string const & path) {
+            close();
+            m_path = path;
+            
+            if(!mapFile()) {
+                return true;
+            }
+            
+            if(m_mappedSize < sizeof(FileHeader)) {
+                unmapFile();
+                return false;
+            }
+            
+            FileHeader header;
+            std::memcpy(&header, m_mapped, sizeof(header));
+            
+            if(header.magic != MAGIC || header.version != VERSION) {
+                printf("program binary cache: %s has an unknown format and is ignored\n", path.c_str());
+                unmapFile();
+                m_dirty = true;
+                return false;
+            }
+            
+            // checked by division first so a corrupt entry count can not wrap the table size
+            if(header.entryCount > (m_mappedSize - sizeof(FileHeader)) / sizeof(FileEntry)) {
+                unmapFile();
+                m_dirty = true;
+                return false;
+            }
+            
+            size_t tableEnd = sizeof(FileHeader) + size_t(header.entryCount) * sizeof(FileEntry);
             
-            while((err = glGetError()) != GL_NO_ERROR) {
-                std::string errorType;
+            for(uint32_t i = 0; i < header.entryCount; i++) {
+                FileEntry entry;
+                std::memcpy(&entry, m_mapped + sizeof(FileHeader) + i * sizeof(FileEntry), sizeof(entry));
                 
-                switch(err) {
-                    case GL_INVALID_OPERATION:             errorType = "INVALID_OPERATION";             break;
-                    case GL_INVALID_ENUM:                  errorType = "INVALID_ENUM";                  break;
-                    case GL_INVALID_VALUE:                 errorType = "INVALID_VALUE";                 break;
-                    case GL_OUT_OF_MEMORY:                 errorType = "OUT_OF_MEMORY";                 break;
-                    case GL_INVALID_FRAMEBUFFER_OPERATION: errorType = "INVALID_FRAMEBUFFER_OPERATION"; break;
-                    default:                               errorType = "UKNOWN ERROR - FUCK SAKE";      break;
+                // offset + length can wrap on a corrupt file - compare the length against what is left instead
+                bool inBounds = entry.offset >= tableEnd && entry.offset <= m_mappedSize && entry.length <= m_mappedSize - entry.offset;
+                if(!inBounds || fnv1aBytes(m_mapped + entry.offset, entry.length) != entry.checksum) {
+                    m_dirty = true;
+                    continue;
                 }
                 
-                std::cerr << "-----------------------------------------------------------------------------\nOPENGL ERROR: "<< errorType
-                << "\nFilename: " << fname
-                << "\nline: " << line
-                << "\nerror on: " << stmt
-                << "\n-----------------------------------------------------------------------------"
-                << std::endl;
+                Entry cached;
+                cached.key    = entry.key;
+                cached.format = entry.format;
+                cached.data   = m_mapped + entry.offset;
+                cached.length = entry.length;
+                m_entries.push_back(cached);
+            }
+            
+            sortEntries();
+            return true;
+        }
+        
+        void close() {
+            if(m_dirty && !m_path.empty()) {
+                save();
+            }
+            m_entries.clear();
+            m_pending.clear();
+            unmapFile();
+            m_dirty = false;
+        }
+        
+        bool find(uint64_t key, GLenum & format, void const * & data, GLsizei & length) const {
+            auto search = std::lower_bound(m_entries.begin(), m_entries.end(), key, [](Entry const & entry, uint64_t k) {
+                return entry.key < k;
+            });
+            
+            if(search == m_entries.end() || search->key != key) {
+                return false;
+            }
+            
+            format = search->format;
+            data   = search->data;
+            length = static_cast<GLsizei>(search->length);
+            return true;
+        }
+        
+        void store(uint64_t key, GLenum format, void const * data, GLsizei length) {
+            invalidate(key);
+            
+            m_pending.emplace_back(static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + length);
+            
+            Entry entry;
+            entry.key    = key;
+            entry.format = format;
+            entry.data   = m_pending.back().data();
+            entry.length = static_cast<uint32_t>(length);
+            m_entries.push_back(entry);
+            
+            sortEntries();
+            m_dirty = true;
+        }
+        
+        // drops an entry the driver rejected - it is left out of the file on the next save
+        void invalidate(uint64_t key) {
+            auto search = std::find_if(m_entries.begin(), m_entries.end(), [key](Entry const & entry) {
+                return entry.key == key;
+            });
+            
+            if(search != m_entries.end()) {
+                m_entries.erase(search);
+                m_dirty = true;
+            }
+        }
+        
+        // writes to a temporary file and renames it over the old one so a crash never leaves a half written cache
+        bool save() {
+            if(m_path.empty()) {
+                return false;
+            }
+            
+            std::string temporaryPath = m_path + ".tmp";
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if(!file) {
+                return false;
             }
+            
+            FileHeader header;
+            header.magic      = MAGIC;
+            header.version    = VERSION;
+            header.entryCount = static_cast<uint32_t>(m_entries.size());
+            header.reserved   = 0;
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            
+            uint64_t offset = sizeof(FileHeader) + m_entries.size() * sizeof(FileEntry);
+            for(auto const & entry : m_entries) {
+                FileEntry fileEntry;
+                fileEntry.key      = entry.key;
+                fileEntry.offset   = offset;
+                fileEntry.length   = entry.length;
+                fileEntry.format   = entry.format;
+                fileEntry.checksum = fnv1aBytes(entry.data, entry.length);
+                file.write(reinterpret_cast<const char *>(&fileEntry), sizeof(fileEntry));
+                offset += entry.length;
+            }
+            
+            for(auto const & entry : m_entries) {
+                file.write(reinterpret_cast<const char *>(entry.data), entry.length);
+            }
+            
+            file.close();
+            if(!file) {
+                std::remove(temporaryPath.c_str());
+                return false;
+            }
+            
+            // the entries point into the mapping and pending blobs - reload so they point into the new file
+            m_entries.clear();
+            m_pending.clear();
+            unmapFile();
+
+#ifdef _WIN32
+            std::remove(m_path.c_str());
+#endif
+            bool renamed = std::rename(temporaryPath.c_str(), m_path.c_str()) == 0;
+            
+            m_dirty = false;
+            std::string path = m_path;
+            open(path);
+            
+            return renamed;
+        }
+        
+        size_t getEntryCount() const {
+            return m_entries.size();
+        }
+    
+    private:
+        static constexpr uint32_t MAGIC   = 0x43504C47; // "GLPC"
+        static constexpr uint32_t VERSION = 1;
+        
+        struct FileHeader {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t entryCount;
+            uint32_t reserved;
+        };
+        
+        struct FileEntry {
+            uint64_t key;
+            uint64_t offset;
+            uint64_t checksum;
+            uint32_t length;
+            uint32_t format;
+        };
+        
+        struct Entry {
+            uint64_t        key;
+            GLenum          format;
+            const uint8_t * data;
+            uint32_t        length;
+        };
+        
+        std::string                        m_path;
+        const uint8_t *                    m_mapped;
+        size_t                             m_mappedSize;
+        std::vector<Entry>                 m_entries; // sorted by key
+        std::vector<std::vector<uint8_t>>  m_pending;
+        std::vector<uint8_t>               m_fileCopy; // used instead of a mapping on windows
+        bool                               m_dirty;
+        
+        void sortEntries() {
+            std::sort(m_entries.begin(), m_entries.end(), [](Entry const & a, Entry const & b) {
+                return a.key < b.key;
+            });
+        }
+        
+        bool mapFile() {
+#ifndef _WIN32
+            int fd = ::open(m_path.c_str(), O_RDONLY);
+            if(fd < 0) {
+                return false;
+            }
+            
+            struct stat info;
+            if(fstat(fd, &info) != 0 || info.st_size == 0) {
+                ::close(fd);
+                return false;
+            }
+            
+            void * mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            
+            if(mapping == MAP_FAILED) {
+                return false;
+            }
+            
+            m_mapped     = static_cast<const uint8_t *>(mapping);
+            m_mappedSize = static_cast<size_t>(info.st_size);
+            return true;
+#else
+            std::ifstream file(m_path, std::ios::binary);
+            if(!file) {
+                return false;
+            }
+            m_fileCopy.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            m_mapped     = m_fileCopy.data();
+            m_mappedSize = m_fileCopy.size();
+            return m_mappedSize > 0;
+#endif
+        }
+        
+        void unmapFile() {
+#ifndef _WIN32
+            if(m_mapped != nullptr) {
+                munmap(const_cast<uint8_t *>(m_mapped), m_mappedSize);
+            }
+#else
+            m_fileCopy.clear();
+#endif
+            m_mapped     = nullptr;
+            m_mappedSize = 0;
+        }
+    };
+    
+    class OpenglShaderLayer
+    {
+    public:
+        
+        OpenglShaderLayer()
+        :
+        m_initialised(false),
+        m_binaryCache(nullptr),
+        m_driverHash(0),
+        m_parallelCompile(false),
+        m_programUniforms(false),
+        m_reloadDebounce(200),
+        m_reloadCount(0),
+        m_shaderObjectStats()
+        {}
+        
+        ~OpenglShaderLayer() {
+            dispose();
+        }
+        
+        bool init() {
+            if(m_initialised) {
+                assert(false && "double init you noob");
+                return false;
+            }
+#if OPENGL_PROGRAM_UNIFORM
+            m_programUniforms = contextSupports(4, 1, "GL_ARB_separate_shader_objects");
+#endif
+            m_initialised = true;
+            return m_initialised;
+        }
+        
+        void dispose() {
+            if(!m_initialised) {
+                return;
+            }
+            
+            for(auto & build : m_programBuilds) {
+                releaseBuildObjects(build);
+                if(build.program != OPENGL_INVALID_OBJECT) {
+                    GL_CHECK(glDeleteProgram(build.program));
+                    build.program.m_id = OPENGL_INVALID_OBJECT;
+                }
+            }
+            disableHotReload();
+            deleteRetiredPrograms();
+            
+            m_programBuilds.clear();
+            m_variantHandles.clear();
+            
+            for(auto & stages : m_programStages) {
+                for(auto const & object : stages.second) {
+                    releaseShaderObject(object);
+                }
+            }
+            m_programStages.clear();
+            
+            // objects acquired by the application and never released
+            for(auto const & cached : m_shaderObjects) {
+                GL_CHECK(glDeleteShader(cached.second.object));
+            }
+            m_shaderObjects.clear();
+            m_shaderObjectKeys.clear();
+            m_shaderObjectStats.liveObjects = 0;
+            
+            m_initialised = false;
+        }
+        
+        /*
+         *Order of shader Program creation*
+         - create a shader progarm
+         - create a shader object
+         - compile shader object
+         - attach objects to program
+         - bind attrib locations ? optional
+         - link program
+         */
+        
+        ShaderProgram createShaderProgram() const {
+            ShaderProgram shaderProgram;
+            
+            GL_CHECK(shaderProgram.m_id = glCreateProgram());
+            labelObject(DebugObject::PROGRAM, shaderProgram.m_id, "program");
+            
+            // TODO: add program to program list - used for deleting at dispose time.
+            return shaderProgram;
+        }
+        
+        ShaderObject createShaderObject(ShaderObjectType const & type) const {
+            ShaderObject shaderObject;
+            
+            GL_CHECK(shaderObject.m_id = glCreateShader(static_cast<GLenum>(type))); // conversion used to restrist values passed to glCreateShader
+            
+            return shaderObject;
+        }
+        
+        void attachSourceToShaderObject(ShaderObject & object, std::string const & source) const {
+            // calling this multiple times in consession will overide the privious attached source - concatinate all source before calling this function
+            assert(object != OPENGL_INVALID_OBJECT && "shader object is in invalid state - the shader object must be created with createShaderObject()");
+            assert(!(source.empty()) && "source is empty");
+            
+            const GLchar* shaderSourceStrings[1];
+            GLint shaderSourceStringLengths[1];
+            
+            shaderSourceStrings[0] = source.c_str();
+            shaderSourceStringLengths[0] = static_cast<GLint>(source.length());
+            
+            GL_CHECK(glShaderSource(object, 1, shaderSourceStrings, shaderSourceStringLengths));
+            
+            object.m_hasSource = true;
+        }
+        
+        // each segment is passed as its own string - the preprocessed text is never joined into one buffer
+        void attachSourceToShaderObject(ShaderObject & object, PreprocessedShader const & source) const {
+            assert(object != OPENGL_INVALID_OBJECT && "shader object is in invalid state - the shader object must be created with createShaderObject()");
+            assert(source.isValid() && "preprocessing failed - check getError()");
+            
+            auto const & segments = source.getSegments();
+            std::vector<const GLchar *> strings(segments.size());
+            std::vector<GLint>          lengths(segments.size());
+            
+            for(size_t i = 0; i < segments.size(); i++) {
+                strings[i] = segments[i].data;
+                lengths[i] = static_cast<GLint>(segments[i].length);
+            }
+            
+            GL_CHECK(glShaderSource(object, static_cast<GLsizei>(segments.size()), strings.data(), lengths.data()));
+            
+            object.m_hasSource = true;
+        }
+        
+        void compileShaderObject(ShaderObject & object) const {
+            assert(object != OPENGL_INVALID_OBJECT && "the shader object being compiled is in an invald state");
+            assert((!(object.m_isCompiled))        && "the shader object being compiled is allready compiled");
+            assert(object.m_hasSource              && "the shader object has no source code to compile");
+            //assert(shaderObject.type == ShaderObjectType::INVALID); TODO: check this out
+            
+            GL_CHECK(glCompileShader(object));
+            
+            if(!queryCompileStatus(object)) {
+                GL_CHECK(glDeleteShader(object)); // Don't leak the shader.
+            }
+        }
+        
+        // blocks until the driver has finished compiling the object - prints the log when it failed
+        bool queryCompileStatus(ShaderObject & object) const {
+            GLint isCompiled = GL_FALSE;
+            
+            GL_CHECK(glGetShaderiv(object,GL_COMPILE_STATUS, &isCompiled));
+            
+            if(isCompiled == GL_FALSE) {
+                GLint maxLength = 0;
+                GL_CHECK(glGetShaderiv(object, GL_INFO_LOG_LENGTH, &maxLength)); // get the length of the error
+                GLchar error[maxLength];  //The maxLength includes the NULL character
+                
+                GL_CHECK(glGetShaderInfoLog(object, maxLength, &maxLength, error)); // populate the error array with the error string
+                
+                printf("%s", error);
+                
+                object.m_isCompiled = false;
+                
+                return false;
+            
+            }
+            object.m_isCompiled = true;
+            return true;
+        }
+        
+        void attachShaderObjectToProgram(ShaderProgram & program, ShaderObject const & object) const {
+            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
+            assert(object  != OPENGL_INVALID_OBJECT && "shader object is in an invalid state");
+            assert(object.m_isCompiled && "shader object is not compiled");
+            
+            auto find = std::find(program.m_shaderObjects.begin(), program.m_shaderObjects.end(),object);
+            
+            if(find == program.m_shaderObjects.end()) {
+                GL_CHECK(glAttachShader(program, object));
+                program.m_shaderObjects.push_back(object);
+            } else {
+                // object is allready attatched
+            }
+        }
+        
+        void detachShaderObjectFromProgram(ShaderProgram & program, ShaderObject const & object) const {
+            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
+            assert(object  != OPENGL_INVALID_OBJECT && "shader object is in an invalid state");
+            
+            auto find = std::find(program.m_shaderObjects.begin(), program.m_shaderObjects.end(),object);
+            
+            if(find != program.m_shaderObjects.end()) {
+                GL_CHECK(glDetachShader(program,object));
+                program.m_shaderObjects.erase(find);
+            } else {
+                // program doesnt contain shader object
+            }
+        }
+        
+        void detachAllShaderObjectsFromProgram(ShaderProgram & program) const {
+            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
+            
+            for(auto const & object : program.m_shaderObjects) {
+                GL_CHECK(glDetachShader(program,object.m_id));
+            }
+            program.m_shaderObjects.clear();
+        }
+        
+        void detachAndDeleteShaderObjectFromProgram(ShaderProgram & program, ShaderObject const & object) const {
+            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
+            assert(object  != OPENGL_INVALID_OBJECT && "shader object is in an invalid state");
+            //TODO: maybe some weird things happening if trying to detach something that isnt attached
+            
+            auto find = std::find(program.m_shaderObjects.begin(), program.m_shaderObjects.end(),object);
+            
+            if(find != program.m_shaderObjects.end()) {
+                GL_CHECK(glDetachShader(program,object));
+                GL_CHECK(glDeleteShader(object));
+                program.m_shaderObjects.erase(find);
+            } else {
+                // program doesnt contain the specified shader object
+            }
+        }
+        
+        void detachAndDeleteAllShaderObjectsFromProgram(ShaderProgram & program) const {
+            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
+            
+            for(auto const & object : program.m_shaderObjects) {
+                GL_CHECK(glDetachShader(program,object.m_id));
+                GL_CHECK(glDeleteShader(object.m_id));
+            }
+            program.m_shaderObjects.clear();
+        }
+        
+        // called on every exit of linkProgram() so a failed link doesnt leak the compiled objects
+        void releaseLinkedShaderObjects(ShaderProgram & program, bool deleteShaderObjects) const {
+            if(deleteShaderObjects) {
+                detachAndDeleteAllShaderObjectsFromProgram(program);
+            } else {
+                detachAllShaderObjectsFromProgram(program); // objects from acquireShaderObject() are shared - see releaseShaderObject()
+            }
+        }
+        
+        void linkProgram(ShaderProgram & program, bool deleteShaderObjects = true) {
+            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
+            
+            // check to see if program contains any objects
+            // if contains object check to see if they are valid
+            // if valid link program
+            
+            if(!program.m_shaderObjects.empty())
+            {
+                printf("program contains shader objects\n");
+                // check if the the shader program contains any valid objects - if it does link
+                bool isLinkable = true;
+                
+                for(ShaderObject & so : program.m_shaderObjects) {
+                    if(so == OPENGL_INVALID_OBJECT) {
+                        isLinkable = false;
+                    }
+                }
+                
+                if(isLinkable) {
+                    printf("program doesnt contain any invalid shader objects\n");
+                    
+                    if(m_binaryCache != nullptr) {
+                        GL_CHECK(glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+                    }
+                    
+                    GL_CHECK(glLinkProgram(program));
+                    
+                    GLint isLinked = GL_FALSE;
+                    
+                    GL_CHECK(glGetProgramiv(program,GL_LINK_STATUS,&isLinked));
+                    
+                    if(isLinked == GL_FALSE) {
+                        printf("program link failed");
+                        
+                        GLint maxLength = 0;
+                        GL_CHECK(glGetProgramiv(program, GL_INFO_LOG_LENGTH, &maxLength));
+                        GLchar error[maxLength]; //The maxLength includes the NULL character
+                        
+                        GL_CHECK(glGetProgramInfoLog(program, maxLength, &maxLength, error));
+                        
+                        std::cout << error << std::endl;;
+                        
+                        releaseLinkedShaderObjects(program, deleteShaderObjects);
+                        deleteShaderProgram(program);
+                        
+                        
+                        
+                        //Provide the infolog in whatever manner you deem best.
+                        //Exit with failure. TODO: exit with failure or error code?
+                        return;
+                    } else { // if link succesfull
+                        printf("program link successfull\n");
+                        program.m_linked = true;
+                        reflectProgram(program);
+                        
+                        releaseLinkedShaderObjects(program, deleteShaderObjects);
+                    }
+                } else {
+                    // shader program contains invalid shader objects - nothing can be linked, let go of the valid ones
+                    program.m_shaderObjects.erase(std::remove(program.m_shaderObjects.begin(), program.m_shaderObjects.end(), ShaderObject()), program.m_shaderObjects.end());
+                    releaseLinkedShaderObjects(program, deleteShaderObjects);
+                }
+            } else {
+                printf("the program contains no shader objects\n");
+            }
+        }
+        
+        void deleteShaderProgram(ShaderProgram & program) {
+            assert(program != OPENGL_INVALID_OBJECT && "shader program being deleted is invalid");
+            detachAllShaderObjectsFromProgram(program);
+            
+            auto stages = m_programStages.find(program.m_id);
+            if(stages != m_programStages.end()) {
+                for(auto const & object : stages->second) {
+                    releaseShaderObject(object);
+                }
+                m_programStages.erase(stages);
+            }
+            
+            GL_CHECK(glDeleteProgram(program));
+            program.m_id = OPENGL_INVALID_OBJECT;
+            program.m_reflection.reset();
+        }
+        
+        void deleteShaderObject(ShaderObject & object) const {
+            assert(object != OPENGL_INVALID_OBJECT && "shader object being deleted is invalid");
+            GL_CHECK(glDeleteShader(object));
+            object.m_id = OPENGL_INVALID_OBJECT;
+        }
+        
+        /* program binary cache */
+        /*------------------------------------------------------------------------------------------*/
+        
+        /*
+         the driver strings go into every key so a driver update or a different gpu never gets handed a binary
+         it did not produce. pass nullptr to stop using the cache. the cache must outlive the layer.
+         */
+        void setProgramBinaryCache(ProgramBinaryCache * cache, OpenglInformationLayer const & info) {
+            m_binaryCache = nullptr;
+            
+            GLint formats = 0;
+            GL_CHECK(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats));
+            if(cache != nullptr && formats == 0) {
+                printf("program binary cache: the driver supports no binary formats - cache disabled\n");
+                return;
+            }
+            
+            m_binaryCache = cache;
+            m_driverHash  = fnv1a(info.getVendor());
+            m_driverHash  = fnv1a(info.getRenderer(), m_driverHash);
+            m_driverHash  = fnv1a(info.getVersionString(), m_driverHash);
+        }
+        
+        uint64_t makeProgramCacheKey(std::vector<ShaderSource> const & sources, std::string const & defines) const {
+            uint64_t key = fnv1a(defines, m_driverHash);
+            for(auto const & source : sources) {
+                GLenum type = static_cast<GLenum>(source.type);
+                key = fnv1aBytes(&type, sizeof(type), key);
+                key = fnv1a(source.source, key);
+            }
+            return key;
+        }
+        
+        // returns false when there is no entry or the driver rejected it - a rejected entry is removed from the cache
+        bool loadProgramBinary(ShaderProgram & program, uint64_t key) {
+            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
+            
+            GLenum        format;
+            void const *  data;
+            GLsizei       length;
+            
+            if(m_binaryCache == nullptr || !m_binaryCache->find(key, format, data, length)) {
+                return false;
+            }
+            
+            GL_CHECK(glProgramBinary(program, format, data, length));
+            
+            GLint isLinked = GL_FALSE;
+            GL_CHECK(glGetProgramiv(program, GL_LINK_STATUS, &isLinked));
+            
+            if(isLinked == GL_FALSE) {
+                m_binaryCache->invalidate(key);
+                return false;
+            }
+            
+            program.m_linked = true;
+            reflectProgram(program);
+            return true;
+        }
+        
+        void storeProgramBinary(ShaderProgram const & program, uint64_t key) {
+            if(m_binaryCache == nullptr) {
+                return;
+            }
+            
+            GLint length = 0;
+            GL_CHECK(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length));
+            if(length <= 0) {
+                return;
+            }
+            
+            std::vector<uint8_t> binary(static_cast<size_t>(length));
+            GLenum format = 0;
+            GL_CHECK(glGetProgramBinary(program, length, &length, &format, binary.data()));
+            
+            m_binaryCache->store(key, format, binary.data(), length);
+        }
+        
+        /*
+         master function for program creation - creates, compiles and links a program from its sources.
+         defines are "#define NAME VALUE" lines put straight after the #version line of every stage.
+         with a binary cache set the compile is skipped when the cache has a binary the driver accepts.
+         returns a program with an invalid id when compiling or linking failed.
+         */
+        ShaderProgram createShaderProgram(std::vector<ShaderSource> const & sources, std::string const & defines = "") {
+            ShaderProgram program = createShaderProgram();
+            
+            uint64_t key = makeProgramCacheKey(sources, defines);
+            if(loadProgramBinary(program, key)) {
+                return program;
+            }
+            
+            std::vector<ShaderObject> stages;
+            bool compiled = true;
+            
+            for(auto const & source : sources) {
+                stages.push_back(acquireShaderObject(source.type, injectDefines(source.source, defines)));
+                
+                if(!finishShaderObject(stages.back())) {
+                    compiled = false;
+                    break;
+                }
+                attachShaderObjectToProgram(program, stages.back());
+            }
+            
+            if(compiled) {
+                linkProgram(program, false);
+            }
+            
+            if(!program.m_linked) {
+                for(auto const & object : stages) {
+                    releaseShaderObject(object);
+                }
+                if(program != OPENGL_INVALID_OBJECT) {
+                    deleteShaderProgram(program);
+                }
+                return program;
+            }
+            
+            // the program holds on to its stages until deleteShaderProgram() so later programs can share them
+            m_programStages[program.m_id] = std::move(stages);
+            storeProgramBinary(program, key);
+            
+            return program;
+        }
+        
+        /* shader object cache */
+        /*------------------------------------------------------------------------------------------*/
+        
+        /*
+         compiled shader objects keyed by the hash of their stage type and final source. a hit hands back the
+         object that is already compiled (or compiling) and bumps its reference count - every acquire needs a
+         matching releaseShaderObject(), the object is deleted with the last reference. programs in the program
+         table and programs from createShaderProgram(sources) hold their stages until they are deleted.
+         the status is not queried on a miss, call finishShaderObject() before attaching.
+         */
+        ShaderObject acquireShaderObject(ShaderObjectType type, std::string const & source) {
+            uint64_t key = shaderObjectKey(type, fnv1a(source));
+            
+            ShaderObject cached;
+            if(findCachedShaderObject(key, cached)) {
+                return cached;
+            }
+            
+            ShaderObject object = createShaderObject(type);
+            attachSourceToShaderObject(object, source);
+            return insertCachedShaderObject(key, object);
+        }
+        
+        ShaderObject acquireShaderObject(ShaderObjectType type, PreprocessedShader const & source) {
+            uint64_t key = shaderObjectKey(type, source.getHash());
+            
+            ShaderObject cached;
+            if(findCachedShaderObject(key, cached)) {
+                return cached;
+            }
+            
+            ShaderObject object = createShaderObject(type);
+            attachSourceToShaderObject(object, source);
+            return insertCachedShaderObject(key, object);
+        }
+        
+        void releaseShaderObject(ShaderObject const & object) {
+            auto id = m_shaderObjectKeys.find(object.m_id);
+            if(id == m_shaderObjectKeys.end()) {
+                assert(false && "shader object was not acquired from the cache");
+                return;
+            }
+            
+            auto entry = m_shaderObjects.find(id->second);
+            assert(entry != m_shaderObjects.end() && entry->second.references > 0 && "shader object cache is out of sync");
+            
+            if(--entry->second.references == 0) {
+                GL_CHECK(glDeleteShader(entry->second.object));
+                m_shaderObjects.erase(entry);
+                m_shaderObjectKeys.erase(id);
+            }
+            m_shaderObjectStats.liveObjects = m_shaderObjects.size();
+        }
+        
+        // blocks until the object is compiled - the status is only read from the driver once per cached object
+        bool finishShaderObject(ShaderObject & object) {
+            auto id = m_shaderObjectKeys.find(object.m_id);
+            if(id == m_shaderObjectKeys.end()) {
+                return queryCompileStatus(object);
+            }
+            
+            CachedShaderObject & cached = m_shaderObjects[id->second];
+            if(cached.status == CompileStatus::UNKNOWN) {
+                cached.status = queryCompileStatus(cached.object) ? CompileStatus::COMPILED : CompileStatus::FAILED;
+            }
+            
+            object.m_isCompiled = cached.status == CompileStatus::COMPILED;
+            return object.m_isCompiled;
+        }
+        
+        ShaderObjectCacheStats const & getShaderObjectCacheStats() const {
+            return m_shaderObjectStats;
+        }
+        
+        /* uniforms */
+        /*------------------------------------------------------------------------------------------*/
+        // hashed lookups into the program's reflection - no string compares and no driver round trip
+        GLint getUniformLocation(ShaderProgram const & program, uint64_t nameHash) const {
+            assert(program.m_reflection && "program has not been linked");
+            return program.m_reflection->getUniformLocation(nameHash);
+        }
+        
+        // points a uniform block at a binding point - opengl 4.1 has no layout(binding = N) for blocks.
+        // e.g. bindUniformBlock(program, fnv1a("PerDraw"), GLSL_UNIFORM_PER_DRAW_BLOCK_BINDING)
+        bool bindUniformBlock(ShaderProgram const & program, uint64_t blockHash, GLuint binding) const {
+            assert(program.m_reflection && "program has not been linked");
+            
+            UniformBlockInfo const * block = program.m_reflection->findUniformBlock(blockHash);
+            if(block == nullptr) {
+                return false;
+            }
+            
+            GL_CHECK(glUniformBlockBinding(program, block->index, binding));
+            return true;
+        }
+        
+        /*
+         uploads go through glProgramUniform (opengl 4.1 or GL_ARB_separate_shader_objects) so the program does
+         not have to be bound. without it the program is bound for the upload and the previous one put back -
+         the draw layer's state cache never sees the switch but every upload costs a glGet
+         */
+        void setUniform(ShaderProgram const & program, uint64_t nameHash, GLfloat value) const {
+            GLint location = checkedUniformLocation(program, nameHash, GL_FLOAT);
+            if(location >= 0) {
+#if OPENGL_PROGRAM_UNIFORM
+                if(m_programUniforms) {
+                    GL_CHECK(glProgramUniform1f(program, location, value));
+                    return;
+                }
+#endif
+                UniformUploadScope scope(program);
+                GL_CHECK(glUniform1f(location, value));
+            }
+        }
+        
+        void setUniform(ShaderProgram const & program, uint64_t nameHash, GLint value) const {
+            GLint location = checkedUniformLocation(program, nameHash, GL_INT);
+            if(location >= 0) {
+#if OPENGL_PROGRAM_UNIFORM
+                if(m_programUniforms) {
+                    GL_CHECK(glProgramUniform1i(program, location, value));
+                    return;
+                }
+#endif
+                UniformUploadScope scope(program);
+                GL_CHECK(glUniform1i(location, value));
+            }
+        }
+        
+        void setUniformVec4(ShaderProgram const & program, uint64_t nameHash, GLfloat const * values, GLsizei count = 1) const {
+            GLint location = checkedUniformLocation(program, nameHash, GL_FLOAT_VEC4);
+            if(location >= 0) {
+#if OPENGL_PROGRAM_UNIFORM
+                if(m_programUniforms) {
+                    GL_CHECK(glProgramUniform4fv(program, location, count, values));
+                    return;
+                }
+#endif
+                UniformUploadScope scope(program);
+                GL_CHECK(glUniform4fv(location, count, values));
+            }
+        }
+        
+        void setUniformMat4(ShaderProgram const & program, uint64_t nameHash, GLfloat const * values, GLsizei count = 1, bool transpose = false) const {
+            GLint location = checkedUniformLocation(program, nameHash, GL_FLOAT_MAT4);
+            if(location >= 0) {
+#if OPENGL_PROGRAM_UNIFORM
+                if(m_programUniforms) {
+                    GL_CHECK(glProgramUniformMatrix4fv(program, location, count, transpose ? GL_TRUE : GL_FALSE, values));
+                    return;
+                }
+#endif
+                UniformUploadScope scope(program);
+                GL_CHECK(glUniformMatrix4fv(location, count, transpose ? GL_TRUE : GL_FALSE, values));
+            }
+        }
+        
+        bool hasProgramUniforms() const {
+            return m_programUniforms;
+        }
+        
+        /* asynchronous program builds */
+        /*------------------------------------------------------------------------------------------*/
+        
+        /*
+         lets the driver compile on its own threads (KHR/ARB_parallel_shader_compile). without the extension
+         the builds still work, pollShaderPrograms() just spreads the blocking compiles across frames.
+         threads = 0xFFFFFFFF lets the driver pick the thread count.
+         */
+        bool enableParallelShaderCompile(OpenglInformationLayer const & info, GLuint threads = 0xFFFFFFFF) {
+            m_parallelCompile = false;
+
+#if defined(GL_KHR_parallel_shader_compile)
+            if(info.hasExtension("GL_KHR_parallel_shader_compile")) {
+                GL_CHECK(glMaxShaderCompilerThreadsKHR(threads));
+                m_parallelCompile = true;
+            }
+#endif
+#if defined(GL_ARB_parallel_shader_compile)
+            if(!m_parallelCompile && info.hasExtension("GL_ARB_parallel_shader_compile")) {
+                GL_CHECK(glMaxShaderCompilerThreadsARB(threads));
+                m_parallelCompile = true;
+            }
+#endif
+            return m_parallelCompile;
+        }
+        
+        bool isParallelShaderCompileEnabled() const {
+            return m_parallelCompile;
+        }
+        
+        /*
+         starts building a program and returns straight away - the status is never queried here so the driver
+         is free to compile in the background. submit everything a level needs in one go and then call
+         pollShaderPrograms() once a frame. a binary cache hit is ready immediately.
+         */
+        ProgramHandle submitShaderProgram(std::vector<ShaderSource> const & sources, std::string const & defines = "") {
+            ProgramBuild build = beginBuild(makeProgramCacheKey(sources, defines));
+            
+            if(build.state == ProgramBuildState::COMPILING) {
+                for(auto const & source : sources) {
+                    build.objects.push_back(acquireShaderObject(source.type, injectDefines(source.source, defines)));
+                }
+            }
+            
+            m_programBuilds.push_back(std::move(build));
+            return static_cast<ProgramHandle>(m_programBuilds.size() - 1);
+        }
+        
+        /*
+         builds a permutation of program files run through the preprocessor. variants are deduplicated by the
+         hash of their preprocessed stages - asking for a variant that was already submitted returns the same
+         handle, so every unique variant is compiled exactly once however many materials ask for it.
+         */
+        ProgramHandle submitShaderProgram(ShaderPreprocessor & preprocessor, std::vector<ShaderStage> const & stages, ShaderDefines const & defines = ShaderDefines()) {
+            std::unique_ptr<ProgramRecipe> recipe(new ProgramRecipe());
+            recipe->preprocessor = &preprocessor;
+            recipe->stages       = stages;
+            recipe->defines      = defines;
+            
+            std::vector<PreprocessedShader> preprocessed;
+            bool valid = preprocessRecipe(*recipe, preprocessed);
+            
+            if(valid) {
+                auto existing = m_variantHandles.find(recipe->variantHash);
+                if(existing != m_variantHandles.end()) {
+                    return existing->second;
+                }
+            }
+            
+            ProgramBuild build = beginBuild(fnv1aBytes(&recipe->variantHash, sizeof(recipe->variantHash), m_driverHash));
+            labelProgram(build.program, *recipe);
+            
+            if(!valid) {
+                failBuild(build);
+            } else if(build.state == ProgramBuildState::COMPILING) {
+                compileStages(build, stages, preprocessed);
+            }
+            
+            ProgramHandle handle = static_cast<ProgramHandle>(m_programBuilds.size());
+            
+            if(valid) {
+                m_variantHandles[recipe->variantHash] = handle;
+            }
+            if(m_fileWatcher) {
+                watchRecipeFiles(*recipe);
+            }
+            
+            build.recipe = std::move(recipe);
+            m_programBuilds.push_back(std::move(build));
+            return handle;
+        }
+        
+        // number of unique program variants submitted through the preprocessor
+        size_t getProgramVariantCount() const {
+            return m_variantHandles.size();
+        }
+        
+        /*
+         moves builds on to their next stage. with parallel compile only finished work is touched and this never
+         stalls. without it every step blocks, so at most maxBlockingSteps compiles or links are done per call.
+         returns the number of builds still in flight.
+         */
+        size_t pollShaderPrograms(size_t maxBlockingSteps = 1) {
+            size_t pending = 0;
+            size_t blockingSteps = 0;
+            
+            // the frame that could still draw with them has been submitted
+            deleteRetiredPrograms();
+            
+            for(auto & build : m_programBuilds) {
+                if(build.state == ProgramBuildState::READY || build.state == ProgramBuildState::FAILED) {
+                    continue;
+                }
+                
+                bool canBlock = blockingSteps < maxBlockingSteps;
+                if(advanceBuild(build, canBlock) && !m_parallelCompile) {
+                    blockingSteps++;
+                }
+                
+                if(build.state == ProgramBuildState::COMPILING || build.state == ProgramBuildState::LINKING) {
+                    pending++;
+                }
+            }
+            
+            if(m_fileWatcher) {
+                pollHotReload();
+                
+                for(auto & reload : m_reloads) {
+                    bool canBlock = blockingSteps < maxBlockingSteps;
+                    if(advanceBuild(reload.build, canBlock) && !m_parallelCompile) {
+                        blockingSteps++;
+                    }
+                }
+                finishReloads();
+                pending += m_reloads.size();
+            }
+            return pending;
+        }
+        
+        /* hot reload */
+        /*------------------------------------------------------------------------------------------*/
+        
+        /*
+         watches the files of every program submitted through the preprocessor. pollShaderPrograms() picks up the
+         changes, waits until no file has changed for debounceMilliseconds so saving ten files is one rebuild, and
+         rebuilds each affected program once in the background. the handle switches to the new program only after
+         it links - a broken edit keeps the old program running. the replaced program lives until the next poll so
+         commands already recorded with it still draw.
+         */
+        void enableHotReload(unsigned debounceMilliseconds = 200) {
+            m_reloadDebounce = std::chrono::milliseconds(debounceMilliseconds);
+            
+            if(m_fileWatcher) {
+                return;
+            }
+            
+            m_fileWatcher.reset(new ShaderFileWatcher());
+            for(auto const & build : m_programBuilds) {
+                if(build.recipe) {
+                    watchRecipeFiles(*build.recipe);
+                }
+            }
+        }
+        
+        void disableHotReload() {
+            for(auto & reload : m_reloads) {
+                failBuild(reload.build);
+            }
+            m_reloads.clear();
+            m_changedFiles.clear();
+            m_fileWatcher.reset();
+        }
+        
+        bool isHotReloadEnabled() const {
+            return m_fileWatcher != nullptr;
+        }
+        
+        // number of programs swapped to a reloaded version since hot reload was enabled
+        size_t getReloadCount() const {
+            return m_reloadCount;
+        }
+        
+        // blocks until every submitted program is ready or failed - for loading screens
+        void finishShaderPrograms() {
+            while(pollShaderPrograms(m_programBuilds.size() * 2) > 0) {
+            }
+        }
+        
+        ProgramBuildState getProgramBuildState(ProgramHandle handle) const {
+            assert(handle < m_programBuilds.size() && "invalid program handle");
+            return m_programBuilds[handle].state;
+        }
+        
+        bool isProgramReady(ProgramHandle handle) const {
+            return getProgramBuildState(handle) == ProgramBuildState::READY;
+        }
+        
+        // program to draw with while a build is still in flight or after it failed
+        void setFallbackProgram(ShaderProgram const & program) {
+            m_fallbackProgram = program;
+        }
+        
+        /*
+         the finished program, or the fallback program if the build is not ready. with no fallback set the
+         returned program has an invalid id and the draw layer skips commands that use it.
+         */
+        ShaderProgram const & getProgram(ProgramHandle handle) const {
+            assert(handle < m_programBuilds.size() && "invalid program handle");
+            
+            ProgramBuild const & build = m_programBuilds[handle];
+            return build.state == ProgramBuildState::READY ? build.program : m_fallbackProgram;
+        }
+        
+        static std::string injectDefines(std::string const & source, std::string const & defines) {
+            if(defines.empty()) {
+                return source;
+            }
+            
+            size_t insertAt = 0;
+            size_t version  = source.find("#version");
+            if(version != std::string::npos) {
+                size_t lineEnd = source.find('\n', version);
+                insertAt = lineEnd == std::string::npos ? source.size() : lineEnd + 1;
+            }
+            
+            std::string injected;
+            injected.reserve(source.size() + defines.size() + 1);
+            injected.append(source, 0, insertAt);
+            if(insertAt > 0 && source[insertAt - 1] != '\n') {
+                injected += '\n';
+            }
+            injected += defines;
+            if(defines.back() != '\n') {
+                injected += '\n';
+            }
+            injected.append(source, insertAt, std::string::npos);
+            return injected;
+        }
+    
+    private:
+        enum class CompileStatus {
+            UNKNOWN,
+            COMPILED,
+            FAILED
+        };
+        
+        struct CachedShaderObject {
+            ShaderObject  object;
+            uint32_t      references;
+            CompileStatus status;
+        };
+        
+        // how a program was made from files - kept so it can be made again when one of the files changes
+        struct ProgramRecipe {
+            ShaderPreprocessor *     preprocessor;
+            std::vector<ShaderStage> stages;
+            ShaderDefines            defines;
+            std::vector<std::string> files; // every file the stages included
+            uint64_t                 variantHash;
+        };
+        
+        struct ProgramBuild {
+            ShaderProgram                  program;
+            std::vector<ShaderObject>      objects;
+            uint64_t                       cacheKey;
+            ProgramBuildState              state;
+            std::unique_ptr<ProgramRecipe> recipe; // null for programs built from strings - those can't reload
+        };
+        
+        // a rebuild in flight - replaces the program of handle when it links
+        struct ProgramReload {
+            ProgramHandle                  handle;
+            ProgramBuild                   build;
+            std::unique_ptr<ProgramRecipe> recipe;
+        };
+        
+        bool                      m_initialised;
+        ProgramBinaryCache *      m_binaryCache;
+        uint64_t                  m_driverHash;
+        bool                      m_parallelCompile;
+        bool                      m_programUniforms;
+        std::vector<ProgramBuild> m_programBuilds;
+        ShaderProgram             m_fallbackProgram;
+        std::unordered_map<uint64_t, ProgramHandle> m_variantHandles; // preprocessed variant hash -> build
+        std::unique_ptr<ShaderFileWatcher>          m_fileWatcher;
+        std::vector<std::string>                    m_changedFiles;
+        std::chrono::steady_clock::time_point       m_lastFileChange;
+        std::chrono::milliseconds                   m_reloadDebounce;
+        std::vector<ProgramReload>                  m_reloads;
+        std::vector<GLuint>                         m_retiredPrograms; // replaced by a reload, deleted on the next poll
+        size_t                                      m_reloadCount;
+        std::unordered_map<uint64_t, CachedShaderObject>        m_shaderObjects;    // content hash -> object
+        std::unordered_map<GLuint, uint64_t>                    m_shaderObjectKeys; // object id -> content hash
+        std::unordered_map<GLuint, std::vector<ShaderObject>>   m_programStages;    // stages held by createShaderProgram(sources) programs
+        ShaderObjectCacheStats                                  m_shaderObjectStats;
+        
+        static uint64_t shaderObjectKey(ShaderObjectType type, uint64_t sourceHash) {
+            GLenum stage = static_cast<GLenum>(type);
+            return fnv1aBytes(&stage, sizeof(stage), sourceHash);
+        }
+        
+        bool findCachedShaderObject(uint64_t key, ShaderObject & object) {
+            m_shaderObjectStats.lookups++;
+            
+            auto entry = m_shaderObjects.find(key);
+            if(entry == m_shaderObjects.end()) {
+                return false;
+            }
+            
+            m_shaderObjectStats.hits++;
+            entry->second.references++;
+            object = entry->second.object;
+            return true;
+        }
+        
+        ShaderObject insertCachedShaderObject(uint64_t key, ShaderObject const & object) {
+            GL_CHECK(glCompileShader(object));
+            m_shaderObjectStats.compiles++;
+            
+            CachedShaderObject cached;
+            cached.object     = object;
+            cached.references = 1;
+            cached.status     = CompileStatus::UNKNOWN;
+            
+            m_shaderObjects[key]            = cached;
+            m_shaderObjectKeys[object.m_id] = key;
+            m_shaderObjectStats.liveObjects = m_shaderObjects.size();
+            return object;
+        }
+        
+        // preprocesses every stage and hashes the variant - the recipe's file list is filled even when it fails
+        bool preprocessRecipe(ProgramRecipe & recipe, std::vector<PreprocessedShader> & preprocessed) const {
+            preprocessed.clear();
+            preprocessed.reserve(recipe.stages.size());
+            
+            recipe.files.clear();
+            recipe.variantHash = FNV_OFFSET_BASIS;
+            
+            for(auto const & stage : recipe.stages) {
+                preprocessed.push_back(recipe.preprocessor->preprocess(stage.path, recipe.defines));
+                PreprocessedShader const & source = preprocessed.back();
+                
+                for(auto const & file : source.getFiles()) {
+                    if(std::find(recipe.files.begin(), recipe.files.end(), file) == recipe.files.end()) {
+                        recipe.files.push_back(file);
+                    }
+                }
+                
+                if(!source.isValid()) {
+                    if(recipe.files.empty()) {
+                        recipe.files.push_back(stage.path);
+                    }
+                    std::cout << "shader preprocessing failed: " << source.getError() << std::endl;
+                    return false;
+                }
+                
+                GLenum type = static_cast<GLenum>(stage.type);
+                uint64_t sourceHash = source.getHash();
+                recipe.variantHash = fnv1aBytes(&type, sizeof(type), recipe.variantHash);
+                recipe.variantHash = fnv1aBytes(&sourceHash, sizeof(sourceHash), recipe.variantHash);
+            }
+            return true;
+        }
+        
+        void compileStages(ProgramBuild & build, std::vector<ShaderStage> const & stages, std::vector<PreprocessedShader> const & preprocessed) {
+            for(size_t i = 0; i < stages.size(); i++) {
+                build.objects.push_back(acquireShaderObject(stages[i].type, preprocessed[i]));
+            }
+        }
+        
+        void watchRecipeFiles(ProgramRecipe const & recipe) {
+            for(auto const & file : recipe.files) {
+                m_fileWatcher->watchFile(file);
+            }
+        }
+        
+        // collects changes until the files have been quiet for the debounce time and then starts the rebuilds
+        void pollHotReload() {
+            size_t before = m_changedFiles.size();
+            m_fileWatcher->poll(m_changedFiles);
+            
+            auto now = std::chrono::steady_clock::now();
+            if(m_changedFiles.size() != before) {
+                m_lastFileChange = now;
+            }
+            
+            if(m_changedFiles.empty() || now - m_lastFileChange < m_reloadDebounce) {
+                return;
+            }
+            
+            for(auto const & build : m_programBuilds) {
+                if(build.recipe) {
+                    for(auto const & file : m_changedFiles) {
+                        build.recipe->preprocessor->invalidateFile(file);
+                    }
+                }
+            }
+            
+            for(size_t handle = 0; handle < m_programBuilds.size(); handle++) {
+                ProgramRecipe const * recipe = m_programBuilds[handle].recipe.get();
+                if(recipe == nullptr) {
+                    continue;
+                }
+                
+                bool affected = std::any_of(recipe->files.begin(), recipe->files.end(), [this](std::string const & file) {
+                    return std::find(m_changedFiles.begin(), m_changedFiles.end(), file) != m_changedFiles.end();
+                });
+                
+                if(affected) {
+                    startReload(static_cast<ProgramHandle>(handle));
+                }
+            }
+            
+            m_changedFiles.clear();
+        }
+        
+        void startReload(ProgramHandle handle) {
+            ProgramRecipe const & current = *m_programBuilds[handle].recipe;
+            
+            // a newer edit replaces a rebuild that has not finished yet
+            for(auto reload = m_reloads.begin(); reload != m_reloads.end(); ++reload) {
+                if(reload->handle == handle) {
+                    failBuild(reload->build);
+                    m_reloads.erase(reload);
+                    break;
+                }
+            }
+            
+            ProgramReload reload;
+            reload.handle = handle;
+            reload.recipe.reset(new ProgramRecipe(current));
+            
+            std::vector<PreprocessedShader> preprocessed;
+            bool valid = preprocessRecipe(*reload.recipe, preprocessed);
+            watchRecipeFiles(*reload.recipe);
+            
+            if(!valid) {
+                printf("hot reload: program %u keeps its previous version\n", handle);
+                return;
+            }
+            
+            if(reload.recipe->variantHash == current.variantHash && m_programBuilds[handle].state == ProgramBuildState::READY) {
+                return; // saved without a change
+            }
+            
+            reload.build = beginBuild(fnv1aBytes(&reload.recipe->variantHash, sizeof(reload.recipe->variantHash), m_driverHash));
+            labelProgram(reload.build.program, *reload.recipe);
+            if(reload.build.state == ProgramBuildState::COMPILING) {
+                compileStages(reload.build, reload.recipe->stages, preprocessed);
+            }
+            
+            m_reloads.push_back(std::move(reload));
+        }
+        
+        // the swap - everything that reads the handle after this gets the new program
+        void finishReloads() {
+            for(auto reload = m_reloads.begin(); reload != m_reloads.end(); ) {
+                if(reload->build.state == ProgramBuildState::FAILED) {
+                    printf("hot reload: program %u failed to build and keeps its previous version\n", reload->handle);
+                    reload = m_reloads.erase(reload);
+                    continue;
+                }
+                
+                if(reload->build.state != ProgramBuildState::READY) {
+                    ++reload;
+                    continue;
+                }
+                
+                ProgramBuild & target = m_programBuilds[reload->handle];
+                
+                // commands recorded this frame may still name the old program - opengl only defers the delete of
+                // the program that is current, so it is kept until the next poll
+                releaseBuildObjects(target);
+                if(target.program != OPENGL_INVALID_OBJECT) {
+                    m_retiredPrograms.push_back(target.program);
+                }
+                
+                m_variantHandles.erase(target.recipe->variantHash);
+                m_variantHandles[reload->recipe->variantHash] = reload->handle;
+                
+                target.program  = reload->build.program;
+                target.objects  = std::move(reload->build.objects);
+                target.cacheKey = reload->build.cacheKey;
+                target.state    = ProgramBuildState::READY;
+                target.recipe   = std::move(reload->recipe);
+                
+                m_reloadCount++;
+                reload = m_reloads.erase(reload);
+            }
+        }
+        
+        void deleteRetiredPrograms() {
+            for(GLuint program : m_retiredPrograms) {
+                GL_CHECK(glDeleteProgram(program));
+            }
+            m_retiredPrograms.clear();
+        }
+        
+        // names the program after its stage files so debug messages and captures say which variant it is
+        static void labelProgram(ShaderProgram const & program, ProgramRecipe const & recipe) {
+            if(!debugLabelsEnabled()) {
+                return;
+            }
+            
+            std::string label;
+            for(auto const & stage : recipe.stages) {
+                label += (label.empty() ? "" : " ") + stage.path;
+            }
+            labelObject(DebugObject::PROGRAM, program.m_id, label);
+        }
+        
+        // creates the program and tries the binary cache - a build that is not READY still needs its stages compiled
+        ProgramBuild beginBuild(uint64_t cacheKey) {
+            ProgramBuild build;
+            build.program  = createShaderProgram();
+            build.cacheKey = cacheKey;
+            build.state    = ProgramBuildState::COMPILING;
+            
+            if(loadProgramBinary(build.program, build.cacheKey)) {
+                build.state = ProgramBuildState::READY;
+            }
+            return build;
+        }
+        
+        // binds the program for a glUniform* upload when glProgramUniform* is missing
+        class UniformUploadScope {
+        public:
+            explicit UniformUploadScope(GLuint program)
+            :
+            m_previous(0)
+            {
+                GL_CHECK(glGetIntegerv(GL_CURRENT_PROGRAM, &m_previous));
+                GL_CHECK(glUseProgram(program));
+            }
+            
+            ~UniformUploadScope() {
+                GL_CHECK(glUseProgram(static_cast<GLuint>(m_previous)));
+            }
+        
+        private:
+            GLint m_previous;
+        };
+        
+        GLint checkedUniformLocation(ShaderProgram const & program, uint64_t nameHash, GLenum type) const {
+            assert(program.m_reflection && "program has not been linked");
+            
+            UniformInfo const * uniform = program.m_reflection->findUniform(nameHash);
+            if(uniform == nullptr) {
+                return -1; // optimised out by the compiler - not an error
+            }
+            
+            // setUniform(GLint) also sets samplers and bools so it is not type checked
+            assert((uniform->type == type || (type == GL_INT && uniform->location >= 0)) && "uniform type does not match the value being set");
+            return uniform->location;
+        }
+        
+        static uint64_t hashActiveName(GLchar const * name, GLsizei length) {
+            // "lights[0]" is reported for arrays - store it under "lights"
+            if(length > 3 && name[length - 1] == ']' && name[length - 2] == '0' && name[length - 3] == '[') {
+                length -= 3;
+            }
+            return fnv1aBytes(name, static_cast<size_t>(length));
+        }
+        
+        /*
+         reads back everything active after a link. one glGetActiveUniformsiv per property covers all the
+         uniforms at once, the per uniform calls are only for the names and locations.
+         */
+        void reflectProgram(ShaderProgram & program) const {
+            auto reflection = std::make_shared<ProgramReflection>();
+            
+            GLint maxNameLength = 0;
+            GLint count = 0;
+            
+            // uniforms
+            GL_CHECK(glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength));
+            GL_CHECK(glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count));
+            
+            std::vector<GLchar> name(static_cast<size_t>(std::max(maxNameLength, 1)));
+            
+            if(count > 0) {
+                std::vector<GLuint> indices(static_cast<size_t>(count));
+                for(GLint i = 0; i < count; i++) {
+                    indices[i] = static_cast<GLuint>(i);
+                }
+                
+                std::vector<GLint> types(indices.size()), sizes(indices.size()), blocks(indices.size());
+                std::vector<GLint> offsets(indices.size()), arrayStrides(indices.size()), matrixStrides(indices.size());
+                
+                GL_CHECK(glGetActiveUniformsiv(program, count, indices.data(), GL_UNIFORM_TYPE,          types.data()));
+                GL_CHECK(glGetActiveUniformsiv(program, count, indices.data(), GL_UNIFORM_SIZE,          sizes.data()));
+                GL_CHECK(glGetActiveUniformsiv(program, count, indices.data(), GL_UNIFORM_BLOCK_INDEX,   blocks.data()));
+                GL_CHECK(glGetActiveUniformsiv(program, count, indices.data(), GL_UNIFORM_OFFSET,        offsets.data()));
+                GL_CHECK(glGetActiveUniformsiv(program, count, indices.data(), GL_UNIFORM_ARRAY_STRIDE,  arrayStrides.data()));
+                GL_CHECK(glGetActiveUniformsiv(program, count, indices.data(), GL_UNIFORM_MATRIX_STRIDE, matrixStrides.data()));
+                
+                reflection->m_uniforms.reserve(indices.size());
+                for(GLint i = 0; i < count; i++) {
+                    GLsizei length = 0;
+                    GL_CHECK(glGetActiveUniformName(program, static_cast<GLuint>(i), static_cast<GLsizei>(name.size()), &length, name.data()));
+                    
+                    UniformInfo uniform;
+                    uniform.nameHash     = hashActiveName(name.data(), length);
+                    uniform.location     = -1;
+                    uniform.type         = static_cast<GLenum>(types[i]);
+                    uniform.arraySize    = sizes[i];
+                    uniform.blockIndex   = blocks[i];
+                    uniform.offset       = offsets[i];
+                    uniform.arrayStride  = arrayStrides[i];
+                    uniform.matrixStride = matrixStrides[i];
+                    
+                    if(uniform.blockIndex < 0) {
+                        GL_CHECK(uniform.location = glGetUniformLocation(program, name.data()));
+                    }
+                    reflection->m_uniforms.push_back(uniform);
+                }
+            }
+            
+            // uniform blocks
+            GL_CHECK(glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxNameLength));
+            GL_CHECK(glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count));
+            name.resize(static_cast<size_t>(std::max(maxNameLength, 1)));
+            
+            for(GLint i = 0; i < count; i++) {
+                GLsizei length = 0;
+                GL_CHECK(glGetActiveUniformBlockName(program, static_cast<GLuint>(i), static_cast<GLsizei>(name.size()), &length, name.data()));
+                
+                UniformBlockInfo block;
+                block.nameHash = fnv1aBytes(name.data(), static_cast<size_t>(length));
+                block.index    = static_cast<GLuint>(i);
+                GL_CHECK(glGetActiveUniformBlockiv(program, block.index, GL_UNIFORM_BLOCK_DATA_SIZE, &block.dataSize));
+                GL_CHECK(glGetActiveUniformBlockiv(program, block.index, GL_UNIFORM_BLOCK_BINDING,   &block.binding));
+                reflection->m_blocks.push_back(block);
+            }
+            
+            // attributes
+            GL_CHECK(glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxNameLength));
+            GL_CHECK(glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count));
+            name.resize(static_cast<size_t>(std::max(maxNameLength, 1)));
+            
+            for(GLint i = 0; i < count; i++) {
+                GLsizei length = 0;
+                GLint   size   = 0;
+                GLenum  type   = 0;
+                GL_CHECK(glGetActiveAttrib(program, static_cast<GLuint>(i), static_cast<GLsizei>(name.size()), &length, &size, &type, name.data()));
+                
+                AttributeInfo attribute;
+                attribute.nameHash  = hashActiveName(name.data(), length);
+                attribute.type      = type;
+                attribute.arraySize = size;
+                GL_CHECK(attribute.location = glGetAttribLocation(program, name.data()));
+                reflection->m_attributes.push_back(attribute);
+            }
+            
+            ProgramReflection::sortTable(reflection->m_uniforms);
+            ProgramReflection::sortTable(reflection->m_blocks);
+            ProgramReflection::sortTable(reflection->m_attributes);
+            
+            program.m_reflection = reflection;
+        }
+        
+        // GL_COMPLETION_STATUS_KHR never blocks - without the extension completion can't be asked for
+        bool isShaderObjectComplete(ShaderObject const & object) const {
+#if defined(GL_KHR_parallel_shader_compile)
+            if(m_parallelCompile) {
+                GLint complete = GL_FALSE;
+                GL_CHECK(glGetShaderiv(object, GL_COMPLETION_STATUS_KHR, &complete));
+                return complete == GL_TRUE;
+            }
+#endif
+            return true;
+        }
+        
+        bool isProgramComplete(ShaderProgram const & program) const {
+#if defined(GL_KHR_parallel_shader_compile)
+            if(m_parallelCompile) {
+                GLint complete = GL_FALSE;
+                GL_CHECK(glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &complete));
+                return complete == GL_TRUE;
+            }
+#endif
+            return true;
+        }
+        
+        // returns true when the build moved on a stage
+        bool advanceBuild(ProgramBuild & build, bool canBlock) {
+            if(!m_parallelCompile && !canBlock) {
+                return false;
+            }
+            
+            if(build.state == ProgramBuildState::COMPILING) {
+                for(auto const & object : build.objects) {
+                    if(!isShaderObjectComplete(object)) {
+                        return false;
+                    }
+                }
+                
+                for(auto & object : build.objects) {
+                    if(!finishShaderObject(object)) {
+                        failBuild(build);
+                        return true;
+                    }
+                }
+                
+                for(auto const & object : build.objects) {
+                    attachShaderObjectToProgram(build.program, object);
+                }
+                
+                if(m_binaryCache != nullptr) {
+                    GL_CHECK(glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+                }
+                GL_CHECK(glLinkProgram(build.program));
+                
+                build.state = ProgramBuildState::LINKING;
+                return true;
+            }
+            
+            if(build.state == ProgramBuildState::LINKING) {
+                if(!isProgramComplete(build.program)) {
+                    return false;
+                }
+                
+                GLint isLinked = GL_FALSE;
+                GL_CHECK(glGetProgramiv(build.program, GL_LINK_STATUS, &isLinked));
+                
+                if(isLinked == GL_FALSE) {
+                    GLint maxLength = 0;
+                    GL_CHECK(glGetProgramiv(build.program, GL_INFO_LOG_LENGTH, &maxLength));
+                    std::vector<GLchar> error(static_cast<size_t>(std::max(maxLength, 1)), '\0');
+                    GL_CHECK(glGetProgramInfoLog(build.program, maxLength, &maxLength, error.data()));
+                    
+                    std::cout << "program link failed: " << error.data() << std::endl;
+                    failBuild(build);
+                    return true;
+                }
+                
+                build.program.m_linked = true;
+                reflectProgram(build.program);
+                
+                // the build keeps its references so programs submitted later can share the stages
+                for(auto const & object : build.objects) {
+                    detachShaderObjectFromProgram(build.program, object);
+                }
+                storeProgramBinary(build.program, build.cacheKey);
+                
+                build.state = ProgramBuildState::READY;
+                return true;
+            }
+            
+            return false;
+        }
+        
+        void releaseBuildObjects(ProgramBuild & build) {
+            for(auto & object : build.objects) {
+                if(object == OPENGL_INVALID_OBJECT) {
+                    continue;
+                }
+                
+                // only attached between compile and link
+                if(build.state == ProgramBuildState::LINKING && build.program != OPENGL_INVALID_OBJECT) {
+                    detachShaderObjectFromProgram(build.program, object);
+                }
+                releaseShaderObject(object);
+            }
+            build.objects.clear();
+        }
+        
+        void failBuild(ProgramBuild & build) {
+            releaseBuildObjects(build);
+            GL_CHECK(glDeleteProgram(build.program));
+            build.program.m_id = OPENGL_INVALID_OBJECT;
+            build.state = ProgramBuildState::FAILED;
         }
     };
 }
@@ -0,0 +1,861 @@
+//
+//  OpenglTextureCompressor.h
+//  OpenglFramework
+//
+
+/*
+ class information
+ - block compression and the ktx2 container it is stored in, no opengl calls so it can run on the threads that
+   decode images or in an offline tool
+ - the encoders are the real time kind - bounding box endpoints and a nearest palette search per pixel. fine for
+   textures compressed at load time, an offline encoder does better for shipped assets
+ - bc1, bc3, bc4, bc5 and bc7 (mode 6 only) can be encoded, etc2/eac can only be loaded from a container
+ - compress() splits the image into rows of blocks and encodes them on several threads, the palette search has an
+   sse2 version that gives the same blocks as the scalar one
+ - TextureContainer maps the file and hands out pointers into the mapping, OpenglTextureLayer::createTexture()
+   uploads from them without a copy
+ - the container is read and written in the byte order of the machine - every platform we ship on is little endian
+ 
+ TODO
+ - srgb formats
+ - supercompressed (zstd / basis) containers
+ */
+
+#ifndef OpenglTextureCompressor_h
+#define OpenglTextureCompressor_h
+
+// generic includes
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <assert.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//local includes
+#include "OpenglImageProcessor.h"
+
+namespace glLayer {
+    
+    // the values are the vulkan format numbers a ktx2 file stores
+    enum class BlockFormat : uint32_t {
+        BC1_RGB   = 131, // 4 bits per pixel, opaque colour
+        BC3_RGBA  = 137, // 8 bits per pixel, bc1 colour and a bc4 alpha block
+        BC4_R     = 139, // 4 bits per pixel, one channel - masks, height maps
+        BC5_RG    = 141, // 8 bits per pixel, two bc4 blocks - normal maps with z rebuilt in the shader
+        BC7_RGBA  = 145, // 8 bits per pixel, the best quality of the bc formats
+        ETC2_RGB  = 147,
+        ETC2_RGBA = 151,
+        EAC_R     = 153,
+        EAC_RG    = 155,
+    };
+    
+    // every format has 4x4 pixel blocks
+    constexpr size_t blockFormatBytes(BlockFormat format) {
+        return format == BlockFormat::BC1_RGB || format == BlockFormat::BC4_R || format == BlockFormat::ETC2_RGB || format == BlockFormat::EAC_R ? 8 : 16;
+    }
+    
+    class TextureCompressor {
+    public:
+        static constexpr uint32_t BLOCK_SIZE = 4;
+        
+        static bool isEncodable(BlockFormat format) {
+            return format == BlockFormat::BC1_RGB || format == BlockFormat::BC3_RGBA || format == BlockFormat::BC4_R
+                || format == BlockFormat::BC5_RG  || format == BlockFormat::BC7_RGBA;
+        }
+        
+        static size_t compressedSize(BlockFormat format, uint32_t width, uint32_t height) {
+            return static_cast<size_t>((width + BLOCK_SIZE - 1) / BLOCK_SIZE) * ((height + BLOCK_SIZE - 1) / BLOCK_SIZE) * blockFormatBytes(format);
+        }
+        
+        /*
+         encodes a tightly packed rgba8 image - bc4 takes the red channel, bc5 red and green. the pixels past the right
+         and bottom edge of a partial block repeat the last column/row.
+         threads 0 uses every hardware thread, the calling thread is one of them.
+         */
+        static std::vector<uint8_t> compress(BlockFormat format, uint8_t const * rgba, uint32_t width, uint32_t height, unsigned threads = 0, ImageKernel kernel = ImageProcessor::bestKernel()) {
+            assert(isEncodable(format) && "etc2/eac can not be encoded - load them from a container");
+            assert(width > 0 && height > 0 && "image size must be greater than 0");
+            
+            std::vector<uint8_t> blocks(compressedSize(format, width, height));
+            const uint32_t rows = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            
+            if(threads == 0) {
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+            threads = std::min(threads, (rows + ROWS_PER_JOB - 1) / ROWS_PER_JOB);
+            
+            // rows are handed out a few at a time so a thread that gets easy blocks takes more of them
+            std::atomic<uint32_t> nextRow(0);
+            auto worker = [&] {
+                for(;;) {
+                    uint32_t first = nextRow.fetch_add(ROWS_PER_JOB);
+                    if(first >= rows) {
+                        return;
+                    }
+                    compressBlockRows(format, rgba, width, height, first, std::min(uint32_t(ROWS_PER_JOB), rows - first), blocks.data(), kernel);
+                }
+            };
+            
+            std::vector<std::thread> pool;
+            for(unsigned i = 1; i < threads; i++) {
+                pool.emplace_back(worker);
+            }
+            worker();
+            for(auto & thread : pool) {
+                thread.join();
+            }
+            
+            return blocks;
+        }
+        
+        // level 0 and every level of an ImageProcessor::generateMipChain() result, ready for TextureContainer::write()
+        static std::vector<std::vector<uint8_t>> compressMipChain(BlockFormat format, uint8_t const * rgba, uint32_t width, uint32_t height, std::vector<ImageMipLevel> const & mips,
+                                                                  unsigned threads = 0, ImageKernel kernel = ImageProcessor::bestKernel()) {
+            std::vector<std::vector<uint8_t>> levels;
+            levels.reserve(mips.size() + 1);
+            levels.push_back(compress(format, rgba, width, height, threads, kernel));
+            
+            for(auto const & mip : mips) {
+                levels.push_back(compress(format, mip.pixels.data(), mip.width, mip.height, threads, kernel));
+            }
+            return levels;
+        }
+        
+        /*
+         block rows [firstRow, firstRow + rowCount) - blocks points at the output for the whole image. for callers
+         that split the work over their own job system.
+         */
+        static void compressBlockRows(BlockFormat format, uint8_t const * rgba, uint32_t width, uint32_t height, uint32_t firstRow, uint32_t rowCount, uint8_t * blocks, ImageKernel kernel = ImageProcessor::bestKernel()) {
+            const uint32_t columns    = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            const size_t   blockBytes = blockFormatBytes(format);
+            uint8_t pixels[64];
+            
+            for(uint32_t by = firstRow; by < firstRow + rowCount; by++) {
+                uint8_t * out = blocks + static_cast<size_t>(by) * columns * blockBytes;
+                
+                for(uint32_t bx = 0; bx < columns; bx++, out += blockBytes) {
+                    loadBlock(rgba, width, height, bx, by, pixels);
+                    
+                    switch(format) {
+                        case BlockFormat::BC1_RGB:
+                            encodeBC1(pixels, out, kernel);
+                            break;
+                        case BlockFormat::BC3_RGBA:
+                            encodeBC4(pixels, 3, out);
+                            encodeBC1(pixels, out + 8, kernel);
+                            break;
+                        case BlockFormat::BC4_R:
+                            encodeBC4(pixels, 0, out);
+                            break;
+                        case BlockFormat::BC5_RG:
+                            encodeBC4(pixels, 0, out);
+                            encodeBC4(pixels, 1, out + 8);
+                            break;
+                        case BlockFormat::BC7_RGBA:
+                            encodeBC7(pixels, out, kernel);
+                            break;
+                        default:
+                            assert(false && "format can not be encoded");
+                            break;
+                    }
+                }
+            }
+        }
+    
+    private:
+        static constexpr uint32_t ROWS_PER_JOB = 4;
+        
+        // bit stream of a 128 bit block, least significant bit first
+        struct BlockBits {
+            uint64_t low   = 0;
+            uint64_t high  = 0;
+            uint32_t count = 0;
+            
+            void write(uint32_t value, uint32_t bits) {
+                for(uint32_t i = 0; i < bits; i++, count++) {
+                    uint64_t bit = (value >> i) & 1;
+                    if(count < 64) {
+                        low  |= bit << count;
+                    } else {
+                        high |= bit << (count - 64);
+                    }
+                }
+            }
+            
+            void store(uint8_t * out) const {
+                for(int i = 0; i < 8; i++) {
+                    out[i]     = static_cast<uint8_t>(low  >> (i * 8));
+                    out[i + 8] = static_cast<uint8_t>(high >> (i * 8));
+                }
+            }
+        };
+        
+        static void loadBlock(uint8_t const * rgba, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, uint8_t * pixels) {
+            for(uint32_t y = 0; y < BLOCK_SIZE; y++) {
+                size_t row = std::min(by * BLOCK_SIZE + y, height - 1);
+                for(uint32_t x = 0; x < BLOCK_SIZE; x++) {
+                    size_t column = std::min(bx * BLOCK_SIZE + x, width - 1);
+                    std::memcpy(pixels + (y * BLOCK_SIZE + x) * 4, rgba + (row * width + column) * 4, 4);
+                }
+            }
+        }
+        
+        // per channel minimum and maximum of the 16 pixels
+        static void blockBounds(uint8_t const * pixels, uint8_t * low, uint8_t * high, ImageKernel kernel) {
+#if defined(OPENGL_IMAGE_SSE2)
+            if(kernel >= ImageKernel::SSE2) {
+                __m128i p0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(pixels));
+                __m128i p1 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(pixels + 16));
+                __m128i p2 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(pixels + 32));
+                __m128i p3 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(pixels + 48));
+                
+                __m128i minimum = _mm_min_epu8(_mm_min_epu8(p0, p1), _mm_min_epu8(p2, p3));
+                __m128i maximum = _mm_max_epu8(_mm_max_epu8(p0, p1), _mm_max_epu8(p2, p3));
+                minimum = _mm_min_epu8(minimum, _mm_shuffle_epi32(minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+                maximum = _mm_max_epu8(maximum, _mm_shuffle_epi32(maximum, _MM_SHUFFLE(1, 0, 3, 2)));
+                minimum = _mm_min_epu8(minimum, _mm_shuffle_epi32(minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+                maximum = _mm_max_epu8(maximum, _mm_shuffle_epi32(maximum, _MM_SHUFFLE(2, 3, 0, 1)));
+                
+                uint32_t packedLow  = static_cast<uint32_t>(_mm_cvtsi128_si32(minimum));
+                uint32_t packedHigh = static_cast<uint32_t>(_mm_cvtsi128_si32(maximum));
+                std::memcpy(low,  &packedLow,  4);
+                std::memcpy(high, &packedHigh, 4);
+                return;
+            }
+#endif
+            (void)kernel;
+            for(size_t c = 0; c < 4; c++) {
+                low[c]  = 255;
+                high[c] = 0;
+            }
+            for(size_t i = 0; i < 16; i++) {
+                for(size_t c = 0; c < 4; c++) {
+                    low[c]  = std::min(low[c],  pixels[i * 4 + c]);
+                    high[c] = std::max(high[c], pixels[i * 4 + c]);
+                }
+            }
+        }
+        
+        /*
+         the box diagonal from low to high only fits pixels whose channels rise together. a channel that falls as the
+         widest channel rises gets its ends swapped so the line runs along the other diagonal.
+         */
+        static void selectDiagonal(uint8_t const * pixels, uint8_t * low, uint8_t * high, size_t channels) {
+            size_t reference = 0;
+            for(size_t c = 1; c < channels; c++) {
+                if(high[c] - low[c] > high[reference] - low[reference]) {
+                    reference = c;
+                }
+            }
+            
+            int centre[4];
+            for(size_t c = 0; c < channels; c++) {
+                centre[c] = (low[c] + high[c] + 1) / 2;
+            }
+            
+            for(size_t c = 0; c < channels; c++) {
+                if(c == reference) {
+                    continue;
+                }
+                
+                int covariance = 0;
+                for(size_t i = 0; i < 16; i++) {
+                    covariance += (pixels[i * 4 + reference] - centre[reference]) * (pixels[i * 4 + c] - centre[c]);
+                }
+                if(covariance < 0) {
+                    std::swap(low[c], high[c]);
+                }
+            }
+        }
+        
+        /*
+         index of the nearest palette entry (rgba8) for every pixel by squared distance over the first channels.
+         ties go to the lower index in both versions so they give the same blocks.
+         */
+        static void nearestPaletteIndices(uint8_t const * pixels, uint8_t const * palette, uint32_t paletteSize, size_t channels, uint8_t * indices, ImageKernel kernel) {
+#if defined(OPENGL_IMAGE_SSE2)
+            if(kernel >= ImageKernel::SSE2) {
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i mask = channels == 4 ? _mm_set1_epi16(-1) : _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+                
+                // two pixels of 16 bit channels per register
+                __m128i wide[8];
+                __m128i best[4];
+                __m128i bestIndex[4];
+                for(int i = 0; i < 4; i++) {
+                    __m128i packed = _mm_loadu_si128(reinterpret_cast<__m128i const *>(pixels + i * 16));
+                    wide[i * 2]     = _mm_unpacklo_epi8(packed, zero);
+                    wide[i * 2 + 1] = _mm_unpackhi_epi8(packed, zero);
+                    best[i]         = _mm_set1_epi32(INT_MAX);
+                    bestIndex[i]    = zero;
+                }
+                
+                for(uint32_t e = 0; e < paletteSize; e++) {
+                    uint8_t const * entry = palette + e * 4;
+                    const __m128i colour = _mm_setr_epi16(entry[0], entry[1], entry[2], entry[3], entry[0], entry[1], entry[2], entry[3]);
+                    const __m128i index  = _mm_set1_epi32(static_cast<int>(e));
+                    
+                    for(int i = 0; i < 4; i++) {
+                        __m128i d0 = _mm_and_si128(_mm_sub_epi16(wide[i * 2],     colour), mask);
+                        __m128i d1 = _mm_and_si128(_mm_sub_epi16(wide[i * 2 + 1], colour), mask);
+                        // r*r + g*g and b*b + a*a per pixel, then the two halves added
+                        __m128i s0 = _mm_madd_epi16(d0, d0);
+                        __m128i s1 = _mm_madd_epi16(d1, d1);
+                        s0 = _mm_add_epi32(s0, _mm_shuffle_epi32(s0, _MM_SHUFFLE(2, 3, 0, 1)));
+                        s1 = _mm_add_epi32(s1, _mm_shuffle_epi32(s1, _MM_SHUFFLE(2, 3, 0, 1)));
+                        __m128i distance = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(s0), _mm_castsi128_ps(s1), _MM_SHUFFLE(2, 0, 2, 0)));
+                        
+                        __m128i closer = _mm_cmplt_epi32(distance, best[i]);
+                        best[i]      = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, best[i]));
+                        bestIndex[i] = _mm_or_si128(_mm_and_si128(closer, index),    _mm_andnot_si128(closer, bestIndex[i]));
+                    }
+                }
+                
+                for(int i = 0; i < 4; i++) {
+                    int32_t lanes[4];
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), bestIndex[i]);
+                    for(int j = 0; j < 4; j++) {
+                        indices[i * 4 + j] = static_cast<uint8_t>(lanes[j]);
+                    }
+                }
+                return;
+            }
+#endif
+            (void)kernel;
+            for(size_t i = 0; i < 16; i++) {
+                int     best  = INT_MAX;
+                uint8_t index = 0;
+                
+                for(uint32_t e = 0; e < paletteSize; e++) {
+                    int distance = 0;
+                    for(size_t c = 0; c < channels; c++) {
+                        int d = pixels[i * 4 + c] - palette[e * 4 + c];
+                        distance += d * d;
+                    }
+                    if(distance < best) {
+                        best  = distance;
+                        index = static_cast<uint8_t>(e);
+                    }
+                }
+                indices[i] = index;
+            }
+        }
+        
+        static uint16_t packRGB565(uint8_t const * colour) {
+            return static_cast<uint16_t>(((colour[0] >> 3) << 11) | ((colour[1] >> 2) << 5) | (colour[2] >> 3));
+        }
+        
+        // bit replication, the same expansion the hardware does
+        static void unpackRGB565(uint16_t packed, uint8_t * colour) {
+            uint8_t r = static_cast<uint8_t>((packed >> 11) & 31);
+            uint8_t g = static_cast<uint8_t>((packed >> 5)  & 63);
+            uint8_t b = static_cast<uint8_t>(packed & 31);
+            colour[0] = static_cast<uint8_t>((r << 3) | (r >> 2));
+            colour[1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+            colour[2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+            colour[3] = 255;
+        }
+        
+        // two 565 endpoints and 2 bit indices. always the 4 colour mode so the block is valid inside bc3 as well
+        static void encodeBC1(uint8_t const * pixels, uint8_t * out, ImageKernel kernel) {
+            uint8_t low[4];
+            uint8_t high[4];
+            blockBounds(pixels, low, high, kernel);
+            
+            // pull the ends in by 1/16 of the box - the extremes are rarely worth an endpoint of their own
+            for(size_t c = 0; c < 3; c++) {
+                uint8_t inset = static_cast<uint8_t>((high[c] - low[c]) >> 4);
+                low[c]  = static_cast<uint8_t>(low[c]  + inset);
+                high[c] = static_cast<uint8_t>(high[c] - inset);
+            }
+            selectDiagonal(pixels, low, high, 3);
+            
+            uint16_t colour0 = packRGB565(high);
+            uint16_t colour1 = packRGB565(low);
+            if(colour0 < colour1) {
+                std::swap(colour0, colour1);
+            }
+            
+            // equal endpoints leave every index at 0
+            uint32_t indices = 0;
+            if(colour0 != colour1) {
+                uint8_t palette[16];
+                unpackRGB565(colour0, palette);
+                unpackRGB565(colour1, palette + 4);
+                for(size_t c = 0; c < 4; c++) {
+                    palette[8 + c]  = static_cast<uint8_t>((palette[c] * 2 + palette[4 + c])     / 3);
+                    palette[12 + c] = static_cast<uint8_t>((palette[c]     + palette[4 + c] * 2) / 3);
+                }
+                
+                uint8_t nearest[16];
+                nearestPaletteIndices(pixels, palette, 4, 3, nearest, kernel);
+                for(size_t i = 0; i < 16; i++) {
+                    indices |= static_cast<uint32_t>(nearest[i]) << (i * 2);
+                }
+            }
+            
+            out[0] = static_cast<uint8_t>(colour0);
+            out[1] = static_cast<uint8_t>(colour0 >> 8);
+            out[2] = static_cast<uint8_t>(colour1);
+            out[3] = static_cast<uint8_t>(colour1 >> 8);
+            for(int i = 0; i < 4; i++) {
+                out[4 + i] = static_cast<uint8_t>(indices >> (i * 8));
+            }
+        }
+        
+        /*
+         one channel with 8 bit endpoints and 3 bit indices in the 8 value mode (endpoint 0 > endpoint 1). the
+         palette is evenly spaced so the nearest entry is a rounded division, no search needed.
+         */
+        static void encodeBC4(uint8_t const * pixels, size_t channel, uint8_t * out) {
+            uint32_t low  = 255;
+            uint32_t high = 0;
+            for(size_t i = 0; i < 16; i++) {
+                low  = std::min<uint32_t>(low,  pixels[i * 4 + channel]);
+                high = std::max<uint32_t>(high, pixels[i * 4 + channel]);
+            }
+            
+            out[0] = static_cast<uint8_t>(high);
+            out[1] = static_cast<uint8_t>(low);
+            
+            uint64_t indices = 0;
+            if(high > low) {
+                const uint32_t range = high - low;
+                for(size_t i = 0; i < 16; i++) {
+                    // 0 is high, 7 is low - the stored order is high, low and then the six in between
+                    uint32_t step  = ((high - pixels[i * 4 + channel]) * 7 + range / 2) / range;
+                    uint64_t index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+                    indices |= index << (i * 3);
+                }
+            }
+            
+            for(int i = 0; i < 6; i++) {
+                out[2 + i] = static_cast<uint8_t>(indices >> (i * 8));
+            }
+        }
+        
+        // 7 bit channels with a shared low bit - picks the low bit that lands closest to the colour
+        static void quantizeBC7Endpoint(uint8_t const * colour, uint8_t * endpoint, uint32_t & pbit) {
+            int bestError = INT_MAX;
+            pbit = 0;
+            
+            for(uint32_t p = 0; p < 2; p++) {
+                uint8_t quantized[4];
+                int     error = 0;
+                for(size_t c = 0; c < 4; c++) {
+                    quantized[c] = static_cast<uint8_t>(std::min((colour[c] - static_cast<int>(p) + 1) >> 1, 127));
+                    int d = colour[c] - ((quantized[c] << 1) | static_cast<int>(p));
+                    error += d * d;
+                }
+                if(error < bestError) {
+                    bestError = error;
+                    pbit = p;
+                    std::memcpy(endpoint, quantized, 4);
+                }
+            }
+        }
+        
+        /*
+         mode 6 - a single rgba line with 7 bit endpoints, a p bit each and 4 bit indices. the one mode that covers
+         every block reasonably well, the partitioned modes need a search an encoder at load time can not afford.
+         */
+        static void encodeBC7(uint8_t const * pixels, uint8_t * out, ImageKernel kernel) {
+            static const uint32_t weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+            
+            uint8_t low[4];
+            uint8_t high[4];
+            blockBounds(pixels, low, high, kernel);
+            selectDiagonal(pixels, low, high, 4);
+            
+            uint8_t  endpoints[2][4];
+            uint32_t pbits[2];
+            quantizeBC7Endpoint(low,  endpoints[0], pbits[0]);
+            quantizeBC7Endpoint(high, endpoints[1], pbits[1]);
+            
+            uint8_t palette[64];
+            for(size_t e = 0; e < 16; e++) {
+                for(size_t c = 0; c < 4; c++) {
+                    uint32_t a = static_cast<uint32_t>(endpoints[0][c] << 1) | pbits[0];
+                    uint32_t b = static_cast<uint32_t>(endpoints[1][c] << 1) | pbits[1];
+                    palette[e * 4 + c] = static_cast<uint8_t>(((64 - weights[e]) * a + weights[e] * b + 32) >> 6);
+                }
+            }
+            
+            uint8_t indices[16];
+            nearestPaletteIndices(pixels, palette, 16, 4, indices, kernel);
+            
+            // the first index is stored without its top bit - mirror the line when that bit is set
+            if(indices[0] >= 8) {
+                std::swap(endpoints[0], endpoints[1]);
+                std::swap(pbits[0], pbits[1]);
+                for(auto & index : indices) {
+                    index = static_cast<uint8_t>(15 - index);
+                }
+            }
+            
+            BlockBits bits;
+            bits.write(1u << 6, 7);
+            for(size_t c = 0; c < 4; c++) {
+                bits.write(endpoints[0][c], 7);
+                bits.write(endpoints[1][c], 7);
+            }
+            bits.write(pbits[0], 1);
+            bits.write(pbits[1], 1);
+            bits.write(indices[0], 3);
+            for(size_t i = 1; i < 16; i++) {
+                bits.write(indices[i], 4);
+            }
+            bits.store(out);
+        }
+    };
+    
+    /* Texture Container */
+    /*----------------------------------------------------------------------------------------------*/
+    /*
+     a ktx2 file holding one 2d image and its mip levels - no array layers, faces or supercompression.
+     open() maps the file and checks every level against the size its format and dimensions need, after that the
+     level pointers go straight into the mapping. on windows the file is read into memory instead.
+     */
+    class TextureContainer {
+    public:
+        TextureContainer()
+        : m_mapped(nullptr)
+        , m_mappedSize(0)
+        , m_format(BlockFormat::BC1_RGB)
+        , m_width(0)
+        , m_height(0)
+        {
+        }
+        
+        ~TextureContainer() {
+            close();
+        }
+        
+        TextureContainer(TextureContainer const &) = delete;
+        TextureContainer & operator=(TextureContainer const &) = delete;
+        
+        bool open(std::string const & path) {
+            close();
+            
+            if(!mapFile(path)) {
+                printf("texture container: could not open %s D:\n", path.c_str());
+                return false;
+            }
+            
+            if(!readHeader()) {
+                printf("texture container: %s is not a ktx2 file that can be loaded\n", path.c_str());
+                close();
+                return false;
+            }
+            return true;
+        }
+        
+        void close() {
+            m_levels.clear();
+            unmapFile();
+            m_width  = 0;
+            m_height = 0;
+        }
+        
+        bool        isOpen() const        { return m_mapped != nullptr; }
+        BlockFormat getFormat() const     { return m_format;            }
+        uint32_t    getWidth() const      { return m_width;             }
+        uint32_t    getHeight() const     { return m_height;            }
+        uint32_t    getLevelCount() const { return static_cast<uint32_t>(m_levels.size()); }
+        
+        // points into the mapping - valid until close()
+        uint8_t const * getLevelData(uint32_t level, size_t & size) const {
+            assert(level < m_levels.size() && "mip level out of range");
+            size = m_levels[level].length;
+            return m_mapped + m_levels[level].offset;
+        }
+        
+        /*
+         levels[0] is the full size image and every next level is half the size, each one exactly
+         TextureCompressor::compressedSize() bytes. the levels are stored smallest first like ktx2 asks.
+         */
+        static bool write(std::string const & path, BlockFormat format, uint32_t width, uint32_t height, std::vector<std::vector<uint8_t>> const & levels) {
+            assert(!levels.empty() && "a container needs at least one level");
+            
+            if(levels.size() > mipLevelCount(width, height)) {
+                printf("texture container: %s has more levels than a %ux%u mip chain\n", path.c_str(), width, height);
+                return false;
+            }
+            
+            for(size_t level = 0; level < levels.size(); level++) {
+                if(levels[level].size() != TextureCompressor::compressedSize(format, levelSize(width, level), levelSize(height, level))) {
+                    printf("texture container: level %zu of %s has the wrong size\n", level, path.c_str());
+                    return false;
+                }
+            }
+            
+            std::vector<uint32_t> descriptor = dataFormatDescriptor(format);
+            const size_t descriptorBytes = descriptor.size() * sizeof(uint32_t);
+            const size_t alignment       = blockFormatBytes(format);
+            
+            std::vector<LevelIndex> index(levels.size());
+            size_t offset = HEADER_SIZE + levels.size() * sizeof(LevelIndex) + descriptorBytes;
+            for(size_t level = levels.size(); level-- > 0;) {
+                offset = (offset + alignment - 1) / alignment * alignment;
+                index[level].offset             = offset;
+                index[level].length             = levels[level].size();
+                index[level].uncompressedLength = levels[level].size();
+                offset += levels[level].size();
+            }
+            
+            std::vector<uint8_t> file(offset, 0);
+            uint32_t header[] = {
+                static_cast<uint32_t>(format),
+                1,          // type size - 1 for block compressed formats
+                width,
+                height,
+                0,          // depth
+                0,          // layers
+                1,          // faces
+                static_cast<uint32_t>(levels.size()),
+                0,          // supercompression
+                static_cast<uint32_t>(HEADER_SIZE + levels.size() * sizeof(LevelIndex)),
+                static_cast<uint32_t>(descriptorBytes),
+                0,          // key/value data offset and length
+                0,
+            };
+            
+            std::memcpy(file.data(), identifier(), IDENTIFIER_SIZE);
+            std::memcpy(file.data() + IDENTIFIER_SIZE, header, sizeof(header));
+            // the supercompression global data offset and length stay 0
+            std::memcpy(file.data() + HEADER_SIZE, index.data(), index.size() * sizeof(LevelIndex));
+            std::memcpy(file.data() + header[9], descriptor.data(), descriptorBytes);
+            for(size_t level = 0; level < levels.size(); level++) {
+                std::memcpy(file.data() + index[level].offset, levels[level].data(), levels[level].size());
+            }
+            
+            std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+            if(!stream) {
+                printf("texture container: could not write %s D:\n", path.c_str());
+                return false;
+            }
+            stream.write(reinterpret_cast<const char *>(file.data()), static_cast<std::streamsize>(file.size()));
+            return static_cast<bool>(stream);
+        }
+    
+    private:
+        static constexpr size_t IDENTIFIER_SIZE = 12;
+        static constexpr size_t HEADER_SIZE     = 80; // identifier, 9 header words, 4 index words and 2 64 bit index words
+        static constexpr size_t MAX_LEVELS      = 32; // a full chain for 32 bit sizes
+        
+        struct LevelIndex {
+            uint64_t offset;
+            uint64_t length;
+            uint64_t uncompressedLength;
+        };
+        
+        struct Level {
+            size_t offset;
+            size_t length;
+        };
+        
+        const uint8_t *       m_mapped;
+        size_t                m_mappedSize;
+        BlockFormat           m_format;
+        uint32_t              m_width;
+        uint32_t              m_height;
+        std::vector<Level>    m_levels;
+#ifdef _WIN32
+        std::vector<uint8_t>  m_fileCopy;
+#endif
+        
+        static uint8_t const * identifier() {
+            static const uint8_t bytes[IDENTIFIER_SIZE] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+            return bytes;
+        }
+        
+        static uint32_t levelSize(uint32_t size, size_t level) {
+            return std::max(1u, size >> level);
+        }
+        
+        // floor(log2(max(width, height))) + 1
+        static uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+            uint32_t count = 1;
+            for(uint32_t size = std::max(width, height); size > 1; size >>= 1) {
+                count++;
+            }
+            return count;
+        }
+        
+        static bool isKnownFormat(uint32_t format) {
+            switch(static_cast<BlockFormat>(format)) {
+                case BlockFormat::BC1_RGB:
+                case BlockFormat::BC3_RGBA:
+                case BlockFormat::BC4_R:
+                case BlockFormat::BC5_RG:
+                case BlockFormat::BC7_RGBA:
+                case BlockFormat::ETC2_RGB:
+                case BlockFormat::ETC2_RGBA:
+                case BlockFormat::EAC_R:
+                case BlockFormat::EAC_RG:
+                    return true;
+            }
+            return false;
+        }
+        
+        bool readHeader() {
+            if(m_mappedSize < HEADER_SIZE || std::memcmp(m_mapped, identifier(), IDENTIFIER_SIZE) != 0) {
+                return false;
+            }
+            
+            uint32_t header[9];
+            std::memcpy(header, m_mapped + IDENTIFIER_SIZE, sizeof(header));
+            
+            const uint32_t format = header[0];
+            const uint32_t depth  = header[4];
+            const uint32_t layers = header[5];
+            const uint32_t faces  = header[6];
+            const uint32_t levels = std::max(1u, header[7]); // 0 asks the loader to build the mips - we just use level 0
+            
+            if(!isKnownFormat(format) || header[2] == 0 || header[3] == 0 || depth != 0 || layers > 1 || faces != 1 || header[8] != 0) {
+                return false;
+            }
+            
+            m_format = static_cast<BlockFormat>(format);
+            m_width  = header[2];
+            m_height = header[3];
+            
+            // more levels than the chain has would shift levelSize() past the width of the size
+            if(levels > MAX_LEVELS || levels > mipLevelCount(m_width, m_height)) {
+                return false;
+            }
+            
+            if(HEADER_SIZE + size_t(levels) * sizeof(LevelIndex) > m_mappedSize) {
+                return false;
+            }
+            
+            // the whole index is checked against the mapping before any level is taken
+            LevelIndex index[MAX_LEVELS];
+            std::memcpy(index, m_mapped + HEADER_SIZE, levels * sizeof(LevelIndex));
+            
+            for(uint32_t level = 0; level < levels; level++) {
+                if(index[level].offset > m_mappedSize || index[level].length > m_mappedSize - index[level].offset) {
+                    return false;
+                }
+                
+                size_t expected = TextureCompressor::compressedSize(m_format, levelSize(m_width, level), levelSize(m_height, level));
+                if(index[level].length != expected) {
+                    return false;
+                }
+            }
+            
+            m_levels.reserve(levels);
+            for(uint32_t level = 0; level < levels; level++) {
+                m_levels.push_back(Level{ static_cast<size_t>(index[level].offset), static_cast<size_t>(index[level].length) });
+            }
+            return true;
+        }
+        
+        /*
+         the basic data format descriptor ktx2 requires - one 4x4 block with a sample for every channel the
+         format stores, linear transfer and bt709 primaries
+         */
+        static std::vector<uint32_t> dataFormatDescriptor(BlockFormat format) {
+            enum : uint32_t { CHANNEL_RED = 0, CHANNEL_GREEN = 1, CHANNEL_COLOUR = 0, CHANNEL_ETC2_COLOUR = 2, CHANNEL_ALPHA = 15 };
+            
+            uint32_t model = 0;
+            std::vector<std::pair<uint32_t, uint32_t>> samples; // bit offset, channel - every sample is 64 bits but bc7's
+            
+            switch(format) {
+                case BlockFormat::BC1_RGB:   model = 128; samples = { {0, CHANNEL_COLOUR} };                            break;
+                case BlockFormat::BC3_RGBA:  model = 130; samples = { {0, CHANNEL_ALPHA}, {64, CHANNEL_COLOUR} };       break;
+                case BlockFormat::BC4_R:     model = 131; samples = { {0, CHANNEL_RED} };                               break;
+                case BlockFormat::BC5_RG:    model = 132; samples = { {0, CHANNEL_RED}, {64, CHANNEL_GREEN} };          break;
+                case BlockFormat::BC7_RGBA:  model = 134; samples = { {0, CHANNEL_COLOUR} };                            break;
+                case BlockFormat::ETC2_RGB:  model = 161; samples = { {0, CHANNEL_ETC2_COLOUR} };                       break;
+                case BlockFormat::ETC2_RGBA: model = 161; samples = { {0, CHANNEL_ALPHA}, {64, CHANNEL_ETC2_COLOUR} };  break;
+                case BlockFormat::EAC_R:     model = 161; samples = { {0, CHANNEL_RED} };                               break;
+                case BlockFormat::EAC_RG:    model = 161; samples = { {0, CHANNEL_RED}, {64, CHANNEL_GREEN} };          break;
+            }
+            
+            const uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+            const uint32_t bits      = format == BlockFormat::BC7_RGBA ? 128 : 64;
+            
+            std::vector<uint32_t> words = {
+                4 + blockSize,                              // total size
+                0,                                          // khronos vendor, basic descriptor
+                2 | (blockSize << 16),                      // version 2
+                model | (1 << 8) | (1 << 16),               // bt709 primaries, linear transfer, straight alpha
+                3 | (3 << 8),                               // block dimensions minus one
+                static_cast<uint32_t>(blockFormatBytes(format)),
+                0,
+            };
+            
+            for(auto const & sample : samples) {
+                words.push_back(sample.first | ((bits - 1) << 16) | (sample.second << 24));
+                words.push_back(0);          // sample position
+                words.push_back(0);          // lower
+                words.push_back(0xFFFFFFFF); // upper
+            }
+            return words;
+        }
+        
+        bool mapFile(std::string const & path) {
+#ifndef _WIN32
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0) {
+                return false;
+            }
+            
+            struct stat info;
+            if(fstat(fd, &info) != 0 || info.st_size == 0) {
+                ::close(fd);
+                return false;
+            }
+            
+            void * mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            
+            if(mapping == MAP_FAILED) {
+                return false;
+            }
+            
+            m_mapped     = static_cast<const uint8_t *>(mapping);
+            m_mappedSize = static_cast<size_t>(info.st_size);
+            return true;
+#else
+            std::ifstream file(path, std::ios::binary);
+            if(!file) {
+                return false;
+            }
+            m_fileCopy.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            m_mapped     = m_fileCopy.data();
+            m_mappedSize = m_fileCopy.size();
+            return m_mappedSize > 0;
+#endif
+        }
+        
+        void unmapFile() {
+#ifndef _WIN32
+            if(m_mapped != nullptr) {
+                munmap(const_cast<uint8_t *>(m_mapped), m_mappedSize);
+            }
+#else
+            m_fileCopy.clear();
+#endif
+            m_mapped     = nullptr;
+            m_mappedSize = 0;
+        }
+    };
+}
+
+#endif /* OpenglTextureCompressor_h */
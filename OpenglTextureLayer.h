@@ -1,35 +1,47 @@
 //
-//  OpenGLContext.hpp
-//  OpenGLExamples
+//  OpenglTextureLayer.h
+//  OpenglFramework
 //
 //  Created by Daniel Collier on 16/10/2016.
 //  Copyright © 2016 Daniel Collier. All rights reserved.
+//
 
 /*
  class information
- - opengl must be linked with this class
- - on windows glew must be linked with this class
  - a context must be created before any of the methods in this class are used
  - the init() function must be called before any other function in this class
+ - textures are immutable - the size, format and level count are fixed when the texture is created,
+   only the pixels can be updated
+ - the gl type and internal format come from the element type of the pixel data at compile time
+ - creating or updating a texture binds it on the active texture unit and leaves it bound. the draw layer
+   forgets its cached bindings at the start of every processDrawCommands() so this is safe between frames
+ - large images can be streamed in the background through a TextureStreamer, see createTextureStreamer()
+ - small images (sprites, ui, glyphs) can share one array texture through a TextureAtlas, see createTextureAtlas()
+ - filtering and wrapping for draws comes from shared sampler objects, see getSampler() - the parameters set
+   on the texture itself only apply when a draw has no sampler
+ - block compressed textures come from TextureCompressor or a TextureContainer, pick the format with
+   selectCompressedFormat() so it is one the driver reports
  
  TODO
- - add ifdefs for opengl versions
- - add context creation into layer so it is based on the version defines.??
- - add master function for shader creation
- - figure out some template magic for the TexturePixelData class and then pass it into the create texture function !(:
- - if defs for DSA opengl
- - finish of createTexture function - currently only works for certain texture types
- - replace glew with something ?? for the windows version
+ - cube map and 3d textures
+ - srgb internal formats
  */
 
-#ifndef OpenglLayer_hpp
-#define OpenglLayer_hpp
+#ifndef OpenglTextureLayer_h
+#define OpenglTextureLayer_h
 
 // generic includes
-#include <stdio.h>
-#include <string>
 #include <vector>
+#include <array>
 #include <iostream>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <type_traits>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <assert.h>
 
 // platform dependent includes
@@ -40,99 +52,676 @@
 #include "GL/glew.h"
 #endif
 
-//defines
+//defines - the version can be overridden before including to compile in newer api paths
+#ifndef OPENGL_MAJOR_VERSION
 #define OPENGL_MAJOR_VERSION  4
+#endif
+#ifndef OPENGL_MINOR_VERSION
 #define OPENGL_MINOR_VERSION  1
-#define OPENGL_MIN_REQUIRED_VERSION_MAJOR 3
-#define OPENGL_MIN_REQUIRED_VERSION_MINOR 2
-#define OPENGL_INVALID_OBJECT 0
+#endif
+
+// block compressed formats the headers may not have - s3tc is an extension, bptc and etc2 are newer than 4.1
+#ifndef GL_TEXTURE_MAX_ANISOTROPY_EXT
+#define GL_TEXTURE_MAX_ANISOTROPY_EXT    0x84FE
+#endif
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM    0x8E8C
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2          0x9274
+#endif
+#ifndef GL_COMPRESSED_RGBA8_ETC2_EAC
+#define GL_COMPRESSED_RGBA8_ETC2_EAC     0x9278
+#endif
+#ifndef GL_COMPRESSED_R11_EAC
+#define GL_COMPRESSED_R11_EAC            0x9270
+#endif
+#ifndef GL_COMPRESSED_RG11_EAC
+#define GL_COMPRESSED_RG11_EAC           0x9272
+#endif
+
+//local includes
+#include "OpenglDebugLayer.h"
+#include "OpenglInformationLayer.h"
+#include "OpenglTextureCompressor.h"
 
-#ifndef GL_CHECK
-#ifdef DEBUG
-#define GL_CHECK(stmt) do { stmt; checkOpenGLError(#stmt,__FILE__,__LINE__); } while(0)
+// glTexStorage* is declared - init() asks the context whether it can be used
+#if OPENGL_VERSION_AT_LEAST(4, 2) || defined(GL_ARB_texture_storage)
+#define OPENGL_TEXTURE_STORAGE 1
 #else
-#define GL_CHECK(stmt) stmt
-#endif//DEBUG
-#endif//GL_CHECK
+#define OPENGL_TEXTURE_STORAGE 0
+#endif
 
-namespace glLayer
-{
-    /* Shader Classes */
+namespace glLayer {
+    
+    enum class TextureTarget {
+        TEXTURE_1D       = GL_TEXTURE_1D,
+        TEXTURE_2D       = GL_TEXTURE_2D,
+        TEXTURE_2D_ARRAY = GL_TEXTURE_2D_ARRAY,
+    };
+    
+    // the channels in the pixel data - the layout in the texture comes from the element type as well
+    enum class TexturePixelFormat {
+        RED  = GL_RED,
+        RG   = GL_RG,
+        RGB  = GL_RGB,
+        RGBA = GL_RGBA,
+    };
+    
+    enum class TextureWrapMode {
+        REPEAT          = GL_REPEAT,
+        MIRRORED_REPEAT = GL_MIRRORED_REPEAT,
+        CLAMP_TO_EDGE   = GL_CLAMP_TO_EDGE,
+        CLAMP_TO_BORDER = GL_CLAMP_TO_BORDER,
+    };
+    
+    /* Pixel Data */
     /*----------------------------------------------------------------------------------------------*/
-    enum class ShaderObjectType
-    {
-        VERTEX_SHADER          = GL_VERTEX_SHADER,
-#if OPENGL_MAJOR_VERSION >= 4
-        TESS_CONTROL_SHADER    = GL_TESS_CONTROL_SHADER,
-        TESS_EVALUATION_SHADER = GL_TESS_EVALUATION_SHADER,
-#endif
-        GEOMETRY_SHADER        = GL_GEOMETRY_SHADER,
-        FRAGMENT_SHADER        = GL_FRAGMENT_SHADER,
-#if OPENGL_MAJOR_VERSION >= 4 && OPENGL_MINOR_VERSION >= 3
-        COMPUTE_SHADER         = GL_COMPUTE_SHADER
-#endif
+    /*
+     maps a pixel element type to its gl type. 8 and 16 bit integers are normalized in the shader
+     (unsigned to [0, 1], signed to [-1, 1]), 32 bit integers are integer textures read with (u)samplers.
+     */
+    template<typename T>
+    struct TexturePixelType {
+        static_assert(sizeof(T) == 0, "unsupported pixel type - use float, (u)int8_t, (u)int16_t or (u)int32_t");
+    };
+    
+    template<> struct TexturePixelType<float>    { static constexpr GLenum type = GL_FLOAT;          };
+    template<> struct TexturePixelType<uint8_t>  { static constexpr GLenum type = GL_UNSIGNED_BYTE;  };
+    template<> struct TexturePixelType<int8_t>   { static constexpr GLenum type = GL_BYTE;           };
+    template<> struct TexturePixelType<uint16_t> { static constexpr GLenum type = GL_UNSIGNED_SHORT; };
+    template<> struct TexturePixelType<int16_t>  { static constexpr GLenum type = GL_SHORT;          };
+    template<> struct TexturePixelType<uint32_t> { static constexpr GLenum type = GL_UNSIGNED_INT;   };
+    template<> struct TexturePixelType<int32_t>  { static constexpr GLenum type = GL_INT;            };
+    
+    constexpr GLint texturePixelComponents(TexturePixelFormat format) {
+        return format == TexturePixelFormat::RED ? 1
+             : format == TexturePixelFormat::RG  ? 2
+             : format == TexturePixelFormat::RGB ? 3
+             : 4;
+    }
+    
+    constexpr bool textureIsInteger(GLenum type) {
+        return type == GL_UNSIGNED_INT || type == GL_INT;
+    }
+    
+    // sized internal format for a gl type and channel count
+    constexpr GLenum textureInternalFormat(GLenum type, TexturePixelFormat format) {
+        return type == GL_FLOAT ?
+                   (format == TexturePixelFormat::RED ? GL_R32F : format == TexturePixelFormat::RG ? GL_RG32F : format == TexturePixelFormat::RGB ? GL_RGB32F : GL_RGBA32F)
+             : type == GL_UNSIGNED_BYTE ?
+                   (format == TexturePixelFormat::RED ? GL_R8 : format == TexturePixelFormat::RG ? GL_RG8 : format == TexturePixelFormat::RGB ? GL_RGB8 : GL_RGBA8)
+             : type == GL_BYTE ?
+                   (format == TexturePixelFormat::RED ? GL_R8_SNORM : format == TexturePixelFormat::RG ? GL_RG8_SNORM : format == TexturePixelFormat::RGB ? GL_RGB8_SNORM : GL_RGBA8_SNORM)
+             : type == GL_UNSIGNED_SHORT ?
+                   (format == TexturePixelFormat::RED ? GL_R16 : format == TexturePixelFormat::RG ? GL_RG16 : format == TexturePixelFormat::RGB ? GL_RGB16 : GL_RGBA16)
+             : type == GL_SHORT ?
+                   (format == TexturePixelFormat::RED ? GL_R16_SNORM : format == TexturePixelFormat::RG ? GL_RG16_SNORM : format == TexturePixelFormat::RGB ? GL_RGB16_SNORM : GL_RGBA16_SNORM)
+             : type == GL_UNSIGNED_INT ?
+                   (format == TexturePixelFormat::RED ? GL_R32UI : format == TexturePixelFormat::RG ? GL_RG32UI : format == TexturePixelFormat::RGB ? GL_RGB32UI : GL_RGBA32UI)
+             :     (format == TexturePixelFormat::RED ? GL_R32I : format == TexturePixelFormat::RG ? GL_RG32I : format == TexturePixelFormat::RGB ? GL_RGB32I : GL_RGBA32I);
+    }
+    
+    constexpr size_t textureTypeSize(GLenum type) {
+        return type == GL_UNSIGNED_BYTE || type == GL_BYTE ? 1
+             : type == GL_UNSIGNED_SHORT || type == GL_SHORT ? 2
+             : 4;
+    }
+    
+    // the format passed to glTex(Sub)Image - integer textures need the _INTEGER variants
+    constexpr GLenum textureTransferFormat(GLenum type, TexturePixelFormat format) {
+        return !textureIsInteger(type) ? static_cast<GLenum>(format)
+             : format == TexturePixelFormat::RED ? GL_RED_INTEGER
+             : format == TexturePixelFormat::RG  ? GL_RG_INTEGER
+             : format == TexturePixelFormat::RGB ? GL_RGB_INTEGER
+             : GL_RGBA_INTEGER;
+    }
+    
+    /*
+     a view of pixels owned by the caller - nothing is copied, gl reads straight from the memory during the
+     upload so it only has to stay alive for the duration of the create/update call.
+     */
+    template<typename T>
+    class TexturePixelData {
+    public:
+        static constexpr GLenum type = TexturePixelType<T>::type;
+        
+        TexturePixelData(T const * pixels, size_t count)
+        : m_data(pixels)
+        , m_count(count)
+        {}
+        
+        TexturePixelData(std::vector<T> const & pixels)
+        : m_data(pixels.data())
+        , m_count(pixels.size())
+        {}
+        
+        template<size_t Count>
+        TexturePixelData(std::array<T, Count> const & pixels)
+        : m_data(pixels.data())
+        , m_count(Count)
+        {}
+        
+        T const * data() const { return m_data;  }
+        size_t    size() const { return m_count; }
+    
+    private:
+        T const * m_data;
+        size_t    m_count;
+    };
+    
+    template<typename T>
+    TexturePixelData<T> pixelData(T const * pixels, size_t count) {
+        return TexturePixelData<T>(pixels, count);
+    }
+    
+    /* Compressed Formats */
+    /*----------------------------------------------------------------------------------------------*/
+    // what the texture holds - selectCompressedFormat() picks the block format from it
+    enum class TextureCompressionUsage {
+        COLOUR,         // opaque rgb
+        COLOUR_ALPHA,   // rgba
+        SINGLE_CHANNEL, // masks, height maps
+        NORMAL_MAP,     // x and y, z is rebuilt in the shader
     };
     
-    class ShaderObject
-    {
-        friend class OpenglShaderLayer;
+    constexpr GLenum textureCompressedFormat(BlockFormat format) {
+        return format == BlockFormat::BC1_RGB   ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+             : format == BlockFormat::BC3_RGBA  ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+             : format == BlockFormat::BC4_R     ? GL_COMPRESSED_RED_RGTC1
+             : format == BlockFormat::BC5_RG    ? GL_COMPRESSED_RG_RGTC2
+             : format == BlockFormat::BC7_RGBA  ? GL_COMPRESSED_RGBA_BPTC_UNORM
+             : format == BlockFormat::ETC2_RGB  ? GL_COMPRESSED_RGB8_ETC2
+             : format == BlockFormat::ETC2_RGBA ? GL_COMPRESSED_RGBA8_ETC2_EAC
+             : format == BlockFormat::EAC_R     ? GL_COMPRESSED_R11_EAC
+             : GL_COMPRESSED_RG11_EAC;
+    }
+    
+    class Texture {
+        friend class OpenglTextureLayer;
         friend class OpenglDrawLayer;
+        friend class DrawCommand;
+        friend class TextureStreamer;
+        friend class TextureAtlas;
     public:
-        ShaderObject()
-        :
-        m_id(OPENGL_INVALID_OBJECT),
-        m_type(ShaderObjectType::VERTEX_SHADER),
-        m_hasSource(false),
-        m_isCompiled(false)
-        {
-        }
+        Texture()
+        : m_id(OPENGL_INVALID_OBJECT)
+        , m_target(TextureTarget::TEXTURE_2D)
+        , m_format(TexturePixelFormat::RGBA)
+        , m_type(GL_UNSIGNED_BYTE)
+        , m_internalFormat(GL_RGBA8)
+        , m_width(0)
+        , m_height(0)
+        , m_layers(0)
+        , m_levels(0)
+        , m_blockFormat(BlockFormat::BC1_RGB)
+        , m_generation(0)
+        {}
         
-        //TODO make opporators only visable to OpenglLayer
-        bool operator==(ShaderObject const & rhs) { return(this->m_id == rhs.m_id); }
-        bool operator!=(ShaderObject const & rhs) { return(!(this->m_id == rhs.m_id)); }
+        bool operator==(Texture const & rhs) { return(this->m_id == rhs.m_id); }
+        bool operator!=(Texture const & rhs) { return(!(this->m_id == rhs.m_id)); }
         operator int() const { return m_id; }
         
+        GLsizei getWidth() const          { return m_width;          }
+        GLsizei getHeight() const         { return m_height;         }
+        GLsizei getLayers() const         { return m_layers;         }
+        GLsizei getLevels() const         { return m_levels;         }
+        GLenum  getInternalFormat() const { return m_internalFormat; }
+        bool    isCompressed() const      { return m_type == GL_NONE;    }
+    
     private:
-        GLuint           m_id;
-        ShaderObjectType m_type;
-        bool             m_hasSource;
-        bool             m_isCompiled;
+        GLuint             m_id;
+        TextureTarget      m_target;
+        TexturePixelFormat m_format;
+        GLenum             m_type;
+        GLenum             m_internalFormat;
+        GLsizei            m_width;
+        GLsizei            m_height; // 1 for 1d textures
+        GLsizei            m_layers; // 1 unless it is an array texture
+        GLsizei            m_levels;
+        BlockFormat        m_blockFormat; // only when m_type is GL_NONE
+        uint32_t           m_generation;  // tells a reused texture name apart from the texture that was deleted
     };
     
-    class ShaderProgram
-    {
-        friend class OpenglShaderLayer;
-        friend class OpenglDrawLayer;
+    /* Samplers */
+    /*----------------------------------------------------------------------------------------------*/
+    enum class TextureFilter {
+        NEAREST,   // no filtering and no mips - pixel art, integer textures
+        BILINEAR,  // linear inside the nearest mip level
+        TRILINEAR, // linear between mip levels as well
+    };
+    
+    struct SamplerDescription {
+        TextureFilter   filter;
+        TextureWrapMode wrapS;
+        TextureWrapMode wrapT;
+        TextureWrapMode wrapR;
+        uint8_t         anisotropy; // 0 follows the texture layer's anisotropy policy, 1 turns it off
+        
+        SamplerDescription(TextureFilter filterMode = TextureFilter::TRILINEAR, TextureWrapMode wrap = TextureWrapMode::REPEAT, uint8_t maxAnisotropy = 0)
+        : filter(filterMode)
+        , wrapS(wrap)
+        , wrapT(wrap)
+        , wrapR(wrap)
+        , anisotropy(maxAnisotropy)
+        {}
         
+        // the cache key - 2 bits a field and the anisotropy in the byte above
+        uint64_t pack() const {
+            return  static_cast<uint64_t>(filter)
+                 | (wrapIndex(wrapS) << 2)
+                 | (wrapIndex(wrapT) << 4)
+                 | (wrapIndex(wrapR) << 6)
+                 | (static_cast<uint64_t>(anisotropy) << 8);
+        }
+    
+    private:
+        static uint64_t wrapIndex(TextureWrapMode wrap) {
+            switch(wrap) {
+                case TextureWrapMode::REPEAT:          return 0;
+                case TextureWrapMode::MIRRORED_REPEAT: return 1;
+                case TextureWrapMode::CLAMP_TO_EDGE:   return 2;
+                case TextureWrapMode::CLAMP_TO_BORDER: return 3;
+            }
+            return 0;
+        }
+    };
+    
+    // a shared gl sampler object - owned by the texture layer, equal descriptions give the same sampler
+    class Sampler {
+        friend class OpenglTextureLayer;
+        friend class DrawCommand;
     public:
-        ShaderProgram()
-        :
-        m_id(OPENGL_INVALID_OBJECT),
-        m_linked(false)
-        {
+        Sampler()
+        : m_id(OPENGL_INVALID_OBJECT)
+        {}
+        
+        bool operator==(Sampler const & rhs) const { return m_id == rhs.m_id; }
+        bool operator!=(Sampler const & rhs) const { return m_id != rhs.m_id; }
+        operator int() const { return m_id; }
+    
+    private:
+        GLuint m_id;
+    };
+    
+    /* Texture Streaming */
+    /*----------------------------------------------------------------------------------------------*/
+    // staging memory for one upload - written by a worker thread and handed back with TextureStreamer::submitUpload()
+    struct StagingAllocation {
+        void *   data;
+        size_t   size;
+        uint32_t page;
+        size_t   offset;
+    };
+    
+    struct TextureStreamingStats {
+        size_t   bytesThisFrame;
+        size_t   uploadsThisFrame;
+        size_t   pendingUploads;
+        size_t   freePages;
+        uint64_t failedAllocations; // every page was in use - the worker has to try again later
+        uint64_t deferredUploads;   // uploads pushed to a later frame by the budget
+    };
+    
+    /*
+     background texture uploads through a pool of pixel buffer objects.
+     - allocateStaging(), submitUpload() and cancelStaging() are thread safe and meant for the threads that
+       decode images - the pixels are written straight into the pbo (persistently mapped with ARB_buffer_storage)
+     - OpenglTextureLayer::processTextureUploads() runs on the gl thread once a frame. it issues glTexSubImage
+       from the pbos, lowest resolution mip levels first, until the frame's byte budget is used up
+     - a page is bump allocated until it is full and then reused once its uploads are issued and the fence
+       placed after them has signalled
+     - the base level of a texture follows the levels that have arrived so it can be drawn as soon as its
+       smallest level is in - see getResidentLevel()
+     - without buffer storage the pages are plain memory and the uploads come from client memory
+     */
+    class TextureStreamer {
+        friend class OpenglTextureLayer;
+    public:
+        static constexpr uint32_t INVALID_PAGE = 0xFFFFFFFF;
+        
+        TextureStreamer()
+        : m_pageSize(0)
+        , m_currentPage(INVALID_PAGE)
+        , m_persistent(false)
+        , m_budget(0)
+        , m_sequence(0)
+        , m_stats()
+        {}
+        
+        TextureStreamer(TextureStreamer const &) = delete;
+        TextureStreamer & operator=(TextureStreamer const &) = delete;
+        
+        // bytes a width x height upload into texture needs
+        static size_t uploadSize(Texture const & texture, GLsizei width, GLsizei height = 1) {
+            assert(!texture.isCompressed() && "compressed textures can not be streamed");
+            return static_cast<size_t>(width) * static_cast<size_t>(height) * static_cast<size_t>(texturePixelComponents(texture.m_format)) * textureTypeSize(texture.m_type);
         }
         
-        //TODO make opporators only visable to OpenglLayer
-        bool operator==(ShaderProgram const & rhs) { return(this->m_id == rhs.m_id);}
-        bool operator!=(ShaderProgram const & rhs) { return(!(this->m_id == rhs.m_id));}
-        operator int() const { return m_id;}
+        // thread safe - data is nullptr when every page is in use
+        StagingAllocation allocateStaging(size_t size) {
+            assert(size > 0 && size <= m_pageSize && "upload does not fit in a staging page - increase the page size");
+            
+            const size_t alignment = 16;
+            
+            StagingAllocation allocation;
+            allocation.data   = nullptr;
+            allocation.size   = size;
+            allocation.page   = INVALID_PAGE;
+            allocation.offset = 0;
+            
+            std::lock_guard<std::mutex> lock(m_mutex);
+            
+            size_t start = 0;
+            if(m_currentPage != INVALID_PAGE) {
+                start = (m_pages[m_currentPage].offset + alignment - 1) & ~(alignment - 1);
+                if(start + size > m_pageSize) {
+                    m_pages[m_currentPage].closed = true;
+                    m_currentPage = INVALID_PAGE;
+                }
+            }
+            
+            if(m_currentPage == INVALID_PAGE) {
+                if(m_freePages.empty()) {
+                    m_stats.failedAllocations++;
+                    return allocation;
+                }
+                m_currentPage = m_freePages.back();
+                m_freePages.pop_back();
+                start = 0;
+            }
+            
+            StagingPage & page = m_pages[m_currentPage];
+            page.offset = start + size;
+            page.pending++;
+            
+            allocation.data   = page.memory + start;
+            allocation.page   = m_currentPage;
+            allocation.offset = start;
+            return allocation;
+        }
         
+        // thread safe - the staging memory belongs to the streamer from here on
+        void submitUpload(StagingAllocation const & staging, Texture const & texture, GLint level, GLint x, GLint y, GLsizei width, GLsizei height) {
+            assert(staging.data != nullptr && "staging allocation failed");
+            assert(texture != OPENGL_INVALID_OBJECT && "texture is in an invalid state");
+            assert(texture.m_target != TextureTarget::TEXTURE_2D_ARRAY && "array textures can not be streamed");
+            assert(level >= 0 && level < texture.m_levels && "mip level out of range");
+            assert(uploadSize(texture, width, height) <= staging.size && "staging allocation is too small for the upload");
+            
+            PendingUpload upload;
+            upload.texture = texture;
+            upload.level   = level;
+            upload.x       = x;
+            upload.y       = y;
+            upload.width   = width;
+            upload.height  = height;
+            upload.page    = staging.page;
+            upload.offset  = staging.offset;
+            
+            std::lock_guard<std::mutex> lock(m_mutex);
+            upload.sequence = m_sequence++;
+            m_pending.push_back(upload);
+        }
+        
+        // thread safe - gives back staging memory that will not be submitted, e.g. when decoding failed
+        void cancelStaging(StagingAllocation const & staging) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            assert(m_pages[staging.page].pending > 0 && "staging allocation was already released");
+            m_pages[staging.page].pending--;
+        }
+        
+        // gl thread - upper bound of bytes uploaded per processTextureUploads(), 0 is unlimited. one upload
+        // is always issued per frame so a level bigger than the budget still gets through
+        void setUploadBudget(size_t bytesPerFrame) {
+            m_budget = bytesPerFrame;
+        }
+        
+        // gl thread - the finest level that can be sampled, texture.getLevels() while nothing has arrived
+        GLint getResidentLevel(Texture const & texture) const {
+            auto search = m_residency.find(texture.m_id);
+            return search == m_residency.end() ? texture.m_levels : search->second.baseLevel;
+        }
+        
+        bool isPersistentlyMapped() const { return m_persistent; }
+        
+        // gl thread - counters for the last processTextureUploads()
+        TextureStreamingStats getStats() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            TextureStreamingStats stats = m_stats;
+            stats.pendingUploads = m_pending.size();
+            stats.freePages      = m_freePages.size();
+            return stats;
+        }
+    
     private:
-        GLuint                    m_id;
-        std::vector<ShaderObject> m_shaderObjects;
-        bool                      m_linked;
+        struct StagingPage {
+            GLuint               buffer;
+            uint8_t *            memory;  // the persistent mapping or fallback
+            std::vector<uint8_t> fallback;
+            size_t               offset;
+            size_t               pending; // allocated but not issued yet
+            bool                 closed;
+            bool                 used;    // uploads were issued from it this frame
+            GLsync               fence;
+        };
+        
+        struct PendingUpload {
+            Texture  texture;
+            GLint    level;
+            GLint    x;
+            GLint    y;
+            GLsizei  width;
+            GLsizei  height;
+            uint32_t page;
+            size_t   offset;
+            uint64_t sequence;
+        };
+        
+        struct Residency {
+            uint32_t levels;    // bit per level that has been uploaded
+            GLint    baseLevel;
+        };
+        
+        std::mutex                              m_mutex; // guards the pages' allocation state, the free list and the queue
+        std::vector<StagingPage>                m_pages;
+        std::vector<uint32_t>                   m_freePages;
+        std::vector<PendingUpload>              m_pending;
+        size_t                                  m_pageSize;
+        uint32_t                                m_currentPage;
+        bool                                    m_persistent;
+        size_t                                  m_budget;
+        uint64_t                                m_sequence;
+        std::unordered_map<GLuint, Residency>   m_residency;
+        TextureStreamingStats                   m_stats;
     };
     
-    class OpenglShaderLayer
-    {
+    /* Texture Atlas */
+    /*----------------------------------------------------------------------------------------------*/
+    /*
+     skyline bin packer - the packed area is described by its top edge (the skyline) and every rectangle goes
+     where its top ends up lowest, ties go to the narrowest segment so gaps fill before the skyline grows.
+     no opengl calls.
+     */
+    class SkylinePacker {
     public:
+        SkylinePacker()
+        : m_width(0)
+        , m_height(0)
+        , m_usedArea(0)
+        {}
         
-        OpenglShaderLayer()
-        :
-        m_initialised(false)
+        void reset(uint32_t width, uint32_t height) {
+            m_width    = width;
+            m_height   = height;
+            m_usedArea = 0;
+            m_skyline.assign(1, Segment{0, 0, width});
+        }
+        
+        bool insert(uint32_t width, uint32_t height, uint32_t & outX, uint32_t & outY) {
+            if(width == 0 || height == 0 || width > m_width || height > m_height) {
+                return false;
+            }
+            
+            size_t   best       = m_skyline.size();
+            uint32_t bestTop    = 0xFFFFFFFF;
+            uint32_t bestWidth  = 0xFFFFFFFF;
+            uint32_t bestY      = 0;
+            
+            for(size_t i = 0; i < m_skyline.size(); i++) {
+                uint32_t y;
+                if(!fits(i, width, height, y)) {
+                    continue;
+                }
+                
+                uint32_t top = y + height;
+                if(top < bestTop || (top == bestTop && m_skyline[i].width < bestWidth)) {
+                    best      = i;
+                    bestTop   = top;
+                    bestWidth = m_skyline[i].width;
+                    bestY     = y;
+                }
+            }
+            
+            if(best == m_skyline.size()) {
+                return false;
+            }
+            
+            outX = m_skyline[best].x;
+            outY = bestY;
+            place(best, width, height, bestY);
+            m_usedArea += uint64_t(width) * height;
+            return true;
+        }
+        
+        // packed area over total area
+        float getOccupancy() const {
+            return m_width == 0 || m_height == 0 ? 0.0f : float(double(m_usedArea) / (double(m_width) * m_height));
+        }
+    
+    private:
+        struct Segment {
+            uint32_t x;
+            uint32_t y;
+            uint32_t width;
+        };
+        
+        uint32_t             m_width;
+        uint32_t             m_height;
+        uint64_t             m_usedArea;
+        std::vector<Segment> m_skyline; // sorted by x and covering the whole width
+        
+        // the rectangle sits on the highest segment it spans when its left edge is at segment i
+        bool fits(size_t i, uint32_t width, uint32_t height, uint32_t & y) const {
+            if(m_skyline[i].x + width > m_width) {
+                return false;
+            }
+            
+            y = 0;
+            uint32_t remaining = width;
+            for(size_t j = i; remaining > 0; j++) {
+                y = std::max(y, m_skyline[j].y);
+                if(y + height > m_height) {
+                    return false;
+                }
+                remaining -= std::min(remaining, m_skyline[j].width);
+            }
+            return true;
+        }
+        
+        void place(size_t i, uint32_t width, uint32_t height, uint32_t y) {
+            Segment placed = {m_skyline[i].x, y + height, width};
+            m_skyline.insert(m_skyline.begin() + static_cast<std::ptrdiff_t>(i), placed);
+            
+            // trim or drop the segments now under the new one
+            size_t next = i + 1;
+            while(next < m_skyline.size()) {
+                uint32_t end = placed.x + placed.width;
+                if(m_skyline[next].x >= end) {
+                    break;
+                }
+                
+                uint32_t overlap = end - m_skyline[next].x;
+                if(overlap < m_skyline[next].width) {
+                    m_skyline[next].x     += overlap;
+                    m_skyline[next].width -= overlap;
+                    break;
+                }
+                m_skyline.erase(m_skyline.begin() + static_cast<std::ptrdiff_t>(next));
+            }
+            
+            // merge neighbours at the same height
+            for(size_t j = 0; j + 1 < m_skyline.size(); ) {
+                if(m_skyline[j].y == m_skyline[j + 1].y) {
+                    m_skyline[j].width += m_skyline[j + 1].width;
+                    m_skyline.erase(m_skyline.begin() + static_cast<std::ptrdiff_t>(j + 1));
+                } else {
+                    j++;
+                }
+            }
+        }
+    };
+    
+    /*
+     where an image ended up in a TextureAtlas. uv and layer are floats so they can be copied straight into an
+     instance record - see GLSL_ATTRIB_ATLAS_REGION_LOCATION and GLSL_ATTRIB_ATLAS_LAYER_LOCATION
+     */
+    struct AtlasRegion {
+        float    uv[4]; // u0, v0, u1, v1
+        float    layer;
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+        uint32_t height;
+    };
+    
+    /*
+     small 2d images packed into the layers of one GL_TEXTURE_2D_ARRAY. every draw that samples the atlas
+     binds the same texture, so commands that differ only in their region (passed as instance data) stay in
+     one state bucket and merge into one instanced draw.
+     */
+    class TextureAtlas {
+        friend class OpenglTextureLayer;
+    public:
+        TextureAtlas()
+        : m_padding(0)
         {}
         
-        ~OpenglShaderLayer() {
+        TextureAtlas(TextureAtlas const &) = delete;
+        TextureAtlas & operator=(TextureAtlas const &) = delete;
+        
+        Texture const & getTexture() const { return m_texture; }
+        size_t getLayerCount() const       { return m_packers.size(); }
+        
+        float getOccupancy(size_t layer) const {
+            return m_packers[layer].getOccupancy();
+        }
+    
+    private:
+        Texture                    m_texture;
+        std::vector<SkylinePacker> m_packers; // one per layer
+        GLsizei                    m_padding;
+    };
+    
+    class OpenglTextureLayer {
+    public:
+        OpenglTextureLayer()
+        : m_unpackAlignment(4)
+        , m_maxAnisotropy(1.0f)
+        , m_anisotropyPolicy(1.0f)
+        , m_textureGeneration(0)
+        , m_textureStorage(false)
+        , m_initialised(false)
+        {
+        }
+        
+        ~OpenglTextureLayer() {
             dispose();
         }
         
@@ -141,6 +730,11 @@ namespace glLayer
                 assert(false && "double init you noob");
                 return false;
             }
+            
+            m_unpackAlignment = 4; // gl default
+#if OPENGL_TEXTURE_STORAGE
+            m_textureStorage = contextSupports(4, 2, "GL_ARB_texture_storage");
+#endif
             m_initialised = true;
             return m_initialised;
         }
@@ -149,251 +743,794 @@ namespace glLayer
             if(!m_initialised) {
                 return;
             }
+            
+            for(auto & streamer : m_streamers) {
+                destroyTextureStreamer(*streamer);
+            }
+            m_streamers.clear();
+            
+            // the atlas textures are in m_textures
+            m_atlases.clear();
+            
+            for(auto & sampler : m_samplers) {
+                GL_CHECK(glDeleteSamplers(1, &sampler.second.id));
+            }
+            m_samplers.clear();
+            
+            for(auto const & texture : m_textures) {
+                GL_CHECK(glDeleteTextures(1, &texture.first));
+            }
+            m_textures.clear();
+            
             m_initialised = false;
         }
         
+        // number of levels in a full mip chain down to 1x1
+        static GLsizei mipLevelCount(GLsizei width, GLsizei height = 1) {
+            GLsizei levels = 1;
+            for(GLsizei size = std::max(width, height); size > 1; size >>= 1) {
+                levels++;
+            }
+            return levels;
+        }
+        
         /*
-         *Order of shader Program creation*
-         - create a shader progarm
-         - create a shader object
-         - compile shader object
-         - attach objects to program
-         - bind attrib locations ? optional
-         - link program
+         width pixels of format channels - pixels must hold at least width * channels elements.
+         level 0 is uploaded, the other levels are left for updateTexture1D()
          */
+        template<typename T>
+        Texture createTexture1D(TexturePixelData<T> const & pixels, GLsizei width, TexturePixelFormat format, TextureWrapMode wrapS, GLsizei levels = 1) {
+            Texture texture = allocateTexture1D<T>(width, format, wrapS, levels);
+            updateTexture1D(texture, pixels, 0, width);
+            return texture;
+        }
         
-        ShaderProgram createShaderProgram() const {
-            ShaderProgram shaderProgram;
-            
-            GL_CHECK(shaderProgram.m_id = glCreateProgram());
-            
-            // TODO: add program to program list - used for deleting at dispose time.
-            return shaderProgram;
+        template<typename T>
+        Texture createTexture1D(std::vector<T> const & pixels, GLsizei width, TexturePixelFormat format, TextureWrapMode wrapS, GLsizei levels = 1) {
+            return createTexture1D(TexturePixelData<T>(pixels), width, format, wrapS, levels);
         }
         
-        ShaderObject createShaderObject(ShaderObjectType const & type) const {
-            ShaderObject shaderObject;
-            
-            GL_CHECK(shaderObject.m_id = glCreateShader(static_cast<GLenum>(type))); // conversion used to restrist values passed to glCreateShader
-            
-            return shaderObject;
+        template<typename T>
+        Texture createTexture2D(TexturePixelData<T> const & pixels, GLsizei width, GLsizei height, TexturePixelFormat format, TextureWrapMode wrapS, TextureWrapMode wrapT, GLsizei levels = 1) {
+            Texture texture = allocateTexture2D<T>(width, height, format, wrapS, wrapT, levels);
+            updateTexture2D(texture, pixels, 0, 0, width, height);
+            return texture;
+        }
+        
+        template<typename T>
+        Texture createTexture2D(std::vector<T> const & pixels, GLsizei width, GLsizei height, TexturePixelFormat format, TextureWrapMode wrapS, TextureWrapMode wrapT, GLsizei levels = 1) {
+            return createTexture2D(TexturePixelData<T>(pixels), width, height, format, wrapS, wrapT, levels);
         }
         
-        void attachSourceToShaderObject(ShaderObject & object, std::string const & source) const {
-            // calling this multiple times in consession will overide the privious attached source - concatinate all source before calling this function
-            assert(object != OPENGL_INVALID_OBJECT && "shader object is in invalid state - the shader object must be created with createShaderObject()");
-            assert(!(source.empty()) && "source is empty");
+        // storage only - the contents are undefined until they are uploaded
+        template<typename T>
+        Texture allocateTexture1D(GLsizei width, TexturePixelFormat format, TextureWrapMode wrapS, GLsizei levels = 1) {
+            Texture texture = makeTexture(TextureTarget::TEXTURE_1D, TexturePixelType<T>::type, format, width, 1, levels);
             
-            const GLchar* shaderSourceStrings[1];
-            GLint shaderSourceStringLengths[1];
+            GL_CHECK(glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, static_cast<GLint>(wrapS)));
+            allocateStorage(texture);
             
-            shaderSourceStrings[0] = source.c_str();
-            shaderSourceStringLengths[0] = static_cast<GLint>(source.length());
+            return texture;
+        }
+        
+        template<typename T>
+        Texture allocateTexture2D(GLsizei width, GLsizei height, TexturePixelFormat format, TextureWrapMode wrapS, TextureWrapMode wrapT, GLsizei levels = 1) {
+            Texture texture = makeTexture(TextureTarget::TEXTURE_2D, TexturePixelType<T>::type, format, width, height, levels);
             
-            GL_CHECK(glShaderSource(object, 1, shaderSourceStrings, shaderSourceStringLengths));
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, static_cast<GLint>(wrapS)));
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, static_cast<GLint>(wrapT)));
+            allocateStorage(texture);
             
-            object.m_hasSource = true;
+            return texture;
         }
         
-        void compileShaderObject(ShaderObject & object) const {
-            assert(object != OPENGL_INVALID_OBJECT && "the shader object being compiled is in an invald state");
-            assert((!(object.m_isCompiled))        && "the shader object being compiled is allready compiled");
-            assert(object.m_hasSource              && "the shader object has no source code to compile");
-            //assert(shaderObject.type == ShaderObjectType::INVALID); TODO: check this out
+        // replaces width pixels starting at x in a level - the element type and format must match the texture
+        template<typename T>
+        void updateTexture1D(Texture const & texture, TexturePixelData<T> const & pixels, GLint x, GLsizei width, GLint level = 0) {
+            checkUpload(texture, TextureTarget::TEXTURE_1D, TexturePixelType<T>::type, pixels.size(), width, 1, level);
             
-            GL_CHECK(glCompileShader(object));
+            setUnpackAlignment(static_cast<size_t>(width) * texturePixelComponents(texture.m_format) * sizeof(T));
+            GL_CHECK(glBindTexture(GL_TEXTURE_1D, texture.m_id));
+            GL_CHECK(glTexSubImage1D(GL_TEXTURE_1D, level, x, width, textureTransferFormat(texture.m_type, texture.m_format), texture.m_type, pixels.data()));
+        }
+        
+        // replaces a width x height rectangle of a level - pixels are tightly packed rows
+        template<typename T>
+        void updateTexture2D(Texture const & texture, TexturePixelData<T> const & pixels, GLint x, GLint y, GLsizei width, GLsizei height, GLint level = 0) {
+            checkUpload(texture, TextureTarget::TEXTURE_2D, TexturePixelType<T>::type, pixels.size(), width, height, level);
             
-            GLint isCompiled = GL_FALSE;
+            setUnpackAlignment(static_cast<size_t>(width) * texturePixelComponents(texture.m_format) * sizeof(T));
+            GL_CHECK(glBindTexture(GL_TEXTURE_2D, texture.m_id));
+            GL_CHECK(glTexSubImage2D(GL_TEXTURE_2D, level, x, y, width, height, textureTransferFormat(texture.m_type, texture.m_format), texture.m_type, pixels.data()));
+        }
+        
+        void deleteTexture(Texture & texture) {
+            auto search = m_textures.find(texture.m_id);
             
-            GL_CHECK(glGetShaderiv(object,GL_COMPILE_STATUS, &isCompiled));
+            // a stale copy must not delete the texture that got its name since
+            if(search != m_textures.end() && search->second == texture.m_generation) {
+                for(auto & streamer : m_streamers) {
+                    forgetStreamedTexture(*streamer, texture.m_id);
+                }
+                GL_CHECK(glDeleteTextures(1, &texture.m_id));
+                m_textures.erase(search);
+                texture.m_id = OPENGL_INVALID_OBJECT;
+            } else {
+                std::cout << "deleteTexture: texture not found D:" << std::endl;
+            }
+        }
+        
+        /* Samplers */
+        /*------------------------------------------------------------------------------------------*/
+        /*
+         the sampler for a description - created the first time it is asked for and shared after that, so any number
+         of materials with the same settings cost one sampler. the samplers live until dispose().
+         */
+        Sampler getSampler(SamplerDescription const & description) {
+            assert(m_initialised && "texture layer must be initialised before creating samplers");
             
-            if(isCompiled == GL_FALSE) {
-                GLint maxLength = 0;
-                GL_CHECK(glGetShaderiv(object, GL_INFO_LOG_LENGTH, &maxLength)); // get the length of the error
-                GLchar error[maxLength];  //The maxLength includes the NULL character
-                
-                GL_CHECK(glGetShaderInfoLog(object, maxLength, &maxLength, error)); // populate the error array with the error string
+            uint64_t key = description.pack();
+            auto search = m_samplers.find(key);
+            if(search == m_samplers.end()) {
+                CachedSampler cached;
+                cached.description = description;
+                GL_CHECK(glGenSamplers(1, &cached.id));
                 
-                printf("%s", error);
+                GLint minFilter = description.filter == TextureFilter::NEAREST  ? GL_NEAREST
+                                : description.filter == TextureFilter::BILINEAR ? GL_LINEAR_MIPMAP_NEAREST
+                                : GL_LINEAR_MIPMAP_LINEAR;
+                GLint magFilter = description.filter == TextureFilter::NEAREST ? GL_NEAREST : GL_LINEAR;
                 
-                GL_CHECK(glDeleteShader(object)); // Don't leak the shader.
-                
-                object.m_isCompiled = false;
-                
-                return;
+                GL_CHECK(glSamplerParameteri(cached.id, GL_TEXTURE_MIN_FILTER, minFilter));
+                GL_CHECK(glSamplerParameteri(cached.id, GL_TEXTURE_MAG_FILTER, magFilter));
+                GL_CHECK(glSamplerParameteri(cached.id, GL_TEXTURE_WRAP_S, static_cast<GLint>(description.wrapS)));
+                GL_CHECK(glSamplerParameteri(cached.id, GL_TEXTURE_WRAP_T, static_cast<GLint>(description.wrapT)));
+                GL_CHECK(glSamplerParameteri(cached.id, GL_TEXTURE_WRAP_R, static_cast<GLint>(description.wrapR)));
+                applyAnisotropy(cached);
+                labelObject(DebugObject::SAMPLER, cached.id, "sampler");
                 
+                search = m_samplers.insert(std::make_pair(key, cached)).first;
             }
-            object.m_isCompiled = true;
+            
+            Sampler sampler;
+            sampler.m_id = search->second.id;
+            return sampler;
         }
         
-        void attachShaderObjectToProgram(ShaderProgram & program, ShaderObject const & object) const {
-            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
-            assert(object  != OPENGL_INVALID_OBJECT && "shader object is in an invalid state");
-            assert(object.m_isCompiled && "shader object is not compiled");
-            
-            auto find = std::find(program.m_shaderObjects.begin(), program.m_shaderObjects.end(),object);
+        /*
+         the anisotropy every sampler with anisotropy 0 uses - the quality setting. it and any explicit anisotropy are
+         clamped to what the driver reports, so anisotropic filtering stays off until this has been called.
+         samplers that already exist are updated.
+         */
+        float setAnisotropyPolicy(float anisotropy, OpenglInformationLayer const & info) {
+            m_maxAnisotropy    = std::max(1.0f, info.getMaxAnisotropy());
+            m_anisotropyPolicy = std::min(std::max(anisotropy, 1.0f), m_maxAnisotropy);
             
-            if(find == program.m_shaderObjects.end()) {
-                GL_CHECK(glAttachShader(program, object));
-                program.m_shaderObjects.push_back(object);
-            } else {
-                // object is allready attatched
+            for(auto & sampler : m_samplers) {
+                applyAnisotropy(sampler.second);
             }
+            return m_anisotropyPolicy;
+        }
+        
+        float getAnisotropyPolicy() const {
+            return m_anisotropyPolicy;
+        }
+        
+        size_t getSamplerCount() const {
+            return m_samplers.size();
         }
         
-        void detachShaderObjectFromProgram(ShaderProgram & program, ShaderObject const & object) const {
-            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
-            assert(object  != OPENGL_INVALID_OBJECT && "shader object is in an invalid state");
+        /* Compressed Textures */
+        /*------------------------------------------------------------------------------------------*/
+        /*
+         s3tc is an extension everywhere, rgtc is core since 3.0, bptc since 4.2 and etc2/eac since 4.3 - drivers
+         older than that can still report them as extensions
+         */
+        static bool isCompressedFormatSupported(OpenglInformationLayer const & info, BlockFormat format) {
+            switch(format) {
+                case BlockFormat::BC1_RGB:
+                case BlockFormat::BC3_RGBA:
+                    return info.hasExtension("GL_EXT_texture_compression_s3tc");
+                case BlockFormat::BC4_R:
+                case BlockFormat::BC5_RG:
+                    return info.isVersionAtLeast(3, 0) || info.hasExtension("GL_ARB_texture_compression_rgtc");
+                case BlockFormat::BC7_RGBA:
+                    return info.isVersionAtLeast(4, 2) || info.hasExtension("GL_ARB_texture_compression_bptc");
+                case BlockFormat::ETC2_RGB:
+                case BlockFormat::ETC2_RGBA:
+                case BlockFormat::EAC_R:
+                case BlockFormat::EAC_RG:
+                    return info.isVersionAtLeast(4, 3) || info.hasExtension("GL_ARB_ES3_compatibility");
+            }
+            return false;
+        }
+        
+        /*
+         the smallest supported format that suits the usage, false when there is none and the texture should stay
+         uncompressed. bc comes first - desktop drivers that report etc2 usually decode it on the cpu and store it
+         uncompressed. encodableOnly leaves out etc2/eac, which TextureCompressor can not produce.
+         */
+        static bool selectCompressedFormat(OpenglInformationLayer const & info, TextureCompressionUsage usage, BlockFormat & format, bool encodableOnly = true) {
+            std::vector<BlockFormat> candidates;
             
-            auto find = std::find(program.m_shaderObjects.begin(), program.m_shaderObjects.end(),object);
+            switch(usage) {
+                case TextureCompressionUsage::COLOUR:         candidates = { BlockFormat::BC1_RGB,  BlockFormat::BC7_RGBA, BlockFormat::ETC2_RGB  }; break;
+                case TextureCompressionUsage::COLOUR_ALPHA:   candidates = { BlockFormat::BC7_RGBA, BlockFormat::BC3_RGBA, BlockFormat::ETC2_RGBA }; break;
+                case TextureCompressionUsage::SINGLE_CHANNEL: candidates = { BlockFormat::BC4_R,    BlockFormat::EAC_R  };                         break;
+                case TextureCompressionUsage::NORMAL_MAP:     candidates = { BlockFormat::BC5_RG,   BlockFormat::EAC_RG };                         break;
+            }
             
-            if(find != program.m_shaderObjects.end()) {
-                GL_CHECK(glDetachShader(program,object));
-                program.m_shaderObjects.erase(find);
-            } else {
-                // program doesnt contain shader object
+            for(auto candidate : candidates) {
+                if((!encodableOnly || TextureCompressor::isEncodable(candidate)) && isCompressedFormatSupported(info, candidate)) {
+                    format = candidate;
+                    return true;
+                }
             }
+            return false;
         }
         
-        void detachAllShaderObjectsFromProgram(ShaderProgram & program) const {
-            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
+        // storage only - fill the levels with updateCompressedTexture2D()
+        Texture allocateCompressedTexture2D(BlockFormat format, GLsizei width, GLsizei height, TextureWrapMode wrapS, TextureWrapMode wrapT, GLsizei levels = 1) {
+            Texture texture = makeTexture(TextureTarget::TEXTURE_2D, GL_NONE, TexturePixelFormat::RGBA, width, height, levels);
+            texture.m_internalFormat = textureCompressedFormat(format);
+            texture.m_blockFormat    = format;
+            
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, static_cast<GLint>(wrapS)));
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, static_cast<GLint>(wrapT)));
+            allocateStorage(texture);
+            
+            return texture;
+        }
+        
+        // blocks is level 0, e.g. the result of TextureCompressor::compress()
+        Texture createCompressedTexture2D(BlockFormat format, void const * blocks, size_t size, GLsizei width, GLsizei height, TextureWrapMode wrapS, TextureWrapMode wrapT, GLsizei levels = 1) {
+            Texture texture = allocateCompressedTexture2D(format, width, height, wrapS, wrapT, levels);
+            updateCompressedTexture2D(texture, blocks, size, 0, 0, width, height);
+            return texture;
+        }
+        
+        /*
+         replaces a width x height rectangle of a level. x and y are multiples of 4, so are width and height unless
+         the rectangle reaches the edge of the level. blocks are tightly packed rows of blocks.
+         */
+        void updateCompressedTexture2D(Texture const & texture, void const * blocks, size_t size, GLint x, GLint y, GLsizei width, GLsizei height, GLint level = 0) {
+            assert(texture != OPENGL_INVALID_OBJECT && "texture is in an invalid state");
+            assert(texture.isCompressed() && "texture is not block compressed - use updateTexture2D()");
+            assert(level >= 0 && level < texture.m_levels && "mip level out of range");
+            assert(x % 4 == 0 && y % 4 == 0 && "compressed uploads start on a block boundary");
+            
+            size_t expected = TextureCompressor::compressedSize(texture.m_blockFormat, static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+            assert(size >= expected && "not enough block data for the upload");
+            (void)size;
+            
+            GL_CHECK(glBindTexture(GL_TEXTURE_2D, texture.m_id));
+            GL_CHECK(glCompressedTexSubImage2D(GL_TEXTURE_2D, level, x, y, width, height, texture.m_internalFormat, static_cast<GLsizei>(expected), blocks));
+        }
+        
+        /*
+         every level of a container, uploaded straight from its mapping - the driver copies the blocks during the
+         call so the container can be closed afterwards. returns an invalid texture when the driver does not
+         support the format.
+         */
+        Texture createTexture(TextureContainer const & container, OpenglInformationLayer const & info, TextureWrapMode wrapS, TextureWrapMode wrapT) {
+            assert(container.isOpen() && "container is not open");
+            
+            if(!isCompressedFormatSupported(info, container.getFormat())) {
+                std::cout << "createTexture: the driver does not support the container's format D:" << std::endl;
+                return Texture();
+            }
             
-            for(auto i = program.m_shaderObjects.begin(); i < program.m_shaderObjects.end(); i++) {
-                GL_CHECK(glDetachShader(program,i->m_id));
-                program.m_shaderObjects.erase(i);
+            GLsizei width  = static_cast<GLsizei>(container.getWidth());
+            GLsizei height = static_cast<GLsizei>(container.getHeight());
+            GLsizei levels = std::min(static_cast<GLsizei>(container.getLevelCount()), mipLevelCount(width, height));
+            
+            Texture texture = allocateCompressedTexture2D(container.getFormat(), width, height, wrapS, wrapT, levels);
+            
+            for(GLsizei level = 0; level < levels; level++) {
+                size_t size = 0;
+                uint8_t const * blocks = container.getLevelData(static_cast<uint32_t>(level), size);
+                updateCompressedTexture2D(texture, blocks, size, 0, 0, std::max(1, width >> level), std::max(1, height >> level), level);
             }
+            
+            return texture;
         }
         
-        void detachAndDeleteShaderObjectFromProgram(ShaderProgram & program, ShaderObject const & object) const {
-            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
-            assert(object  != OPENGL_INVALID_OBJECT && "shader object is in an invalid state");
-            //TODO: maybe some weird things happening if trying to detach something that isnt attached
+        /*
+         creates a streamer with pageCount staging pages of pageSize bytes - a single upload has to fit in a page.
+         the returned reference stays valid until deleteTextureStreamer() or dispose().
+         
+         worker thread:
+         - allocateStaging(TextureStreamer::uploadSize(texture, width, height)), retry later if data is nullptr
+         - decode straight into StagingAllocation::data
+         - submitUpload()
+         
+         gl thread, once a frame:
+         - processTextureUploads()
+         */
+        TextureStreamer & createTextureStreamer(size_t pageSize, uint32_t pageCount, OpenglInformationLayer const & info) {
+            assert(pageSize > 0 && pageCount > 0 && "streamer needs at least one page");
+            
+            m_streamers.emplace_back(new TextureStreamer());
+            TextureStreamer & streamer = *m_streamers.back();
+            
+            streamer.m_pageSize = pageSize;
+            streamer.m_pages.resize(pageCount);
+
+            // a 4.1 build still maps the pages persistently when the driver has buffer storage
+#if OPENGL_VERSION_AT_LEAST(4, 4) || defined(GL_ARB_buffer_storage)
+            streamer.m_persistent = info.isVersionAtLeast(4, 4) || info.hasExtension("GL_ARB_buffer_storage");
+#else
+            (void)info;
+#endif
+            
+            for(uint32_t i = 0; i < pageCount; i++) {
+                TextureStreamer::StagingPage & page = streamer.m_pages[i];
+                page.buffer  = OPENGL_INVALID_OBJECT;
+                page.memory  = nullptr;
+                page.offset  = 0;
+                page.pending = 0;
+                page.closed  = false;
+                page.used    = false;
+                page.fence   = nullptr;
+
+#if OPENGL_VERSION_AT_LEAST(4, 4) || defined(GL_ARB_buffer_storage)
+                if(streamer.m_persistent) {
+                    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                    GL_CHECK(glGenBuffers(1, &page.buffer));
+                    GL_CHECK(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, page.buffer));
+                    labelObject(DebugObject::BUFFER, page.buffer, "texture streamer page");
+                    GL_CHECK(glBufferStorage(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(pageSize), NULL, flags));
+                    GL_CHECK(page.memory = static_cast<uint8_t *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(pageSize), flags)));
+                    GL_CHECK(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+                }
+#endif
+                if(page.memory == nullptr) {
+                    page.fallback.resize(pageSize);
+                    page.memory = page.fallback.data();
+                }
+                
+                // hand the pages out from the front
+                streamer.m_freePages.push_back(pageCount - 1 - i);
+            }
             
-            auto find = std::find(program.m_shaderObjects.begin(), program.m_shaderObjects.end(),object);
+            return streamer;
+        }
+        
+        void deleteTextureStreamer(TextureStreamer & streamer) {
+            auto search = std::find_if(m_streamers.begin(), m_streamers.end(), [&streamer](std::unique_ptr<TextureStreamer> const & owned) {
+                return owned.get() == &streamer;
+            });
             
-            if(find != program.m_shaderObjects.end()) {
-                GL_CHECK(glDetachShader(program,object));
-                GL_CHECK(glDeleteShader(object));
-                program.m_shaderObjects.erase(find);
+            if(search != m_streamers.end()) {
+                destroyTextureStreamer(streamer);
+                m_streamers.erase(search);
             } else {
-                // program doesnt contain the specified shader object
+                std::cout << "deleteTextureStreamer: streamer not found D:" << std::endl;
             }
         }
         
-        void detachAndDeleteAllShaderObjectsFromProgram(ShaderProgram & program) const {
-            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
+        /*
+         an array texture of layers width x height layers that images are packed into with addToAtlas().
+         padding pixels around every image repeat its edge so linear filtering does not pick up the neighbours.
+         the atlas has a single mip level. the returned reference stays valid until deleteTextureAtlas() or dispose().
+         */
+        template<typename T>
+        TextureAtlas & createTextureAtlas(GLsizei width, GLsizei height, GLsizei layers, TexturePixelFormat format, GLsizei padding = 1) {
+            assert(layers > 0 && "atlas needs at least one layer");
+            assert(padding >= 0 && "padding can not be negative");
             
-            for(auto i = program.m_shaderObjects.begin(); i < program.m_shaderObjects.end(); i++) {
-                GL_CHECK(glDetachShader(program,i->m_id));
-                GL_CHECK(glDeleteShader(i->m_id));
-                program.m_shaderObjects.erase(i);
+            m_atlases.emplace_back(new TextureAtlas());
+            TextureAtlas & atlas = *m_atlases.back();
+            
+            atlas.m_texture = makeTexture(TextureTarget::TEXTURE_2D_ARRAY, TexturePixelType<T>::type, format, width, height, 1, layers);
+            atlas.m_padding = padding;
+            
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+            GL_CHECK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+            allocateStorage(atlas.m_texture);
+            
+            atlas.m_packers.resize(static_cast<size_t>(layers));
+            for(auto & packer : atlas.m_packers) {
+                packer.reset(static_cast<uint32_t>(width), static_cast<uint32_t>(height));
             }
+            
+            return atlas;
         }
         
-        void linkProgram(ShaderProgram & program, bool deleteShaderObjects = true) {
-            assert(program != OPENGL_INVALID_OBJECT && "shader program is in an invalid state");
+        /*
+         packs a width x height image into the first layer with room and uploads it. returns false when no layer
+         has room - the atlas is left unchanged.
+         */
+        template<typename T>
+        bool addToAtlas(TextureAtlas & atlas, TexturePixelData<T> const & pixels, GLsizei width, GLsizei height, AtlasRegion & region) {
+            Texture const & texture = atlas.m_texture;
+            assert(texture.m_type == TexturePixelType<T>::type && "pixel data type does not match the atlas");
+            assert(pixels.size() >= static_cast<size_t>(width) * static_cast<size_t>(height) * static_cast<size_t>(texturePixelComponents(texture.m_format)) && "not enough pixel data for the upload");
             
-            // check to see if program contains any objects
-            // if contains object check to see if they are valid
-            // if valid link program
+            const GLsizei padding = atlas.m_padding;
+            uint32_t x = 0;
+            uint32_t y = 0;
+            size_t   layer = 0;
+            
+            for(; layer < atlas.m_packers.size(); layer++) {
+                if(atlas.m_packers[layer].insert(static_cast<uint32_t>(width + padding * 2), static_cast<uint32_t>(height + padding * 2), x, y)) {
+                    break;
+                }
+            }
+            
+            if(layer == atlas.m_packers.size()) {
+                return false;
+            }
+            
+            GLint left = static_cast<GLint>(x) + padding;
+            GLint top  = static_cast<GLint>(y) + padding;
+            GLint z    = static_cast<GLint>(layer);
+            
+            GLenum      format = textureTransferFormat(texture.m_type, texture.m_format);
+            const size_t pixel = static_cast<size_t>(texturePixelComponents(texture.m_format));
+            T const *   data   = pixels.data();
+            
+            // a row length lets the edge columns be read in place
+            setUnpackAlignment(static_cast<size_t>(width) * pixel * sizeof(T));
+            GL_CHECK(glPixelStorei(GL_UNPACK_ROW_LENGTH, width));
+            GL_CHECK(glBindTexture(GL_TEXTURE_2D_ARRAY, texture.m_id));
+            GL_CHECK(glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, left, top, z, width, height, 1, format, texture.m_type, data));
+            
+            T const * lastRow    = data + static_cast<size_t>(height - 1) * width * pixel;
+            T const * lastColumn = data + static_cast<size_t>(width - 1) * pixel;
+            
+            for(GLint i = 1; i <= padding; i++) {
+                GL_CHECK(glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, left, top - i,              z, width, 1, 1, format, texture.m_type, data));
+                GL_CHECK(glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, left, top + height - 1 + i, z, width, 1, 1, format, texture.m_type, lastRow));
+                GL_CHECK(glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, left - i,             top, z, 1, height, 1, format, texture.m_type, data));
+                GL_CHECK(glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, left + width - 1 + i, top, z, 1, height, 1, format, texture.m_type, lastColumn));
+                
+                for(GLint j = 1; j <= padding; j++) {
+                    GL_CHECK(glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, left - i,             top - j,              z, 1, 1, 1, format, texture.m_type, data));
+                    GL_CHECK(glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, left + width - 1 + i, top - j,              z, 1, 1, 1, format, texture.m_type, lastColumn));
+                    GL_CHECK(glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, left - i,             top + height - 1 + j, z, 1, 1, 1, format, texture.m_type, lastRow));
+                    GL_CHECK(glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, left + width - 1 + i, top + height - 1 + j, z, 1, 1, 1, format, texture.m_type, lastRow + static_cast<size_t>(width - 1) * pixel));
+                }
+            }
+            GL_CHECK(glPixelStorei(GL_UNPACK_ROW_LENGTH, 0));
+            
+            region.uv[0]  = float(left)          / float(texture.m_width);
+            region.uv[1]  = float(top)           / float(texture.m_height);
+            region.uv[2]  = float(left + width)  / float(texture.m_width);
+            region.uv[3]  = float(top  + height) / float(texture.m_height);
+            region.layer  = float(layer);
+            region.x      = static_cast<uint32_t>(left);
+            region.y      = static_cast<uint32_t>(top);
+            region.width  = static_cast<uint32_t>(width);
+            region.height = static_cast<uint32_t>(height);
+            return true;
+        }
+        
+        template<typename T>
+        bool addToAtlas(TextureAtlas & atlas, std::vector<T> const & pixels, GLsizei width, GLsizei height, AtlasRegion & region) {
+            return addToAtlas(atlas, TexturePixelData<T>(pixels), width, height, region);
+        }
+        
+        // forgets every region - the pixels stay until they are overwritten
+        void clearTextureAtlas(TextureAtlas & atlas) const {
+            for(auto & packer : atlas.m_packers) {
+                packer.reset(static_cast<uint32_t>(atlas.m_texture.m_width), static_cast<uint32_t>(atlas.m_texture.m_height));
+            }
+        }
+        
+        void deleteTextureAtlas(TextureAtlas & atlas) {
+            auto search = std::find_if(m_atlases.begin(), m_atlases.end(), [&atlas](std::unique_ptr<TextureAtlas> const & owned) {
+                return owned.get() == &atlas;
+            });
             
-            if(!program.m_shaderObjects.empty())
+            if(search != m_atlases.end()) {
+                deleteTexture(atlas.m_texture);
+                m_atlases.erase(search);
+            } else {
+                std::cout << "deleteTextureAtlas: atlas not found D:" << std::endl;
+            }
+        }
+        
+        // gl thread - recycles finished pages and issues the queued uploads that fit in the frame's budget
+        void processTextureUploads(TextureStreamer & streamer) {
+            std::vector<TextureStreamer::PendingUpload> uploads;
             {
-                printf("program contains shader objects\n");
-                // check if the the shader program contains any valid objects - if it does link
-                bool isLinkable = true;
+                std::lock_guard<std::mutex> lock(streamer.m_mutex);
+                recycleStagingPages(streamer);
+                uploads.swap(streamer.m_pending);
+            }
+            
+            streamer.m_stats.bytesThisFrame   = 0;
+            streamer.m_stats.uploadsThisFrame = 0;
+            
+            if(uploads.empty()) {
+                return;
+            }
+            
+            // lowest resolution first so every texture gets something drawable before any texture gets detail
+            std::sort(uploads.begin(), uploads.end(), [](TextureStreamer::PendingUpload const & a, TextureStreamer::PendingUpload const & b) {
+                return a.level != b.level ? a.level > b.level : a.sequence < b.sequence;
+            });
+            
+            size_t issued = 0;
+            size_t bytes  = 0;
+            
+            for(; issued < uploads.size(); issued++) {
+                TextureStreamer::PendingUpload const & upload = uploads[issued];
+                size_t size = TextureStreamer::uploadSize(upload.texture, upload.width, upload.height);
                 
-                for(ShaderObject & so : program.m_shaderObjects) {
-                    if(so == OPENGL_INVALID_OBJECT) {
-                        isLinkable = false;
-                    }
+                if(streamer.m_budget != 0 && issued > 0 && bytes + size > streamer.m_budget) {
+                    break;
                 }
                 
-                if(isLinkable) {
-                    printf("program doesnt contain any invalid shader objects\n");
-                    GL_CHECK(glLinkProgram(program));
-                    
-                    GLint isLinked = GL_FALSE;
-                    
-                    GL_CHECK(glGetProgramiv(program,GL_LINK_STATUS,&isLinked));
-                    
-                    if(isLinked == GL_FALSE) {
-                        printf("program link failed");
-                        
-                        GLint maxLength = 0;
-                        GL_CHECK(glGetProgramiv(program, GL_INFO_LOG_LENGTH, &maxLength));
-                        GLchar error[maxLength]; //The maxLength includes the NULL character
-                        
-                        GL_CHECK(glGetProgramInfoLog(program, maxLength, &maxLength, error));
-                        
-                        std::cout << error << std::endl;;
-                        
-                        deleteShaderProgram(program);
-                        
-                        
-                        
-                        //Provide the infolog in whatever manner you deem best.
-                        //Exit with failure. TODO: exit with failure or error code?
-                        return;
-                    } else { // if link succesfull
-                        printf("program link successfull\n");
-                        
-                        if(deleteShaderObjects) {
-                            detachAndDeleteAllShaderObjectsFromProgram(program);
-                        } else {
-                            detachAllShaderObjectsFromProgram(program);
-                            //TODO: cache shader objects
-                        }
+                // submitted by a worker after deleteTexture() - the name may already belong to another texture
+                if(!isTextureAlive(upload.texture)) {
+                    continue;
+                }
+                
+                issueStagedUpload(streamer, upload);
+                bytes += size;
+            }
+            
+            if(streamer.m_persistent) {
+                GL_CHECK(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+            }
+            
+            std::lock_guard<std::mutex> lock(streamer.m_mutex);
+            
+            for(size_t i = 0; i < issued; i++) {
+                streamer.m_pages[uploads[i].page].pending--;
+            }
+            
+            // anything over budget goes back in front of what the workers queued meanwhile
+            streamer.m_pending.insert(streamer.m_pending.begin(), uploads.begin() + static_cast<std::ptrdiff_t>(issued), uploads.end());
+            
+            for(auto & page : streamer.m_pages) {
+                if(page.used && streamer.m_persistent) {
+                    if(page.fence != nullptr) {
+                        GL_CHECK(glDeleteSync(page.fence));
                     }
-                } else {
-                    // shader program contains invalid shader objects: TODO: handle shader object destruction
+                    GL_CHECK(page.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
                 }
-            } else {
-                printf("the program contains no shader objects\n");
+                page.used = false;
             }
+            
+            streamer.m_stats.bytesThisFrame   = bytes;
+            streamer.m_stats.uploadsThisFrame = issued;
+            streamer.m_stats.deferredUploads += uploads.size() - issued;
         }
+    
+    private:
+        struct CachedSampler {
+            GLuint             id;
+            SamplerDescription description;
+        };
         
-        void deleteShaderProgram(ShaderProgram & program) const {
-            assert(program != OPENGL_INVALID_OBJECT && "shader program being deleted is invalid");
-            detachAllShaderObjectsFromProgram(program);
-            GL_CHECK(glDeleteProgram(program));
-            program.m_id = OPENGL_INVALID_OBJECT;
-        }
+        GLint                                         m_unpackAlignment;
+        std::unordered_map<uint64_t, CachedSampler>   m_samplers;
+        float                                         m_maxAnisotropy;
+        float                                         m_anisotropyPolicy;
+        std::unordered_map<GLuint, uint32_t>          m_textures; // name -> generation
+        uint32_t                                      m_textureGeneration;
+        bool                                          m_textureStorage; // glTexStorage* - opengl 4.2 or GL_ARB_texture_storage
+        std::vector<std::unique_ptr<TextureStreamer>> m_streamers;
+        std::vector<std::unique_ptr<TextureAtlas>>    m_atlases;
+        bool                m_initialised;
         
-        void deleteShaderObject(ShaderObject & object) const {
-            assert(object != OPENGL_INVALID_OBJECT && "shader object being deleted is invalid");
-            GL_CHECK(glDeleteShader(object));
-            object.m_id = OPENGL_INVALID_OBJECT;
+        Texture makeTexture(TextureTarget target, GLenum type, TexturePixelFormat format, GLsizei width, GLsizei height, GLsizei levels, GLsizei layers = 1) {
+            assert(m_initialised && "texture layer must be initialised before creating textures");
+            assert(width > 0 && height > 0 && "texture size must be greater than 0");
+            assert(levels > 0 && levels <= mipLevelCount(width, height) && "invalid mip level count");
+            
+            Texture texture;
+            texture.m_target         = target;
+            texture.m_format         = format;
+            texture.m_type           = type;
+            texture.m_internalFormat = textureInternalFormat(type, format);
+            texture.m_width          = width;
+            texture.m_height         = height;
+            texture.m_layers         = layers;
+            texture.m_levels         = levels;
+            
+            GLenum glTarget = static_cast<GLenum>(target);
+            
+            GL_CHECK(glGenTextures(1, &texture.m_id));
+            GL_CHECK(glBindTexture(glTarget, texture.m_id));
+            
+            if(debugLabelsEnabled()) {
+                char label[64];
+                snprintf(label, sizeof(label), "texture %dx%d layers %d levels %d", width, height, layers, levels);
+                labelObject(DebugObject::TEXTURE, texture.m_id, label);
+            }
+            
+            // integer textures can not be filtered
+            GLint magFilter = textureIsInteger(type) ? GL_NEAREST : GL_LINEAR;
+            GLint minFilter = textureIsInteger(type) ? GL_NEAREST : (levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+            
+            GL_CHECK(glTexParameteri(glTarget, GL_TEXTURE_MIN_FILTER, minFilter));
+            GL_CHECK(glTexParameteri(glTarget, GL_TEXTURE_MAG_FILTER, magFilter));
+            GL_CHECK(glTexParameteri(glTarget, GL_TEXTURE_BASE_LEVEL, 0));
+            GL_CHECK(glTexParameteri(glTarget, GL_TEXTURE_MAX_LEVEL,  levels - 1));
+            
+            texture.m_generation = ++m_textureGeneration;
+            m_textures[texture.m_id] = texture.m_generation;
+            return texture;
         }
         
-    private:
-        bool m_initialised;
+        // expects the texture to be bound
+        void allocateStorage(Texture const & texture) const {
+#if OPENGL_TEXTURE_STORAGE
+            if(m_textureStorage) {
+                if(texture.m_target == TextureTarget::TEXTURE_1D) {
+                    GL_CHECK(glTexStorage1D(GL_TEXTURE_1D, texture.m_levels, texture.m_internalFormat, texture.m_width));
+                } else if(texture.m_target == TextureTarget::TEXTURE_2D_ARRAY) {
+                    GL_CHECK(glTexStorage3D(GL_TEXTURE_2D_ARRAY, texture.m_levels, texture.m_internalFormat, texture.m_width, texture.m_height, texture.m_layers));
+                } else {
+                    GL_CHECK(glTexStorage2D(GL_TEXTURE_2D, texture.m_levels, texture.m_internalFormat, texture.m_width, texture.m_height));
+                }
+                return;
+            }
+#endif
+            // no glTexStorage - every level is specified once up front and never respecified which gives the same result
+            GLenum transferFormat = textureTransferFormat(texture.m_type, texture.m_format);
+            
+            for(GLsizei level = 0; level < texture.m_levels; level++) {
+                GLsizei width  = std::max(1, texture.m_width  >> level);
+                GLsizei height = std::max(1, texture.m_height >> level);
+                
+                if(texture.isCompressed()) {
+                    GLsizei size = static_cast<GLsizei>(TextureCompressor::compressedSize(texture.m_blockFormat, static_cast<uint32_t>(width), static_cast<uint32_t>(height)));
+                    GL_CHECK(glCompressedTexImage2D(GL_TEXTURE_2D, level, texture.m_internalFormat, width, height, 0, size, nullptr));
+                } else if(texture.m_target == TextureTarget::TEXTURE_1D) {
+                    GL_CHECK(glTexImage1D(GL_TEXTURE_1D, level, static_cast<GLint>(texture.m_internalFormat), width, 0, transferFormat, texture.m_type, nullptr));
+                } else if(texture.m_target == TextureTarget::TEXTURE_2D_ARRAY) {
+                    GL_CHECK(glTexImage3D(GL_TEXTURE_2D_ARRAY, level, static_cast<GLint>(texture.m_internalFormat), width, height, texture.m_layers, 0, transferFormat, texture.m_type, nullptr));
+                } else {
+                    GL_CHECK(glTexImage2D(GL_TEXTURE_2D, level, static_cast<GLint>(texture.m_internalFormat), width, height, 0, transferFormat, texture.m_type, nullptr));
+                }
+            }
+        }
         
-        void checkOpenGLError(const char * stmt, const char * fname, int line) const {
-            // TODO: add assert functionality
-            GLenum err;
+        // nearest filtering never samples more than one texel so anisotropy stays off for it
+        void applyAnisotropy(CachedSampler const & sampler) const {
+            if(m_maxAnisotropy <= 1.0f) {
+                return;
+            }
             
-            while((err = glGetError()) != GL_NO_ERROR) {
-                std::string errorType;
+            float anisotropy = sampler.description.anisotropy == 0 ? m_anisotropyPolicy : std::min(float(sampler.description.anisotropy), m_maxAnisotropy);
+            if(sampler.description.filter == TextureFilter::NEAREST) {
+                anisotropy = 1.0f;
+            }
+            GL_CHECK(glSamplerParameterf(sampler.id, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisotropy));
+        }
+        
+        // called with the streamer's lock held - a closed page with nothing pending is free once the gpu is done with it
+        void recycleStagingPages(TextureStreamer & streamer) {
+            for(uint32_t i = 0; i < streamer.m_pages.size(); i++) {
+                TextureStreamer::StagingPage & page = streamer.m_pages[i];
+                if(!page.closed || page.pending > 0) {
+                    continue;
+                }
                 
-                switch(err) {
-                    case GL_INVALID_OPERATION:             errorType = "INVALID_OPERATION";             break;
-                    case GL_INVALID_ENUM:                  errorType = "INVALID_ENUM";                  break;
-                    case GL_INVALID_VALUE:                 errorType = "INVALID_VALUE";                 break;
-                    case GL_OUT_OF_MEMORY:                 errorType = "OUT_OF_MEMORY";                 break;
-                    case GL_INVALID_FRAMEBUFFER_OPERATION: errorType = "INVALID_FRAMEBUFFER_OPERATION"; break;
-                    default:                               errorType = "UKNOWN ERROR - FUCK SAKE";      break;
+                if(page.fence != nullptr) {
+                    GLenum result;
+                    GL_CHECK(result = glClientWaitSync(page.fence, 0, 0));
+                    if(result == GL_TIMEOUT_EXPIRED) {
+                        continue;
+                    }
+                    GL_CHECK(glDeleteSync(page.fence));
+                    page.fence = nullptr;
                 }
                 
-                std::cerr << "-----------------------------------------------------------------------------\nOPENGL ERROR: "<< errorType
-                << "\nFilename: " << fname
-                << "\nline: " << line
-                << "\nerror on: " << stmt
-                << "\n-----------------------------------------------------------------------------"
-                << std::endl;
+                page.offset = 0;
+                page.closed = false;
+                streamer.m_freePages.push_back(i);
+            }
+        }
+        
+        void issueStagedUpload(TextureStreamer & streamer, TextureStreamer::PendingUpload const & upload) {
+            Texture const & texture = upload.texture;
+            TextureStreamer::StagingPage & page = streamer.m_pages[upload.page];
+            
+            // with a pbo bound the pointer is an offset into it
+            GLvoid const * pixels = page.memory + upload.offset;
+            if(streamer.m_persistent) {
+                GL_CHECK(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, page.buffer));
+                pixels = reinterpret_cast<GLvoid const *>(static_cast<uintptr_t>(upload.offset));
+            }
+            page.used = true;
+            
+            GLenum target = static_cast<GLenum>(texture.m_target);
+            GLenum format = textureTransferFormat(texture.m_type, texture.m_format);
+            
+            setUnpackAlignment(static_cast<size_t>(upload.width) * texturePixelComponents(texture.m_format) * textureTypeSize(texture.m_type));
+            GL_CHECK(glBindTexture(target, texture.m_id));
+            
+            if(texture.m_target == TextureTarget::TEXTURE_1D) {
+                GL_CHECK(glTexSubImage1D(target, upload.level, upload.x, upload.width, format, texture.m_type, pixels));
+            } else {
+                GL_CHECK(glTexSubImage2D(target, upload.level, upload.x, upload.y, upload.width, upload.height, format, texture.m_type, pixels));
+            }
+            
+            // only whole levels count towards residency
+            GLsizei levelWidth  = std::max(1, texture.m_width  >> upload.level);
+            GLsizei levelHeight = std::max(1, texture.m_height >> upload.level);
+            if(upload.x != 0 || upload.y != 0 || upload.width != levelWidth || upload.height != levelHeight) {
+                return;
+            }
+            
+            auto inserted = streamer.m_residency.insert(std::make_pair(texture.m_id, TextureStreamer::Residency{0, texture.m_levels}));
+            TextureStreamer::Residency & residency = inserted.first->second;
+            residency.levels |= 1u << upload.level;
+            
+            GLint base = residency.baseLevel;
+            while(base > 0 && (residency.levels & (1u << (base - 1))) != 0) {
+                base--;
+            }
+            
+            if(base != residency.baseLevel) {
+                residency.baseLevel = base;
+                GL_CHECK(glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, base));
+            }
+        }
+        
+        bool isTextureAlive(Texture const & texture) const {
+            auto search = m_textures.find(texture.m_id);
+            return search != m_textures.end() && search->second == texture.m_generation;
+        }
+        
+        // drops the queued uploads and the residency of a texture that is being deleted
+        void forgetStreamedTexture(TextureStreamer & streamer, GLuint texture) {
+            std::lock_guard<std::mutex> lock(streamer.m_mutex);
+            
+            auto end = std::remove_if(streamer.m_pending.begin(), streamer.m_pending.end(), [&streamer, texture](TextureStreamer::PendingUpload const & upload) {
+                if(upload.texture.m_id != texture) {
+                    return false;
+                }
+                streamer.m_pages[upload.page].pending--;
+                return true;
+            });
+            streamer.m_pending.erase(end, streamer.m_pending.end());
+            streamer.m_residency.erase(texture);
+        }
+        
+        void destroyTextureStreamer(TextureStreamer & streamer) {
+            for(auto & page : streamer.m_pages) {
+                if(page.fence != nullptr) {
+                    GL_CHECK(glDeleteSync(page.fence));
+                    page.fence = nullptr;
+                }
+                if(page.buffer != OPENGL_INVALID_OBJECT) {
+                    GL_CHECK(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, page.buffer));
+                    GL_CHECK(glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER));
+                    GL_CHECK(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+                    GL_CHECK(glDeleteBuffers(1, &page.buffer));
+                    page.buffer = OPENGL_INVALID_OBJECT;
+                }
+            }
+            streamer.m_pages.clear();
+            streamer.m_freePages.clear();
+            streamer.m_pending.clear();
+            streamer.m_residency.clear();
+        }
+        
+        void checkUpload(Texture const & texture, TextureTarget target, GLenum type, size_t count, GLsizei width, GLsizei height, GLint level) const {
+            assert(texture != OPENGL_INVALID_OBJECT && "texture is in an invalid state");
+            assert(texture.m_target == target && "texture has a different target");
+            assert(texture.m_type == type && "pixel data type does not match the texture");
+            assert(level >= 0 && level < texture.m_levels && "mip level out of range");
+            assert(count >= static_cast<size_t>(width) * static_cast<size_t>(height) * static_cast<size_t>(texturePixelComponents(texture.m_format)) && "not enough pixel data for the upload");
+        }
+        
+        // rows of rgb bytes are not 4 byte aligned - use the largest alignment the row size allows
+        void setUnpackAlignment(size_t rowBytes) {
+            GLint alignment = rowBytes % 8 == 0 ? 8 : rowBytes % 4 == 0 ? 4 : rowBytes % 2 == 0 ? 2 : 1;
+            if(alignment != m_unpackAlignment) {
+                GL_CHECK(glPixelStorei(GL_UNPACK_ALIGNMENT, alignment));
+                m_unpackAlignment = alignment;
             }
         }
     };
 }
 
-#endif /* OpenglLayer_hpp */
+#endif /* OpenglTextureLayer_h */
@@ -6,12 +6,32 @@
 //  Copyright © 2016 Daniel Collier. All rights reserved.
 //
 
+/*
+ class information
+ - a context must be created before any of the methods in this class are used
+ - the init() function must be called before any other function in this class
+ - creating a vertex array object or attaching an instance buffer to one binds it and leaves vao 0 bound.
+   the draw layer forgets its cached bindings at the start of every processDrawCommands() so this is safe
+   between frames
+ - buffers are filled through GL_COPY_WRITE_BUFFER, never GL_ELEMENT_ARRAY_BUFFER, so creating an index buffer does
+   not change the index buffer of the vao that is bound
+ */
+
 #ifndef OpenglVertexDataLayer_h
 #define OpenglVertexDataLayer_h
 
 //generic includes
 #include <vector>
+#include <array>
 #include <iostream>
+#include <algorithm>
+#include <memory>
+#include <map>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <assert.h>
 
 // platform dependent includes
 #ifdef __APPLE__
@@ -21,14 +41,10 @@
 #include "GL/glew.h"
 #endif /* __APPLE__ */
 
-//defines
-#ifndef GL_CHECK
-#ifdef DEBUG
-#define GL_CHECK(stmt) do { stmt; checkOpenGLError(#stmt,__FILE__,__LINE__); } while(0)
-#else
-#define GL_CHECK(stmt) stmt
-#endif//DEBUG
-#endif//GL_CHECK
+//local includes
+#include "OpenglDebugLayer.h"
+#include "OpenglInformationLayer.h"
+#include "glsl/glslAttributeAndBindLocations.glsl"
 
 namespace glLayer {
     
@@ -41,6 +57,13 @@ namespace glLayer {
         INVALID        = GL_INVALID_ENUM,
         ARRAY_BUFFER   = GL_ARRAY_BUFFER,
         ELEMENT_BUFFER = GL_ELEMENT_ARRAY_BUFFER,
+        UNIFORM_BUFFER = GL_UNIFORM_BUFFER,
+    };
+    
+    enum class IndexType {
+        NONE           = 0,
+        UNSIGNED_SHORT = GL_UNSIGNED_SHORT,
+        UNSIGNED_INT   = GL_UNSIGNED_INT,
     };
     
     class VertexArrayObject {
@@ -58,27 +81,474 @@ namespace glLayer {
         GLuint m_id;
     };
     
+    /* Vertex Layouts */
+    /*----------------------------------------------------------------------------------------------*/
+    /*
+     an attribute format. Integer attributes are set up with glVertexAttribIPointer and read as ints in glsl,
+     Normalized attributes are mapped to [0, 1] or [-1, 1]. Size is the size in bytes inside the vertex and
+     is kept a multiple of 4 so every attribute stays 4 byte aligned.
+     */
+    template<GLuint Location, GLint Components, GLenum Type, bool Normalized, bool Integer, GLuint Size>
+    struct VertexAttributeFormat {
+        static constexpr GLuint location   = Location;
+        static constexpr GLint  components = Components;
+        static constexpr GLenum type       = Type;
+        static constexpr bool   normalized = Normalized;
+        static constexpr bool   integer    = Integer;
+        static constexpr GLuint size       = Size;
+        
+        static_assert(Size % 4 == 0, "vertex attributes must be a multiple of 4 bytes");
+        static_assert(!(Normalized && Integer), "integer attributes can not be normalized");
+    };
+    
+    // locations come from glsl/glslAttributeAndBindLocations.glsl so the shaders and c++ agree
+    struct Position3f       : VertexAttributeFormat<GLSL_ATTRIB_POSITION_LOCATION,   3, GL_FLOAT,                false, false, 12> {};
+    struct Position4h       : VertexAttributeFormat<GLSL_ATTRIB_POSITION_LOCATION,   4, GL_HALF_FLOAT,           false, false,  8> {};
+    struct TexCoord2f       : VertexAttributeFormat<GLSL_ATTRIB_TEX_COORDS_LOCATION, 2, GL_FLOAT,                false, false,  8> {};
+    struct TexCoord2h       : VertexAttributeFormat<GLSL_ATTRIB_TEX_COORDS_LOCATION, 2, GL_HALF_FLOAT,           false, false,  4> {};
+    struct TexCoord2us      : VertexAttributeFormat<GLSL_ATTRIB_TEX_COORDS_LOCATION, 2, GL_UNSIGNED_SHORT,       true,  false,  4> {};
+    struct Normal3f         : VertexAttributeFormat<GLSL_ATTRIB_NORMALS_LOCATION,    3, GL_FLOAT,                false, false, 12> {};
+    struct Normal10_10_10_2 : VertexAttributeFormat<GLSL_ATTRIB_NORMALS_LOCATION,    4, GL_INT_2_10_10_10_REV,   true,  false,  4> {};
+    struct Colour4ub        : VertexAttributeFormat<GLSL_ATTRIB_COLOUR_LOCATION,     4, GL_UNSIGNED_BYTE,        true,  false,  4> {};
+    struct Colour4f         : VertexAttributeFormat<GLSL_ATTRIB_COLOUR_LOCATION,     4, GL_FLOAT,                false, false, 16> {};
+    
+    // what the layer needs at runtime to call glVertexAttrib(I)Pointer
+    struct VertexAttributeDescription {
+        GLuint location;
+        GLint  components;
+        GLenum type;
+        bool   normalized;
+        bool   integer;
+        GLuint offset;
+    };
+    
+    // compile time helpers for VertexLayout
+    constexpr GLuint vertexLayoutSum() { return 0; }
+    
+    template<typename... Sizes>
+    constexpr GLuint vertexLayoutSum(GLuint first, Sizes... rest) { return first + vertexLayoutSum(rest...); }
+    
+    template<size_t Count>
+    constexpr bool vertexLayoutLocationsUnique(GLuint const (&locations)[Count]) {
+        for(size_t i = 0; i < Count; i++) {
+            for(size_t j = i + 1; j < Count; j++) {
+                if(locations[i] == locations[j]) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    
+    /*
+     interleaved vertex layout, attributes are laid out in the order given.
+     e.g. VertexLayout<Position3f, TexCoord2h, Normal10_10_10_2> is a 20 byte vertex.
+     stride, offsets and locations are all worked out at compile time.
+     */
+    template<typename... Attributes>
+    struct VertexLayout {
+        static_assert(sizeof...(Attributes) > 0, "a vertex layout needs at least one attribute");
+        static_assert(vertexLayoutLocationsUnique<sizeof...(Attributes)>({Attributes::location...}), "two attributes in the vertex layout use the same location");
+        
+        static constexpr size_t  attributeCount = sizeof...(Attributes);
+        static constexpr GLsizei stride         = static_cast<GLsizei>(vertexLayoutSum(Attributes::size...));
+        
+        static constexpr GLuint offsetOf(size_t index) {
+            const GLuint sizes[] = {Attributes::size...};
+            GLuint offset = 0;
+            for(size_t i = 0; i < index; i++) {
+                offset += sizes[i];
+            }
+            return offset;
+        }
+        
+        static constexpr std::array<VertexAttributeDescription, sizeof...(Attributes)> describe() {
+            return describe(std::index_sequence_for<Attributes...>());
+        }
+        
+    private:
+        template<size_t... Index>
+        static constexpr std::array<VertexAttributeDescription, sizeof...(Attributes)> describe(std::index_sequence<Index...>) {
+            return {{ VertexAttributeDescription{Attributes::location, Attributes::components, Attributes::type, Attributes::normalized, Attributes::integer, offsetOf(Index)}... }};
+        }
+    };
+    
+    // cpu side packing for the compact formats
+    inline uint16_t packHalfFloat(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        
+        uint32_t sign     = (bits >> 16) & 0x8000;
+        int32_t  exponent = static_cast<int32_t>((bits >> 23) & 0xFF) - 127 + 15;
+        uint32_t mantissa = bits & 0x007FFFFF;
+        
+        if(exponent <= 0) {
+            // too small for a normal half - flush to signed zero
+            return static_cast<uint16_t>(sign);
+        }
+        if(exponent >= 31) {
+            // overflow or inf/nan - clamp to inf, keep nan as nan
+            bool isNan = ((bits >> 23) & 0xFF) == 0xFF && mantissa != 0;
+            return static_cast<uint16_t>(sign | 0x7C00 | (isNan ? 0x200 : 0));
+        }
+        
+        // round to nearest
+        uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+        if(mantissa & 0x1000) {
+            half++;
+        }
+        return static_cast<uint16_t>(half);
+    }
+    
+    // x, y, z in [-1, 1] packed for GL_INT_2_10_10_10_REV with w = 0
+    inline uint32_t packNormal10_10_10_2(float x, float y, float z) {
+        auto pack = [](float v) -> uint32_t {
+            v = std::min(1.0f, std::max(-1.0f, v));
+            int32_t i = static_cast<int32_t>(v * 511.0f + (v >= 0.0f ? 0.5f : -0.5f));
+            return static_cast<uint32_t>(i) & 0x3FF;
+        };
+        return pack(x) | (pack(y) << 10) | (pack(z) << 20);
+    }
+    
+    /*
+     a vertex buffer is either its own gl buffer or a range of a shared page when buffer suballocation
+     is enabled - m_offset must then be added to every attribute/index offset.
+     */
     class VertexBufferObject {
         friend class OpenglVertexDataLayer;
         friend class OpenglDrawLayer;
     public:
-        VertexBufferObject() : m_id(OPENGL_INVALID_OBJECT), m_bufferType(BufferType::INVALID)
+        static constexpr uint32_t NOT_SUBALLOCATED = 0xFFFFFFFF;
+        
+        VertexBufferObject()
+        : m_id(OPENGL_INVALID_OBJECT)
+        , m_bufferType(BufferType::INVALID)
+        , m_offset(0)
+        , m_size(0)
+        , m_allocation(NOT_SUBALLOCATED)
         {}
         
-        bool operator==(VertexBufferObject const & rhs) { return(this->m_id == rhs.m_id); }
-        bool operator!=(VertexBufferObject const & rhs) { return(!(this->m_id == rhs.m_id)); }
+        bool operator==(VertexBufferObject const & rhs) { return(this->m_id == rhs.m_id && this->m_offset == rhs.m_offset); }
+        bool operator!=(VertexBufferObject const & rhs) { return(!(*this == rhs)); }
         operator int() const { return m_id; }
         
+        GLintptr   getOffset() const      { return m_offset; }
+        GLsizeiptr getSize() const        { return m_size; }
+        bool       isSuballocated() const { return m_allocation != NOT_SUBALLOCATED; }
+        
     private:
-        GLuint m_id;
+        GLuint     m_id;
         BufferType m_bufferType;
+        GLintptr   m_offset;
+        GLsizeiptr m_size;
+        uint32_t   m_allocation;
     };
     
-    class OpenglVertexDataLayer {
+    // an element buffer together with how to read it - created by OpenglVertexDataLayer::createIndexBufferObject()
+    struct IndexBufferObject {
+        VertexBufferObject buffer;
+        IndexType          type;
+        GLsizei            count;
         
+        GLuint indexSize() const { return type == IndexType::UNSIGNED_SHORT ? 2 : 4; }
+    };
+    
+    /*
+     best fit free list over one buffer page - only bookkeeping, no gl calls.
+     free blocks are indexed by offset (for coalescing neighbours) and by size (for best fit lookups).
+     */
+    class RangeAllocator {
     public:
-        OpenglVertexDataLayer() {
+        explicit RangeAllocator(GLsizeiptr size = 0)
+        : m_size(size)
+        , m_freeBytes(size)
+        {
+            if(size > 0) {
+                insertFree(0, size);
+            }
+        }
+        
+        bool allocate(GLsizeiptr size, GLsizeiptr alignment, GLintptr & outOffset) {
+            assert(alignment > 0 && (alignment & (alignment - 1)) == 0 && "alignment must be a power of two");
+            
+            for(auto i = m_freeBySize.lower_bound(size); i != m_freeBySize.end(); i++) {
+                GLintptr   blockOffset = i->second;
+                GLsizeiptr blockSize   = i->first;
+                GLintptr   aligned     = (blockOffset + alignment - 1) & ~(alignment - 1);
+                GLsizeiptr padding     = aligned - blockOffset;
+                
+                if(padding + size > blockSize) {
+                    continue;
+                }
+                
+                eraseFree(blockOffset, blockSize);
+                
+                if(padding > 0) {
+                    insertFree(blockOffset, padding);
+                }
+                
+                GLsizeiptr tail = blockSize - padding - size;
+                if(tail > 0) {
+                    insertFree(aligned + size, tail);
+                }
+                
+                m_freeBytes -= size;
+                outOffset = aligned;
+                return true;
+            }
+            return false;
+        }
+        
+        void free(GLintptr offset, GLsizeiptr size) {
+            m_freeBytes += size;
+            
+            // merge with the block after
+            auto next = m_freeByOffset.find(offset + size);
+            if(next != m_freeByOffset.end()) {
+                GLsizeiptr nextSize = next->second;
+                eraseFree(next->first, nextSize);
+                size += nextSize;
+            }
+            
+            // merge with the block before
+            auto after = m_freeByOffset.lower_bound(offset);
+            if(after != m_freeByOffset.begin()) {
+                auto previous = std::prev(after);
+                if(previous->first + previous->second == offset) {
+                    GLintptr   previousOffset = previous->first;
+                    GLsizeiptr previousSize   = previous->second;
+                    eraseFree(previousOffset, previousSize);
+                    offset = previousOffset;
+                    size  += previousSize;
+                }
+            }
             
+            insertFree(offset, size);
+        }
+        
+        GLsizeiptr getSize() const      { return m_size; }
+        GLsizeiptr getFreeBytes() const { return m_freeBytes; }
+        size_t getFreeBlockCount() const { return m_freeByOffset.size(); }
+        
+        GLsizeiptr getLargestFreeBlock() const {
+            return m_freeBySize.empty() ? 0 : m_freeBySize.rbegin()->first;
+        }
+        
+    private:
+        GLsizeiptr                           m_size;
+        GLsizeiptr                           m_freeBytes;
+        std::map<GLintptr, GLsizeiptr>       m_freeByOffset;
+        std::multimap<GLsizeiptr, GLintptr>  m_freeBySize;
+        
+        void insertFree(GLintptr offset, GLsizeiptr size) {
+            m_freeByOffset.emplace(offset, size);
+            m_freeBySize.emplace(size, offset);
+        }
+        
+        void eraseFree(GLintptr offset, GLsizeiptr size) {
+            m_freeByOffset.erase(offset);
+            auto range = m_freeBySize.equal_range(size);
+            for(auto i = range.first; i != range.second; i++) {
+                if(i->second == offset) {
+                    m_freeBySize.erase(i);
+                    break;
+                }
+            }
+        }
+    };
+    
+    struct BufferPoolStats {
+        size_t     pages;
+        size_t     allocations;
+        size_t     freeBlocks;
+        GLsizeiptr totalBytes;
+        GLsizeiptr usedBytes;
+        GLsizeiptr freeBytes;
+        GLsizeiptr largestFreeBlock;
+        float      fragmentation; // 1 - largestFreeBlock / freeBytes - 0 means all free space is one block
+    };
+    
+    // one float attribute inside an instance record - offset is in bytes from the start of the record
+    struct InstanceAttribute {
+        GLuint location;
+        GLint  components;
+        GLuint offset;
+    };
+    
+    /*
+     buffer of per instance records used by the draw layer when it merges commands into instanced draws.
+     every record is m_stride bytes and the attributes advance once per instance (divisor 1).
+     */
+    class InstanceBuffer {
+        friend class OpenglVertexDataLayer;
+        friend class OpenglDrawLayer;
+    public:
+        static constexpr size_t MAX_ATTRIBUTES = 4;
+        
+        InstanceBuffer()
+        : m_id(OPENGL_INVALID_OBJECT)
+        , m_stride(0)
+        , m_capacity(0)
+        , m_attributeCount(0)
+        {}
+        
+        bool operator==(InstanceBuffer const & rhs) { return(this->m_id == rhs.m_id); }
+        bool operator!=(InstanceBuffer const & rhs) { return(!(this->m_id == rhs.m_id)); }
+        operator int() const { return m_id; }
+        
+        GLsizei getStride() const { return m_stride; }
+        
+    private:
+        GLuint                                          m_id;
+        GLsizei                                         m_stride;
+        GLsizeiptr                                      m_capacity; // in bytes
+        std::array<InstanceAttribute, MAX_ATTRIBUTES>   m_attributes;
+        size_t                                          m_attributeCount;
+    };
+    
+    // memory handed out by a StreamingRingBuffer - write size bytes to data and draw from (buffer, offset)
+    struct StreamAllocation {
+        void *     data;
+        GLuint     buffer;
+        GLintptr   offset;
+        GLsizeiptr size;
+    };
+    
+    /*
+     triple buffered ring for geometry that changes every frame.
+     - the buffer is split into SEGMENT_COUNT segments, one per frame in flight
+     - with ARB_buffer_storage the whole buffer is mapped once (persistent + coherent) and the cpu writes straight
+       into it, a fence per segment makes sure the gpu has finished with a segment before it is written again.
+       the path is compiled whenever the gl headers declare glBufferStorage and picked when the context reports it
+     - without it the buffer is orphaned every time the ring wraps and each frame's segment is mapped unsynchronized
+       once, the segments in flight belong to the orphaned storage so no fences are needed
+     */
+    class StreamingRingBuffer {
+        friend class OpenglVertexDataLayer;
+    public:
+        static constexpr GLuint SEGMENT_COUNT = 3;
+        
+        StreamingRingBuffer()
+        : m_id(OPENGL_INVALID_OBJECT)
+        , m_target(GL_ARRAY_BUFFER)
+        , m_segmentSize(0)
+        , m_persistent(false)
+        , m_mapped(nullptr)
+        , m_segment(0)
+        , m_offset(0)
+        , m_segmentMapped(nullptr)
+        , m_stalls(0)
+        , m_minAlignment(1)
+        {
+            for(auto & fence : m_fences) {
+                fence = nullptr;
+            }
+        }
+        
+        StreamingRingBuffer(StreamingRingBuffer const &) = delete;
+        StreamingRingBuffer & operator=(StreamingRingBuffer const &) = delete;
+        
+        bool       isPersistentlyMapped() const { return m_persistent; }
+        GLuint     getId() const                { return m_id; }
+        GLsizeiptr getSegmentSize() const       { return m_segmentSize; }
+        GLsizeiptr getSegmentRemaining() const  { return m_segmentSize - m_offset; }
+        
+        // number of times beginStreamFrame() had to wait for the gpu - should stay at 0
+        uint64_t   getStallCount() const        { return m_stalls; }
+        
+    private:
+        GLuint     m_id;
+        GLenum     m_target;
+        GLsizeiptr m_segmentSize;
+        bool       m_persistent;
+        uint8_t *  m_mapped;
+        GLuint     m_segment;
+        GLsizeiptr m_offset;
+        uint8_t *  m_segmentMapped; // fallback path - the current segment, mapped from beginStreamFrame() to finishStreamWrites()
+        GLsync     m_fences[SEGMENT_COUNT];
+        uint64_t   m_stalls;
+        GLsizeiptr m_minAlignment; // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT for uniform rings
+    };
+    
+    /* std140 */
+    /*----------------------------------------------------------------------------------------------*/
+    /*
+     the std140 rules worked out at compile time so a c++ struct can be checked against the block it mirrors
+     
+     typedef Std140Layout<Std140Mat4, Std140Vec4, Std140Array<Std140Float, 4>> PerDrawLayout;
+     static_assert(offsetof(PerDraw, colour)  == PerDrawLayout::offsetOf<1>(), "PerDraw does not match std140");
+     static_assert(offsetof(PerDraw, weights) == PerDrawLayout::offsetOf<2>(), "PerDraw does not match std140");
+     static_assert(sizeof(PerDraw)            == PerDrawLayout::size,          "PerDraw does not match std140");
+     */
+    constexpr size_t STD140_MIN_MAX_UNIFORM_BLOCK_SIZE = 16384; // GL_MAX_UNIFORM_BLOCK_SIZE every implementation supports
+    
+    template<size_t Alignment, size_t Size>
+    struct Std140Type {
+        static constexpr size_t alignment = Alignment;
+        static constexpr size_t size      = Size;
+    };
+    
+    typedef Std140Type<4,  4>  Std140Float;
+    typedef Std140Type<4,  4>  Std140Int;
+    typedef Std140Type<4,  4>  Std140Uint;
+    typedef Std140Type<4,  4>  Std140Bool;
+    typedef Std140Type<8,  8>  Std140Vec2;
+    typedef Std140Type<16, 12> Std140Vec3; // a following scalar packs into the 4th component
+    typedef Std140Type<16, 16> Std140Vec4;
+    typedef Std140Type<16, 16> Std140IVec4;
+    typedef Std140Type<16, 48> Std140Mat3; // columns are padded to vec4
+    typedef Std140Type<16, 64> Std140Mat4;
+    
+    constexpr size_t std140RoundUp(size_t value, size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+    
+    // every array element is rounded up to the size of a vec4
+    template<typename Element, size_t Count>
+    struct Std140Array {
+        static_assert(Count > 0, "std140 arrays can not be empty");
+        static constexpr size_t stride    = std140RoundUp(Element::size, 16);
+        static constexpr size_t alignment = 16;
+        static constexpr size_t size      = stride * Count;
+    };
+    
+    // offset of member index - index == member count gives the end of the last member
+    template<typename... Members>
+    constexpr size_t std140LayoutOffset(size_t index) {
+        const size_t alignments[] = { Members::alignment... };
+        const size_t sizes[]      = { Members::size... };
+        
+        size_t offset = 0;
+        for(size_t i = 0; i < index; i++) {
+            offset = std140RoundUp(offset, alignments[i]) + sizes[i];
+        }
+        return index < sizeof...(Members) ? std140RoundUp(offset, alignments[index]) : offset;
+    }
+    
+    template<typename... Members>
+    struct Std140Layout {
+        static_assert(sizeof...(Members) > 0, "a uniform block needs at least one member");
+        
+        static constexpr size_t count = sizeof...(Members);
+        
+        // a block is padded out to a multiple of a vec4
+        static constexpr size_t size = std140RoundUp(std140LayoutOffset<Members...>(sizeof...(Members)), 16);
+        
+        template<size_t Index>
+        static constexpr size_t offsetOf() {
+            static_assert(Index < sizeof...(Members), "member index out of range");
+            return std140LayoutOffset<Members...>(Index);
+        }
+    };
+    
+    class OpenglVertexDataLayer {
+        
+    public:
+        OpenglVertexDataLayer()
+        : m_suballocationPageSize(0)
+        , m_suballocationAlignment(256)
+        , m_initialised(false)
+        {
         }
         
         ~OpenglVertexDataLayer() {
@@ -111,41 +581,153 @@ namespace glLayer {
                 GL_CHECK(glDeleteBuffers(1, &vbo.m_id));
             }
             m_vertexBuffersObjects.clear();
+            
+            //delete suballocation pages
+            for(auto & pool : m_pools) {
+                for(auto & page : pool) {
+                    GL_CHECK(glDeleteBuffers(1, &page.id));
+                }
+                pool.clear();
+            }
+            m_allocations.clear();
+            m_freeAllocationSlots.clear();
+            
+            //delete instance buffers
+            for(auto & buffer : m_instanceBuffers) {
+                GL_CHECK(glDeleteBuffers(1, &buffer.m_id));
+            }
+            m_instanceBuffers.clear();
+            
+            //delete streaming ring buffers
+            for(auto & ring : m_ringBuffers) {
+                destroyStreamingRingBuffer(*ring);
+            }
+            m_ringBuffers.clear();
+            
+            m_initialised = false;
+        }
+        
+        /*
+         after this STATIC_DRAW vertex and element buffers are packed into shared pages of pageSize bytes instead of
+         getting a buffer object each. buffers bigger than a page get a page of their own.
+         must be called before any buffers are created.
+         */
+        void enableBufferSuballocation(GLsizeiptr pageSize = 32 * 1024 * 1024, GLsizeiptr alignment = 256) {
+            assert(m_vertexBuffersObjects.empty() && m_allocations.empty() && "enable suballocation before creating buffers");
+            assert(pageSize > 0 && "page size must be greater than 0");
+            m_suballocationPageSize  = pageSize;
+            m_suballocationAlignment = alignment;
         }
         
         //TODO: add support for other variable types - double ... int ?
         VertexBufferObject createVertexBufferObject(BufferType const & bufferType, VertexBufferDrawType const & type, std::vector<float> const & vertices, size_t numVertices) {
-            VertexBufferObject vbo;
-            
-            GLenum bType = static_cast<GLenum>(bufferType);
+            return createVertexBufferObjectFromBytes(bufferType, type, &vertices[0], static_cast<GLsizeiptr>(numVertices * sizeof(float)));
+        }
+        
+        // any plain vertex or index type e.g. a vertex struct matching a VertexLayout - count is the number of elements
+        template<typename T>
+        VertexBufferObject createVertexBufferObject(BufferType const & bufferType, VertexBufferDrawType const & type, T const * data, size_t count) {
+            static_assert(std::is_trivially_copyable<T>::value, "vertex data must be trivially copyable");
+            return createVertexBufferObjectFromBytes(bufferType, type, data, static_cast<GLsizeiptr>(count * sizeof(T)));
+        }
+        
+        /*
+         stores the indices as 16 bit when every index fits (0xFFFF is left free for primitive restart) and as
+         32 bit otherwise. the buffer goes through the same path as vertex buffers so it is suballocated too.
+         */
+        IndexBufferObject createIndexBufferObject(std::vector<uint32_t> const & indices, VertexBufferDrawType const & type = VertexBufferDrawType::STATIC_DRAW) {
+            assert(!indices.empty() && "index buffer is empty");
             
-            GL_CHECK(glGenBuffers(1, &vbo.m_id));;
-            GL_CHECK(glBindBuffer(bType, vbo));
-            GL_CHECK(glBufferData(bType, numVertices * sizeof(float), &vertices[0], static_cast<GLenum>(type)));
-            GL_CHECK(glBindBuffer(bType, 0));
+            IndexBufferObject ibo;
+            ibo.count = static_cast<GLsizei>(indices.size());
+            ibo.type  = selectIndexType(*std::max_element(indices.begin(), indices.end()));
             
-            m_vertexBuffersObjects.push_back(vbo);
+            if(ibo.type == IndexType::UNSIGNED_SHORT) {
+                std::vector<uint16_t> narrow(indices.begin(), indices.end());
+                ibo.buffer = createVertexBufferObject(BufferType::ELEMENT_BUFFER, type, narrow.data(), narrow.size());
+            } else {
+                ibo.buffer = createVertexBufferObject(BufferType::ELEMENT_BUFFER, type, indices.data(), indices.size());
+            }
             
-            return vbo;
+            return ibo;
+        }
+        
+        static IndexType selectIndexType(uint32_t maxIndex) {
+            return maxIndex < 0xFFFF ? IndexType::UNSIGNED_SHORT : IndexType::UNSIGNED_INT;
         }
         
         void deleteVertexBufferObject(VertexBufferObject const & vbo) {
-            auto search = std::find(m_vertexArrayObjects.begin(), m_vertexArrayObjects.end(), vbo);
+            if(vbo.isSuballocated()) {
+                freeSuballocation(vbo.m_allocation);
+                return;
+            }
+            
+            auto search = std::find(m_vertexBuffersObjects.begin(), m_vertexBuffersObjects.end(), vbo);
             
-            if(search != m_vertexArrayObjects.end()) {
+            if(search != m_vertexBuffersObjects.end()) {
                 GL_CHECK(glDeleteBuffers(1, &search->m_id));
-                m_vertexArrayObjects.erase(search);
+                m_vertexBuffersObjects.erase(search);
             } else {
                 // not found
                 std::cout << "deleteVertexBuffer: vertexBufferObject not found D:" << std::endl;
             }
         }
         
+        // defragmentation moves suballocated buffers - this updates a copy of the handle to the new page and offset
+        void refreshVertexBufferObject(VertexBufferObject & vbo) const {
+            if(!vbo.isSuballocated()) {
+                return;
+            }
+            Suballocation const & allocation = m_allocations[vbo.m_allocation];
+            vbo.m_id     = m_pools[poolIndex(allocation.type)][allocation.page].id;
+            vbo.m_offset = allocation.offset;
+        }
+        
+        /*
+         repacks every pool whose fragmentation is above minFragmentation into as few pages as possible with
+         glCopyBufferSubData. returns how many buffers moved - refreshVertexBufferObject() must be called on
+         the handles and vaos that point into moved buffers must be rebuilt.
+         */
+        size_t defragmentVertexBuffers(float minFragmentation = 0.0f) {
+            size_t moved = 0;
+            
+            for(size_t pool = 0; pool < POOL_COUNT; pool++) {
+                BufferType type = pool == 0 ? BufferType::ARRAY_BUFFER : BufferType::ELEMENT_BUFFER;
+                BufferPoolStats stats = getBufferPoolStats(type);
+                
+                if(stats.allocations == 0 || (stats.fragmentation <= minFragmentation && stats.pages <= 1)) {
+                    continue;
+                }
+                moved += defragmentPool(pool);
+            }
+            
+            return moved;
+        }
+        
+        BufferPoolStats getBufferPoolStats(BufferType const & bufferType) const {
+            BufferPoolStats stats = {};
+            
+            for(auto const & page : m_pools[poolIndex(bufferType)]) {
+                stats.pages++;
+                stats.allocations      += page.liveAllocations;
+                stats.freeBlocks       += page.allocator.getFreeBlockCount();
+                stats.totalBytes       += page.allocator.getSize();
+                stats.freeBytes        += page.allocator.getFreeBytes();
+                stats.largestFreeBlock  = std::max(stats.largestFreeBlock, page.allocator.getLargestFreeBlock());
+            }
+            
+            stats.usedBytes     = stats.totalBytes - stats.freeBytes;
+            stats.fragmentation = stats.freeBytes > 0 ? 1.0f - float(stats.largestFreeBlock) / float(stats.freeBytes) : 0.0f;
+            
+            return stats;
+        }
+        
         VertexArrayObject createVertexArrayObject() {
             VertexArrayObject vao;
             
             GL_CHECK(glGenVertexArrays(1, &vao.m_id));
             GL_CHECK(glBindVertexArray(vao.m_id));
+            labelObject(DebugObject::VERTEX_ARRAY, vao.m_id, "vertex array object");
             GL_CHECK(glEnableVertexAttribArray(0));
             //m_vertexArrayObjects.push_back(vao);
             GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, 1));
@@ -156,35 +738,487 @@ namespace glLayer {
             return vao;
         }
         
+        /*
+         creates a vao for an interleaved buffer described by Layout. the attribute offsets include the
+         buffer's offset so suballocated buffers work. indices is optional and is bound into the vao.
+         */
+        template<typename Layout>
+        VertexArrayObject createVertexArrayObject(VertexBufferObject const & vertices, VertexBufferObject const * indices = nullptr) {
+            assert(vertices != OPENGL_INVALID_OBJECT && "vertex buffer object is in an invalid state");
+            
+            constexpr auto attributes = Layout::describe();
+            
+            VertexArrayObject vao;
+            
+            GL_CHECK(glGenVertexArrays(1, &vao.m_id));
+            GL_CHECK(glBindVertexArray(vao.m_id));
+            labelObject(DebugObject::VERTEX_ARRAY, vao.m_id, "vertex array object");
+            GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, vertices.m_id));
+            
+            for(auto const & attribute : attributes) {
+                GLvoid const * offset = reinterpret_cast<GLvoid const *>(static_cast<uintptr_t>(vertices.m_offset + attribute.offset));
+                
+                GL_CHECK(glEnableVertexAttribArray(attribute.location));
+                if(attribute.integer) {
+                    GL_CHECK(glVertexAttribIPointer(attribute.location, attribute.components, attribute.type, Layout::stride, offset));
+                } else {
+                    GL_CHECK(glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized ? GL_TRUE : GL_FALSE, Layout::stride, offset));
+                }
+            }
+            
+            if(indices != nullptr) {
+                assert(indices->m_bufferType == BufferType::ELEMENT_BUFFER && "index buffer must be an element buffer");
+                GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices->m_id));
+            }
+            
+            GL_CHECK(glBindVertexArray(0));
+            GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, 0));
+            
+            m_vertexArrayObjects.push_back(vao);
+            
+            return vao;
+        }
+        
+        template<typename Layout>
+        VertexArrayObject createVertexArrayObject(VertexBufferObject const & vertices, IndexBufferObject const & indices) {
+            return createVertexArrayObject<Layout>(vertices, &indices.buffer);
+        }
+        
+        /*
+         creates a buffer for per instance data
+         - stride is the size in bytes of one instance record
+         - maxInstances is only the initial size, the draw layer grows the storage when a frame needs more
+         - the attributes must be float attributes and there can be at most InstanceBuffer::MAX_ATTRIBUTES (a mat4 is 4 vec4s)
+         */
+        InstanceBuffer createInstanceBuffer(GLsizei stride, size_t maxInstances, std::vector<InstanceAttribute> const & attributes) {
+            assert(stride > 0 && "instance stride must be greater than 0");
+            assert(!attributes.empty() && attributes.size() <= InstanceBuffer::MAX_ATTRIBUTES && "invalid instance attribute count");
+            
+            InstanceBuffer buffer;
+            buffer.m_stride         = stride;
+            buffer.m_capacity       = static_cast<GLsizeiptr>(stride * maxInstances);
+            buffer.m_attributeCount = attributes.size();
+            std::copy(attributes.begin(), attributes.end(), buffer.m_attributes.begin());
+            
+            GL_CHECK(glGenBuffers(1, &buffer.m_id));
+            GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, buffer.m_id));
+            labelObject(DebugObject::BUFFER, buffer.m_id, "instance buffer");
+            GL_CHECK(glBufferData(GL_ARRAY_BUFFER, buffer.m_capacity, NULL, GL_STREAM_DRAW));
+            GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, 0));
+            
+            m_instanceBuffers.push_back(buffer);
+            
+            return buffer;
+        }
+        
+        void deleteInstanceBuffer(InstanceBuffer & buffer) {
+            auto search = std::find(m_instanceBuffers.begin(), m_instanceBuffers.end(), buffer);
+            
+            if(search != m_instanceBuffers.end()) {
+                GL_CHECK(glDeleteBuffers(1, &search->m_id));
+                m_instanceBuffers.erase(search);
+                buffer.m_id = OPENGL_INVALID_OBJECT;
+            } else {
+                std::cout << "deleteInstanceBuffer: instanceBuffer not found D:" << std::endl;
+            }
+        }
+        
+        // enables the instance attributes on the vao - the draw layer moves the attribute offsets per batch
+        void attachInstanceBufferToVertexArrayObject(VertexArrayObject const & vao, InstanceBuffer const & buffer) const {
+            assert(vao    != OPENGL_INVALID_OBJECT && "vertex array object is in an invalid state");
+            assert(buffer != OPENGL_INVALID_OBJECT && "instance buffer is in an invalid state");
+            
+            GL_CHECK(glBindVertexArray(vao.m_id));
+            GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, buffer.m_id));
+            
+            for(size_t i = 0; i < buffer.m_attributeCount; i++) {
+                InstanceAttribute const & attribute = buffer.m_attributes[i];
+                GL_CHECK(glEnableVertexAttribArray(attribute.location));
+                GL_CHECK(glVertexAttribPointer(attribute.location, attribute.components, GL_FLOAT, GL_FALSE, buffer.m_stride, reinterpret_cast<GLvoid const *>(static_cast<uintptr_t>(attribute.offset))));
+                GL_CHECK(glVertexAttribDivisor(attribute.location, 1));
+            }
+            
+            GL_CHECK(glBindVertexArray(0));
+            GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, 0));
+        }
+        
+        /*
+         creates a ring for per frame data. segmentSize is the most that can be written in one frame.
+         the returned reference stays valid until deleteStreamingRingBuffer() or dispose().
+         
+         per frame:
+         - beginStreamFrame()
+         - allocateStream() as often as needed, write into StreamAllocation::data. every pointer stays valid
+           until finishStreamWrites()
+         - finishStreamWrites() before drawing from the ring (a no-op when persistently mapped)
+         - endStreamFrame() after the draws that read this frame's data were submitted
+         */
+        StreamingRingBuffer & createStreamingRingBuffer(BufferType const & bufferType, GLsizeiptr segmentSize, OpenglInformationLayer const & info) {
+            assert(segmentSize > 0 && "segment size must be greater than 0");
+            
+            m_ringBuffers.emplace_back(new StreamingRingBuffer());
+            StreamingRingBuffer & ring = *m_ringBuffers.back();
+            
+            ring.m_target      = static_cast<GLenum>(bufferType);
+            
+            // segments start on an aligned offset so every allocation in them can be bound with glBindBufferRange
+            if(bufferType == BufferType::UNIFORM_BUFFER) {
+                ring.m_minAlignment = std::max<GLsizeiptr>(info.getUniformBufferOffsetAlignment(), 1);
+                segmentSize = (segmentSize + ring.m_minAlignment - 1) / ring.m_minAlignment * ring.m_minAlignment;
+            }
+            ring.m_segmentSize = segmentSize;
+            
+            GLsizeiptr totalSize = segmentSize * StreamingRingBuffer::SEGMENT_COUNT;
+            
+            // created and mapped through the copy target - an element ring bound to its own target would replace
+            // the element buffer of the bound vao
+            GL_CHECK(glGenBuffers(1, &ring.m_id));
+            GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, ring.m_id));
+            labelObject(DebugObject::BUFFER, ring.m_id, "streaming ring buffer");
+
+#if OPENGL_VERSION_AT_LEAST(4, 4) || defined(GL_ARB_buffer_storage)
+            if(info.isVersionAtLeast(4, 4) || info.hasExtension("GL_ARB_buffer_storage")) {
+                const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                GL_CHECK(glBufferStorage(GL_COPY_WRITE_BUFFER, totalSize, NULL, flags));
+                GL_CHECK(ring.m_mapped = static_cast<uint8_t *>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, totalSize, flags)));
+                ring.m_persistent = ring.m_mapped != nullptr;
+            }
+#endif
+            
+            if(!ring.m_persistent) {
+                GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, totalSize, NULL, GL_STREAM_DRAW));
+            }
+            
+            GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+            
+            // start on the last segment so the first beginStreamFrame() wraps to segment 0
+            ring.m_segment = StreamingRingBuffer::SEGMENT_COUNT - 1;
+            ring.m_offset  = segmentSize;
+            
+            return ring;
+        }
+        
+        void deleteStreamingRingBuffer(StreamingRingBuffer & ring) {
+            auto search = std::find_if(m_ringBuffers.begin(), m_ringBuffers.end(), [&ring](std::unique_ptr<StreamingRingBuffer> const & owned) {
+                return owned.get() == &ring;
+            });
+            
+            if(search != m_ringBuffers.end()) {
+                destroyStreamingRingBuffer(ring);
+                m_ringBuffers.erase(search);
+            } else {
+                std::cout << "deleteStreamingRingBuffer: ring buffer not found D:" << std::endl;
+            }
+        }
+        
+        // moves to the next segment - waits for the gpu only if it is still reading the segment from SEGMENT_COUNT frames ago
+        void beginStreamFrame(StreamingRingBuffer & ring) {
+            finishStreamWrites(ring);
+            
+            ring.m_segment = (ring.m_segment + 1) % StreamingRingBuffer::SEGMENT_COUNT;
+            ring.m_offset  = 0;
+            
+            if(ring.m_persistent) {
+                GLsync & fence = ring.m_fences[ring.m_segment];
+                if(fence != nullptr) {
+                    GLenum result;
+                    GL_CHECK(result = glClientWaitSync(fence, 0, 0));
+                    
+                    if(result == GL_TIMEOUT_EXPIRED) {
+                        ring.m_stalls++;
+                        do {
+                            GL_CHECK(result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000));
+                        } while(result == GL_TIMEOUT_EXPIRED);
+                    }
+                    
+                    GL_CHECK(glDeleteSync(fence));
+                    fence = nullptr;
+                }
+            } else {
+                GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, ring.m_id));
+                
+                // wrapped - orphan so the driver hands back fresh storage while the old frames are still in flight
+                if(ring.m_segment == 0) {
+                    GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, ring.m_segmentSize * StreamingRingBuffer::SEGMENT_COUNT, NULL, GL_STREAM_DRAW));
+                }
+                
+                // the whole segment is mapped once so every allocation of the frame shares the mapping
+                const GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+                GL_CHECK(ring.m_segmentMapped = static_cast<uint8_t *>(glMapBufferRange(GL_COPY_WRITE_BUFFER, ring.m_segment * ring.m_segmentSize, ring.m_segmentSize, access)));
+                GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+            }
+        }
+        
+        // returns an allocation with data == nullptr when the segment is full
+        StreamAllocation allocateStream(StreamingRingBuffer & ring, GLsizeiptr size, GLsizeiptr alignment = 16) {
+            assert(alignment > 0 && (alignment & (alignment - 1)) == 0 && "alignment must be a power of two");
+            alignment = std::max(alignment, ring.m_minAlignment);
+            
+            StreamAllocation allocation;
+            allocation.data   = nullptr;
+            allocation.buffer = ring.m_id;
+            allocation.offset = 0;
+            allocation.size   = size;
+            
+            GLsizeiptr start = (ring.m_offset + alignment - 1) & ~(alignment - 1);
+            if(start + size > ring.m_segmentSize) {
+                assert(false && "streaming ring buffer segment is full - increase the segment size");
+                return allocation;
+            }
+            
+            if(!ring.m_persistent && ring.m_segmentMapped == nullptr) {
+                assert(false && "allocateStream called outside beginStreamFrame() and finishStreamWrites()");
+                return allocation;
+            }
+            
+            ring.m_offset     = start + size;
+            allocation.offset = static_cast<GLintptr>(ring.m_segment * ring.m_segmentSize + start);
+            
+            if(ring.m_persistent) {
+                allocation.data = ring.m_mapped + allocation.offset;
+            } else {
+                allocation.data = ring.m_segmentMapped + start;
+            }
+            
+            return allocation;
+        }
+        
+        /*
+         one std140 block for a single draw - write it through the returned pointer and hand the allocation to
+         DrawCommand::setUniformBlock(). the ring must have been created as a BufferType::UNIFORM_BUFFER ring.
+         */
+        template<typename Layout>
+        StreamAllocation allocateUniformBlock(StreamingRingBuffer & ring) {
+            static_assert(Layout::size <= STD140_MIN_MAX_UNIFORM_BLOCK_SIZE, "uniform block is bigger than every implementation has to support");
+            assert(ring.m_target == GL_UNIFORM_BUFFER && "uniform blocks must come from a uniform buffer ring");
+            
+            return allocateStream(ring, static_cast<GLsizeiptr>(Layout::size), 16);
+        }
+        
+        // the fallback path keeps the segment mapped until this is called - must happen before the gpu reads it
+        void finishStreamWrites(StreamingRingBuffer & ring) {
+            if(ring.m_segmentMapped == nullptr) {
+                return;
+            }
+            GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, ring.m_id));
+            GL_CHECK(glUnmapBuffer(GL_COPY_WRITE_BUFFER));
+            GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+            ring.m_segmentMapped = nullptr;
+        }
+        
+        // fences the segment written this frame - call after the draws that read from it
+        void endStreamFrame(StreamingRingBuffer & ring) {
+            finishStreamWrites(ring);
+            
+            if(ring.m_persistent) {
+                GLsync & fence = ring.m_fences[ring.m_segment];
+                assert(fence == nullptr && "endStreamFrame called twice for the same segment");
+                GL_CHECK(fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+            }
+        }
         
     private:
-        std::vector<VertexBufferObject> m_vertexBuffersObjects;
-        std::vector<VertexArrayObject>  m_vertexArrayObjects;
-        bool                            m_initialised;
+        static constexpr size_t POOL_COUNT = 2; // array and element buffers
+        
+        struct BufferPage {
+            GLuint         id;
+            RangeAllocator allocator;
+            size_t         liveAllocations;
+        };
+        
+        struct Suballocation {
+            BufferType type;
+            uint32_t   page;
+            GLintptr   offset;
+            GLsizeiptr size;
+            bool       live;
+        };
+        
+        GLsizeiptr                      m_suballocationPageSize;
+        GLsizeiptr                      m_suballocationAlignment;
+        std::vector<BufferPage>         m_pools[POOL_COUNT];
+        std::vector<Suballocation>      m_allocations;
+        std::vector<uint32_t>           m_freeAllocationSlots;
+        
+        static size_t poolIndex(BufferType const & type) {
+            assert((type == BufferType::ARRAY_BUFFER || type == BufferType::ELEMENT_BUFFER) && "buffer type can not be suballocated");
+            return type == BufferType::ARRAY_BUFFER ? 0 : 1;
+        }
+        
+        VertexBufferObject createVertexBufferObjectFromBytes(BufferType const & bufferType, VertexBufferDrawType const & type, void const * data, GLsizeiptr size) {
+            if(m_suballocationPageSize > 0 && type == VertexBufferDrawType::STATIC_DRAW) {
+                return suballocateVertexBufferObject(bufferType, data, size);
+            }
+            
+            VertexBufferObject vbo;
+            vbo.m_bufferType = bufferType;
+            vbo.m_size       = size;
+            
+            // uploaded through the copy target - the element array binding belongs to the bound vao and binding
+            // an index buffer there would take the index buffer away from whichever vao the draw layer left bound
+            GL_CHECK(glGenBuffers(1, &vbo.m_id));
+            GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, vbo));
+            labelObject(DebugObject::BUFFER, vbo.m_id, "vertex buffer object");
+            GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, size, data, static_cast<GLenum>(type)));
+            GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+            
+            m_vertexBuffersObjects.push_back(vbo);
+            
+            return vbo;
+        }
+        
+        uint32_t createPage(size_t pool, GLsizeiptr size) {
+            BufferPage page;
+            page.allocator       = RangeAllocator(size);
+            page.liveAllocations = 0;
+            
+            // index pages too go through the copy target so the bound vao keeps its element buffer
+            GL_CHECK(glGenBuffers(1, &page.id));
+            GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, page.id));
+            labelObject(DebugObject::BUFFER, page.id, "suballocation page");
+            GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW));
+            GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+            
+            m_pools[pool].push_back(std::move(page));
+            return static_cast<uint32_t>(m_pools[pool].size() - 1);
+        }
+        
+        uint32_t storeSuballocation(Suballocation const & allocation) {
+            if(!m_freeAllocationSlots.empty()) {
+                uint32_t slot = m_freeAllocationSlots.back();
+                m_freeAllocationSlots.pop_back();
+                m_allocations[slot] = allocation;
+                return slot;
+            }
+            m_allocations.push_back(allocation);
+            return static_cast<uint32_t>(m_allocations.size() - 1);
+        }
+        
+        VertexBufferObject suballocateVertexBufferObject(BufferType const & bufferType, void const * data, GLsizeiptr size) {
+            size_t pool = poolIndex(bufferType);
+            
+            Suballocation allocation;
+            allocation.type = bufferType;
+            allocation.size = size;
+            allocation.live = true;
+            
+            bool found = false;
+            for(uint32_t i = 0; i < m_pools[pool].size() && !found; i++) {
+                if(m_pools[pool][i].allocator.allocate(size, m_suballocationAlignment, allocation.offset)) {
+                    allocation.page = i;
+                    found = true;
+                }
+            }
+            
+            if(!found) {
+                allocation.page = createPage(pool, std::max(m_suballocationPageSize, size));
+                found = m_pools[pool][allocation.page].allocator.allocate(size, m_suballocationAlignment, allocation.offset);
+                assert(found && "a fresh page must fit the allocation");
+            }
+            
+            BufferPage & page = m_pools[pool][allocation.page];
+            page.liveAllocations++;
+            
+            GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, page.id));
+            GL_CHECK(glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.offset, size, data));
+            GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+            
+            VertexBufferObject vbo;
+            vbo.m_id         = page.id;
+            vbo.m_bufferType = bufferType;
+            vbo.m_offset     = allocation.offset;
+            vbo.m_size       = size;
+            vbo.m_allocation = storeSuballocation(allocation);
+            
+            return vbo;
+        }
+        
+        void freeSuballocation(uint32_t index) {
+            assert(index < m_allocations.size() && m_allocations[index].live && "vertex buffer was already deleted");
+            
+            Suballocation & allocation = m_allocations[index];
+            BufferPage & page = m_pools[poolIndex(allocation.type)][allocation.page];
+            
+            page.allocator.free(allocation.offset, allocation.size);
+            page.liveAllocations--;
+            
+            allocation.live = false;
+            m_freeAllocationSlots.push_back(index);
+        }
         
-        void checkOpenGLError(const char * stmt, const char * fname, int line) const {
-            // TODO: add assert functionality
-            GLenum err;
+        size_t defragmentPool(size_t pool) {
+            // live allocations in their current page order so data keeps its relative locality
+            std::vector<uint32_t> live;
+            for(uint32_t i = 0; i < m_allocations.size(); i++) {
+                if(m_allocations[i].live && poolIndex(m_allocations[i].type) == pool) {
+                    live.push_back(i);
+                }
+            }
+            std::sort(live.begin(), live.end(), [this](uint32_t a, uint32_t b) {
+                Suballocation const & lhs = m_allocations[a];
+                Suballocation const & rhs = m_allocations[b];
+                return lhs.page != rhs.page ? lhs.page < rhs.page : lhs.offset < rhs.offset;
+            });
+            
+            std::vector<BufferPage> oldPages;
+            oldPages.swap(m_pools[pool]);
             
-            while((err = glGetError()) != GL_NO_ERROR) {
-                std::string errorType;
+            // copy everything into fresh pages - copying inside one buffer is not allowed for overlapping ranges
+            for(uint32_t index : live) {
+                Suballocation & allocation = m_allocations[index];
+                GLuint source = oldPages[allocation.page].id;
                 
-                switch(err) {
-                    case GL_INVALID_OPERATION:             errorType = "INVALID_OPERATION";             break;
-                    case GL_INVALID_ENUM:                  errorType = "INVALID_ENUM";                  break;
-                    case GL_INVALID_VALUE:                 errorType = "INVALID_VALUE";                 break;
-                    case GL_OUT_OF_MEMORY:                 errorType = "OUT_OF_MEMORY";                 break;
-                    case GL_INVALID_FRAMEBUFFER_OPERATION: errorType = "INVALID_FRAMEBUFFER_OPERATION"; break;
-                    default:                               errorType = "UKNOWN ERROR - FUCK SAKE";      break;
+                GLintptr offset = 0;
+                uint32_t pageIndex = m_pools[pool].empty() ? 0 : static_cast<uint32_t>(m_pools[pool].size() - 1);
+                
+                if(m_pools[pool].empty() || !m_pools[pool][pageIndex].allocator.allocate(allocation.size, m_suballocationAlignment, offset)) {
+                    pageIndex = createPage(pool, std::max(m_suballocationPageSize, allocation.size));
+                    m_pools[pool][pageIndex].allocator.allocate(allocation.size, m_suballocationAlignment, offset);
                 }
                 
-                std::cerr << "-----------------------------------------------------------------------------\nOPENGL ERROR: "<< errorType
-                << "\nFilename: " << fname
-                << "\nline: " << line
-                << "\nerror on: " << stmt
-                << "\n-----------------------------------------------------------------------------"
-                << std::endl;
+                GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER,  source));
+                GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, m_pools[pool][pageIndex].id));
+                GL_CHECK(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, allocation.offset, offset, allocation.size));
+                
+                m_pools[pool][pageIndex].liveAllocations++;
+                allocation.page   = pageIndex;
+                allocation.offset = offset;
+            }
+            
+            GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER,  0));
+            GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+            
+            for(auto & page : oldPages) {
+                GL_CHECK(glDeleteBuffers(1, &page.id));
+            }
+            
+            return live.size();
+        }
+        
+        std::vector<VertexBufferObject> m_vertexBuffersObjects;
+        std::vector<VertexArrayObject>  m_vertexArrayObjects;
+        std::vector<InstanceBuffer>     m_instanceBuffers;
+        std::vector<std::unique_ptr<StreamingRingBuffer>> m_ringBuffers;
+        bool                            m_initialised;
+        
+        void destroyStreamingRingBuffer(StreamingRingBuffer & ring) {
+            for(auto & fence : ring.m_fences) {
+                if(fence != nullptr) {
+                    GL_CHECK(glDeleteSync(fence));
+                    fence = nullptr;
+                }
             }
+            
+            if(ring.m_persistent || ring.m_segmentMapped != nullptr) {
+                GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, ring.m_id));
+                GL_CHECK(glUnmapBuffer(GL_COPY_WRITE_BUFFER));
+                GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+                ring.m_mapped        = nullptr;
+                ring.m_segmentMapped = nullptr;
+            }
+            
+            GL_CHECK(glDeleteBuffers(1, &ring.m_id));
+            ring.m_id = OPENGL_INVALID_OBJECT;
         }
     };
 }
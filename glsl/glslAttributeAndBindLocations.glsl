@@ -6,17 +6,22 @@
 //
 
 // can be includes in a .cpp file and a .glsl so that a binding or atrribute location change is
-// updated across both files.
+// updated across both files. the names must not start with GL_ - glsl reserves that prefix for macros.
 
 #ifndef glslAttributeAndBindLocations_h
 #define glslAttributeAndBindLocations_h
 
-#define GL_ATTRIB_POSITION_LOCATION             0
-#define GL_ATTRIB_TEX_COORDS_LOCATION           1
-#define GL_ATTRIB_NORMALS_LOCATION              2
+#define GLSL_ATTRIB_POSITION_LOCATION             0
+#define GLSL_ATTRIB_TEX_COORDS_LOCATION           1
+#define GLSL_ATTRIB_NORMALS_LOCATION              2
+#define GLSL_ATTRIB_INSTANCE_LOCATION             4 // per instance data - a mat4 uses 4 through 7
+#define GLSL_ATTRIB_COLOUR_LOCATION               8
+#define GLSL_ATTRIB_ATLAS_REGION_LOCATION         9 // per instance vec4 - u0, v0, u1, v1 of an AtlasRegion
+#define GLSL_ATTRIB_ATLAS_LAYER_LOCATION          10 // per instance float - AtlasRegion::layer
 
-#define GL_UNIFORM_MVP_LOCATION                 3
-#define GL_UNIFORM_DIFFUSE_TEXTURE_BINDING_UNIT 0
+#define GLSL_UNIFORM_MVP_LOCATION                 3
+#define GLSL_UNIFORM_DIFFUSE_TEXTURE_BINDING_UNIT 0
+#define GLSL_UNIFORM_PER_DRAW_BLOCK_BINDING       0 // uniform block the draw layer binds per draw command
 
-#end //glslAttributeAndBindLocations_h
+#endif //glslAttributeAndBindLocations_h
 